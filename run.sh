@@ -2,18 +2,38 @@
 
 GDB_WRAPPER=""
 BUILD_DIR="build"
+KERNEL="kernel"
 QEMU_EXTRA_ARGS=""
+BENCH=""
 
 if [ "$1" = "-d" ]; then
     GDB_WRAPPER="gdb --ex run --args"
     BUILD_DIR="build-debug"
     QEMU_EXTRA_ARGS="-s -S"
+elif [ "$1" = "-b" ]; then
+    # Built with the bench target, exits QEMU through semihosting when done
+    KERNEL="kernel-bench"
+    QEMU_EXTRA_ARGS="-semihosting"
+    BENCH=1
 fi
 
-${GDB_WRAPPER} qemu-system-aarch64 \
-    -machine raspi4b \
-    -kernel ${BUILD_DIR}/src/kernel/kernel \
-    -smp 4 \
-    -device loader,file=${BUILD_DIR}/src/user/init/init,addr=0x70000000,force-raw=on \
-    -nographic \
-    ${QEMU_EXTRA_ARGS}
\ No newline at end of file
+run_qemu() {
+    ${GDB_WRAPPER} qemu-system-aarch64 \
+        -machine raspi4b \
+        -kernel ${BUILD_DIR}/src/kernel/${KERNEL} \
+        -smp 4 \
+        -device loader,file=${BUILD_DIR}/src/initramfs/initramfs.img,addr=0x70000000,force-raw=on \
+        -nographic \
+        ${QEMU_EXTRA_ARGS}
+}
+
+if [ -n "${BENCH}" ]; then
+    run_qemu | tee ${BUILD_DIR}/bench.log
+    {
+        echo "name,samples,min_ns,p50_ns,p90_ns,p99_ns,max_ns"
+        tr -d '\r' < ${BUILD_DIR}/bench.log | grep '^bench,' | cut -d, -f2-
+    } > ${BUILD_DIR}/bench.csv
+    echo "Wrote ${BUILD_DIR}/bench.csv"
+else
+    run_qemu
+fi
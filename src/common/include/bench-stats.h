@@ -0,0 +1,75 @@
+#ifndef BENCH_STATS_H
+#define BENCH_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "stdio.h"
+
+/*
+ * Latency summary shared by the kernel benchmark runner and the user space
+ * benchmark program, so both report in the same machine readable format,
+ * one line per benchmark:
+ *
+ *   bench,<name>,<samples>,<min_ns>,<p50_ns>,<p90_ns>,<p99_ns>,<max_ns>
+ *
+ * run.sh -b collects these lines into a CSV file.
+ */
+
+#define BENCH_LINE_MAX 128
+
+typedef struct BenchSummary {
+  size_t samples;
+  uint64_t min;
+  uint64_t p50;
+  uint64_t p90;
+  uint64_t p99;
+  uint64_t max;
+} BenchSummary;
+
+// freq is CNTFRQ_EL0, ticks are CNTPCT_EL0 deltas
+static inline uint64_t bench_ticks_to_ns(uint64_t ticks, uint64_t freq) {
+  return ticks * 1000000000UL / freq;
+}
+
+// Nearest-rank percentile of sorted samples
+static inline uint64_t bench_percentile(const uint64_t* sorted, size_t count,
+                                        unsigned int percent) {
+  size_t rank = (count * percent + 99) / 100;
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// Sorts samples in place. Shell sort, no recursion or extra memory.
+static inline void bench_summarize(uint64_t* samples, size_t count,
+                                   BenchSummary* out) {
+  for (size_t gap = count / 2; gap > 0; gap /= 2) {
+    for (size_t i = gap; i < count; i++) {
+      uint64_t value = samples[i];
+      size_t j = i;
+      for (; j >= gap && samples[j - gap] > value; j -= gap) {
+        samples[j] = samples[j - gap];
+      }
+      samples[j] = value;
+    }
+  }
+
+  out->samples = count;
+  if (count == 0) {
+    out->min = out->p50 = out->p90 = out->p99 = out->max = 0;
+    return;
+  }
+  out->min = samples[0];
+  out->p50 = bench_percentile(samples, count, 50);
+  out->p90 = bench_percentile(samples, count, 90);
+  out->p99 = bench_percentile(samples, count, 99);
+  out->max = samples[count - 1];
+}
+
+// Returns the length of the line, newline included
+static inline int bench_format(char* buf, size_t size, const char* name,
+                               const BenchSummary* s) {
+  return snprintf(buf, size, "bench,%s,%lu,%lu,%lu,%lu,%lu,%lu\n", name,
+                  s->samples, s->min, s->p50, s->p90, s->p99, s->max);
+}
+
+#endif // BENCH_STATS_H
@@ -0,0 +1,69 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * Asynchronous I/O ring shared between a user process and the kernel.
+ *
+ * The process writes submission queue entries (SQEs) to sqes[sq_tail]
+ * and publishes them by advancing sq_tail. A kernel worker consumes them,
+ * advancing sq_head, and posts one completion queue entry (CQE) per SQE
+ * to cqes[cq_tail]. The process consumes CQEs by advancing cq_head.
+ * Indices grow without wrapping to the array size, use IO_RING_MASK.
+ */
+
+#define IO_RING_ENTRIES 256
+#define IO_RING_MASK (IO_RING_ENTRIES - 1)
+
+#if IO_RING_ENTRIES & IO_RING_MASK
+#error "IO_RING_ENTRIES must be a power of 2"
+#endif
+
+// Setup flags
+// Kernel worker polls the submission queue, no syscall needed to submit
+#define IO_RING_SETUP_SQPOLL 0x1
+
+// sq_flags
+// SQPOLL worker went idle and sleeps, submit with io_ring_enter
+#define IO_RING_SQ_NEED_WAKEUP 0x1
+
+// Operations, fields used are listed for each
+#define IO_OP_NOP    0
+#define IO_OP_OPEN   1  // addr = path, flags, mode
+#define IO_OP_CLOSE  2  // fd
+#define IO_OP_READ   3  // fd, addr = buffer, len
+#define IO_OP_WRITE  4  // fd, addr = buffer, len
+#define IO_OP_PREAD  5  // fd, addr = buffer, len, offset
+#define IO_OP_PWRITE 6  // fd, addr = buffer, len, offset
+
+typedef struct IORingSQE {
+  uint32_t opcode;
+  int32_t fd;
+  uint64_t addr;
+  uint64_t len;
+  int64_t offset;
+  uint32_t flags;
+  uint32_t mode;
+  uint64_t user_data;  // Passed back as is in the CQE
+} IORingSQE;
+
+typedef struct IORingCQE {
+  uint64_t user_data;
+  int64_t res;  // Return value of the operation
+} IORingCQE;
+
+typedef struct IORing {
+  _Atomic uint32_t sq_head;  // Written by kernel
+  _Atomic uint32_t sq_tail;  // Written by user
+  _Atomic uint32_t cq_head;  // Written by user
+  _Atomic uint32_t cq_tail;  // Written by kernel
+  uint32_t flags;
+  _Atomic uint32_t sq_flags; // Written by kernel
+  uint32_t sq_pending;       // User private, SQEs taken but not yet submitted
+  IORingSQE sqes[IO_RING_ENTRIES];
+  IORingCQE cqes[IO_RING_ENTRIES];
+} IORing;
+
+#endif // IO_RING_H
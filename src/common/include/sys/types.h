@@ -7,5 +7,6 @@
 typedef long long ssize_t;
 typedef int pid_t;
 typedef unsigned long mode_t;
+typedef long long off_t;
 
 #endif // TYPES_H
\ No newline at end of file
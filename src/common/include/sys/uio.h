@@ -0,0 +1,14 @@
+#ifndef UIO_H
+#define UIO_H
+
+#include <sys/types.h>
+
+// Max number of buffers in one readv/writev call
+#define IOV_MAX 16
+
+struct iovec {
+  void* iov_base;
+  size_t iov_len;
+};
+
+#endif // UIO_H
@@ -12,6 +12,18 @@
 #define SYS_WRITE   21
 #define SYS_READ    22
 #define SYS_CLOSE   23
+#define SYS_PREAD   24
+#define SYS_PWRITE  25
+#define SYS_READV   26
+#define SYS_WRITEV  27
+
+// Asynchronous I/O
+#define SYS_IO_RING_SETUP 30
+#define SYS_IO_RING_ENTER 31
+
+// Synchronization
+#define SYS_FUTEX_WAIT 40
+#define SYS_FUTEX_WAKE 41
 
 #define MAX_SYSCALL_PARAMS 6
 
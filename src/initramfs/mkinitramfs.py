@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""Packs files into a LaOS initramfs image, see src/kernel/initramfs.h.
+
+Usage: mkinitramfs.py -o <image> <path in image>=<host file> ...
+
+Parent directories of the given paths are created automatically.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"LAOSIRFS"
+VERSION = 1
+BLOCK_SIZE = 64 * 1024
+ENTRY_DIR = 0x1
+
+HEADER_FORMAT = "<8sIIIIII"
+ENTRY_FORMAT = "<IIIIIIII"
+
+# LZ4 block format constraints
+MIN_MATCH = 4
+LAST_LITERALS = 5
+MF_LIMIT = 12
+MAX_OFFSET = 0xFFFF
+HASH_BITS = 16
+
+
+def _write_length(out, length):
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+
+def _emit_sequence(out, literals, match_length, offset):
+    lit_len = len(literals)
+    token = min(lit_len, 15) << 4
+    if match_length is not None:
+        token |= min(match_length - MIN_MATCH, 15)
+    out.append(token)
+    if lit_len >= 15:
+        _write_length(out, lit_len - 15)
+    out += literals
+    if match_length is not None:
+        out += struct.pack("<H", offset)
+        if match_length - MIN_MATCH >= 15:
+            _write_length(out, match_length - MIN_MATCH - 15)
+
+
+def lz4_compress_block(data):
+    """Greedy LZ4 block compressor with a single entry hash table."""
+    n = len(data)
+    out = bytearray()
+    table = {}
+    anchor = 0
+    i = 0
+    match_limit = n - MF_LIMIT
+
+    while i < match_limit:
+        key = data[i:i + MIN_MATCH]
+        candidate = table.get(key)
+        table[key] = i
+
+        if candidate is None or i - candidate > MAX_OFFSET:
+            i += 1
+            continue
+
+        # Extend the match, last literals must stay literals
+        length = MIN_MATCH
+        limit = n - LAST_LITERALS
+        while i + length < limit and data[candidate + length] == data[i + length]:
+            length += 1
+
+        _emit_sequence(out, data[anchor:i], length, i - candidate)
+        i += length
+        anchor = i
+
+    _emit_sequence(out, data[anchor:], None, 0)
+    return bytes(out)
+
+
+def pack_file_data(data):
+    """Returns block table followed by blocks, offsets relative to the table."""
+    blocks = []
+    for start in range(0, len(data), BLOCK_SIZE):
+        raw = data[start:start + BLOCK_SIZE]
+        compressed = lz4_compress_block(raw)
+        # Incompressible blocks are stored as is, sizes tell them apart
+        blocks.append(compressed if len(compressed) < len(raw) else raw)
+
+    table_size = (len(blocks) + 1) * 4
+    offsets = [table_size]
+    for block in blocks:
+        offsets.append(offsets[-1] + len(block))
+
+    return offsets, b"".join(blocks)
+
+
+def build_image(files):
+    # Entry 0 is the root, directories are implied by file paths
+    paths = ["/"]
+    is_dir = {"/": True}
+    for path in sorted(files):
+        parts = path.strip("/").split("/")
+        for depth in range(1, len(parts) + 1):
+            sub = "/" + "/".join(parts[:depth])
+            if sub not in is_dir:
+                paths.append(sub)
+                is_dir[sub] = depth < len(parts)
+            elif depth == len(parts) or not is_dir[sub]:
+                sys.exit(f"mkinitramfs: conflicting path {sub}")
+
+    index = {path: i for i, path in enumerate(paths)}
+
+    strings = bytearray()
+    name_offsets = []
+    for path in paths:
+        name_offsets.append(len(strings))
+        strings += path.encode() + b"\0"
+
+    header_size = struct.calcsize(HEADER_FORMAT)
+    entry_size = struct.calcsize(ENTRY_FORMAT)
+    entry_table_offset = header_size
+    string_table_offset = entry_table_offset + len(paths) * entry_size
+    data_offset = (string_table_offset + len(strings) + 3) & ~3
+
+    entries = bytearray()
+    data = bytearray()
+    for i, path in enumerate(paths):
+        parent = path.rsplit("/", 1)[0] or "/"
+        parent_index = index[parent] if path != "/" else 0
+
+        if is_dir[path]:
+            entries += struct.pack(ENTRY_FORMAT, name_offsets[i], ENTRY_DIR,
+                                   0, 0, 0, parent_index, 0, 0)
+            continue
+
+        with open(files[path], "rb") as f:
+            contents = f.read()
+
+        table_offset = data_offset + len(data)
+        offsets, blocks = pack_file_data(contents)
+        for offset in offsets:
+            data += struct.pack("<I", table_offset + offset)
+        data += blocks
+        data += b"\0" * (-len(data) % 4)  # Keep block tables aligned
+
+        entries += struct.pack(ENTRY_FORMAT, name_offsets[i], 0, table_offset,
+                               len(blocks), len(contents), parent_index, 0, 0)
+
+    image_size = data_offset + len(data)
+    header = struct.pack(HEADER_FORMAT, MAGIC, VERSION, len(paths),
+                         entry_table_offset, string_table_offset, image_size, 0)
+
+    image = header + entries + strings
+    image += b"\0" * (data_offset - len(image))
+    return image + data
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Create LaOS initramfs image")
+    parser.add_argument("-o", "--output", required=True, help="output image")
+    parser.add_argument("files", nargs="+", metavar="PATH=FILE",
+                        help="absolute path in image and file to read it from")
+    args = parser.parse_args()
+
+    files = {}
+    for spec in args.files:
+        path, sep, host_file = spec.partition("=")
+        if not sep or not path.startswith("/") or path == "/":
+            sys.exit(f"mkinitramfs: invalid file spec {spec}")
+        files[path.rstrip("/")] = host_file
+
+    image = build_image(files)
+    with open(args.output, "wb") as f:
+        f.write(image)
+
+
+if __name__ == "__main__":
+    main()
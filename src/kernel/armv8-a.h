@@ -5,6 +5,7 @@
 
 #define USE_SMP 1
 #define NUM_CPUS 4
+#define CACHE_LINE_SIZE 64
 
 /* REGISTER GETTER GENERATORS */
 
@@ -80,6 +81,26 @@ MAKE_MOV_GETTER_64(GET_X8, x8)
 MAKE_MRS_GETTER_32(GET_TIMER_FREQ, cntfrq_el0)
 MAKE_MRS_GETTER_64(GET_TIMER_COUNT, cntpct_el0)
 
+// Lets EL0 read CNTPCT_EL0 and CNTFRQ_EL0 on the calling CPU (CNTKCTL_EL1.EL0PCTEN)
+#define ENABLE_EL0_TIMER_COUNT() \
+    asm volatile ("mrs x0, cntkctl_el1\n" \
+                  "orr x0, x0, #1\n" \
+                  "msr cntkctl_el1, x0\n" \
+                  "isb\n" ::: "x0", "memory")
+
+/* PMU */
+
+MAKE_MRS_GETTER_64(GET_CYCLE_COUNT, pmccntr_el0)
+
+// Starts PMCCNTR_EL0 on the calling CPU (PMCR_EL0.E, PMCNTENSET_EL0.C)
+#define ENABLE_CYCLE_COUNTER() \
+    asm volatile ("mrs x0, pmcr_el0\n" \
+                  "orr x0, x0, #1\n" \
+                  "msr pmcr_el0, x0\n" \
+                  "mov x0, #(1 << 31)\n" \
+                  "msr pmcntenset_el0, x0\n" \
+                  "isb\n" ::: "x0", "memory")
+
 #define SET_PHYS_TIMER_VALUE(tval) \
     asm volatile ("msr cntp_tval_el0, %0" : : "r"(tval))
 
@@ -109,6 +130,12 @@ MAKE_MRS_GETTER_64(GET_TIMER_COUNT, cntpct_el0)
 #define WRITE_AS_EL0_8(addr, val) \
     asm volatile ("sttrb %w0, [%1]" : : "r"(val), "r"(addr))
 
+#define READ_AS_EL0_32(addr) ({ \
+    uint32_t val; \
+    asm volatile ("ldtr %w0, [%1]" : "=r"(val) : "r"(addr)); \
+    val; \
+})
+
 #define READ_AS_EL0_64(addr) ({ \
     uint64_t val; \
     asm volatile ("ldtr %0, [%1]" : "=r"(val) : "r"(addr)); \
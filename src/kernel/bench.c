@@ -0,0 +1,280 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bench.h"
+#include "bench-stats.h"
+#include "armv8-a.h"
+#include "fcntl.h"
+#include "io.h"
+#include "memory.h"
+#include "mmu.h"
+#include "percpu.h"
+#include "process.h"
+#include "sched.h"
+#include "sem.h"
+#include "serial-tx.h"
+#include "vfs.h"
+
+#define BENCH_SAMPLES       1000
+#define BENCH_FILE          "/bench"
+#define BENCH_IO_SIZE       4096
+#define BENCH_USER_PROGRAM  "/sbin/bench"
+#define BENCH_USER_POLL_US  10000
+#define BENCH_USER_TIMEOUT_US 60000000UL
+
+// Each sample times a batch of operations and stores the per-operation
+// average, so operations shorter than a CNTPCT tick still resolve
+static uint64_t samples[BENCH_SAMPLES];
+static _Atomic bool bench_running = false;
+
+// Helper tasks on this or another CPU, stopped through these
+static _Atomic bool helper_stop;
+static _Atomic bool helper_started;
+static _Atomic bool helper_done;
+
+static KSemaphore ping = K_SEM_INIT(0, 1);
+static KSemaphore pong = K_SEM_INIT(0, 1);
+
+static void report(const char* name, size_t count) {
+  BenchSummary summary;
+  bench_summarize(samples, count, &summary);
+
+  char line[BENCH_LINE_MAX];
+  (void)bench_format(line, sizeof(line), name, &summary);
+  k_puts_wait(line);
+}
+
+static void run_bench(const char* name, void (*op)(void*), void* arg,
+                      uint32_t batch) {
+  uint64_t freq = GET_TIMER_FREQ();
+
+  for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+    uint64_t start = GET_TIMER_COUNT();
+    for (uint32_t j = 0; j < batch; j++) {
+      op(arg);
+    }
+    uint64_t end = GET_TIMER_COUNT();
+    samples[i] = bench_ticks_to_ns(end - start, freq) / batch;
+  }
+
+  report(name, BENCH_SAMPLES);
+}
+
+static bool start_helper(uint32_t cpu, void (*task_func)(void*)) {
+  atomic_store(&helper_stop, false);
+  atomic_store(&helper_started, false);
+  atomic_store(&helper_done, false);
+
+  if (sched_create_kernel_task_on(cpu, task_func, NULL) == NO_TASK) {
+    return false;
+  }
+  while (!atomic_load(&helper_started)) {
+    sched_yield();
+  }
+  return true;
+}
+
+static void wait_helper_done(void) {
+  while (!atomic_load(&helper_done)) {
+    sched_yield();
+  }
+}
+
+/* Context switch: a task on the same CPU yields straight back */
+
+static void yield_helper_task(void* arg) {
+  (void)arg;
+  atomic_store(&helper_started, true);
+  while (!atomic_load(&helper_stop)) {
+    sched_yield();
+  }
+  atomic_store(&helper_done, true);
+  sched_terminate_cpu_current_task();
+}
+
+static void op_yield(void* arg) {
+  (void)arg;
+  sched_yield();
+}
+
+static void bench_context_switch(void) {
+  if (!start_helper(THIS_CPU_ID(), yield_helper_task)) {
+    k_printf("bench: failed to create context switch helper\n");
+    return;
+  }
+  // Two switches per yield, to the helper and back
+  run_bench("ctx_switch_rt", op_yield, NULL, 1);
+  atomic_store(&helper_stop, true);
+  wait_helper_done();
+}
+
+/* Semaphore ping-pong with a task on the next CPU */
+
+static void pong_helper_task(void* arg) {
+  (void)arg;
+  atomic_store(&helper_started, true);
+  while (1) {
+    (void)k_sem_wait(&ping);
+    if (atomic_load(&helper_stop)) {
+      break;
+    }
+    (void)k_sem_post(&pong);
+  }
+  atomic_store(&helper_done, true);
+  sched_terminate_cpu_current_task();
+}
+
+static void op_ping_pong(void* arg) {
+  (void)arg;
+  (void)k_sem_post(&ping);
+  (void)k_sem_wait(&pong);
+}
+
+static void bench_sem_ping_pong(void) {
+  uint32_t cpu = (THIS_CPU_ID() + 1) % NUM_CPUS;
+  if (!start_helper(cpu, pong_helper_task)) {
+    k_printf("bench: failed to create ping-pong helper on CPU%u\n", cpu);
+    return;
+  }
+  run_bench("sem_ping_pong_rt", op_ping_pong, NULL, 1);
+  atomic_store(&helper_stop, true);
+  (void)k_sem_post(&ping);
+  wait_helper_done();
+}
+
+/* k_malloc */
+
+static void op_kmalloc_free(void* arg) {
+  (void)arg;
+  k_free(k_malloc(64));
+}
+
+/* VFS on the RamFS root */
+
+typedef struct VfsBenchArg {
+  VFSFileDescriptor* fd;
+  void* buffer;
+} VfsBenchArg;
+
+static void op_vfs_open_close(void* arg) {
+  (void)arg;
+  VFSFileDescriptor* fd = vfs_open(BENCH_FILE, O_RDWR, 0);
+  if (fd != NULL) {
+    vfs_close(fd);
+  }
+}
+
+static void op_vfs_pwrite(void* arg) {
+  VfsBenchArg* a = arg;
+  (void)vfs_pwrite(a->fd, a->buffer, BENCH_IO_SIZE, 0);
+}
+
+static void op_vfs_pread(void* arg) {
+  VfsBenchArg* a = arg;
+  (void)vfs_pread(a->fd, a->buffer, BENCH_IO_SIZE, 0);
+}
+
+static void bench_vfs(void) {
+  VfsBenchArg arg = { .buffer = k_zalloc(BENCH_IO_SIZE) };
+  if (arg.buffer == NULL) {
+    k_printf("bench: failed to allocate VFS buffer\n");
+    return;
+  }
+
+  arg.fd = vfs_open(BENCH_FILE, O_CREAT | O_RDWR, 0);
+  if (arg.fd == NULL) {
+    k_printf("bench: failed to create %s\n", BENCH_FILE);
+    goto free_buffer;
+  }
+
+  run_bench("vfs_open_close", op_vfs_open_close, NULL, 1);
+  run_bench("vfs_pwrite_4k", op_vfs_pwrite, &arg, 1);
+  run_bench("vfs_pread_4k", op_vfs_pread, &arg, 1);
+
+  vfs_close(arg.fd);
+  (void)vfs_remove(BENCH_FILE);
+free_buffer:
+  k_free(arg.buffer);
+}
+
+/* User address space switch, L1 entry rewrite and local TLB invalidate */
+
+static void op_tlb_switch(void* arg) {
+  uint64_t** tables = arg;
+  mmu_set_user_l2_table(tables[0]);
+  mmu_set_user_l2_table(tables[1]);
+}
+
+static void bench_tlb_switch(void) {
+  // Empty tables, only the switch itself is measured
+  uint64_t* tables[2] = { k_zalloc(4096), k_zalloc(4096) };
+  if (tables[0] != NULL && tables[1] != NULL) {
+    run_bench("tlb_switch", op_tlb_switch, tables, 8);
+    // Kernel tasks run without user mappings
+    mmu_set_user_l2_table(NULL);
+  } else {
+    k_printf("bench: failed to allocate L2 tables\n");
+  }
+  k_free(tables[0]);
+  k_free(tables[1]);
+}
+
+/* Syscall and fork latency are timed from EL0 by /sbin/bench */
+
+static void bench_user(void) {
+  pid_t pid = process_spawn(BENCH_USER_PROGRAM, THIS_CPU_ID());
+  if (pid < 0) {
+    k_printf("bench: failed to start %s\n", BENCH_USER_PROGRAM);
+    return;
+  }
+
+  uint64_t waited_us = 0;
+  while (process_exists(pid)) {
+    if (waited_us >= BENCH_USER_TIMEOUT_US) {
+      k_printf("bench: %s (PID %d) timed out\n", BENCH_USER_PROGRAM, pid);
+      return;
+    }
+    sched_sleep_cpu_current_task(BENCH_USER_POLL_US);
+    waited_us += BENCH_USER_POLL_US;
+  }
+}
+
+void bench_run(void) {
+  bool expected = false;
+  if (!atomic_compare_exchange_strong(&bench_running, &expected, true)) {
+    k_printf("bench: already running\n");
+    return;
+  }
+
+  k_printf("bench: CPU%u, %u samples, CNTFRQ %u Hz\n", THIS_CPU_ID(),
+           BENCH_SAMPLES, GET_TIMER_FREQ());
+
+  bench_context_switch();
+  bench_sem_ping_pong();
+  run_bench("kmalloc_free_64", op_kmalloc_free, NULL, 16);
+  bench_vfs();
+  bench_tlb_switch();
+  bench_user();
+
+  k_printf("bench: done\n");
+  atomic_store(&bench_running, false);
+}
+
+// Semihosting SYS_EXIT with ADP_Stopped_ApplicationExit
+static void __attribute__((noreturn)) semihosting_exit(void) {
+  static const uint64_t block[2] = { 0x20026, 0 };
+  asm volatile ("mov x0, #0x18\n"
+                "mov x1, %0\n"
+                "hlt #0xf000\n" :: "r"(block) : "x0", "x1", "memory");
+  while (1) {
+    WAIT_FOR_INTERRUPT();
+  }
+}
+
+void bench_boot_task(void* arg) {
+  (void)arg;
+  bench_run();
+  serial_tx_flush();
+  semihosting_exit();
+}
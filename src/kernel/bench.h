@@ -0,0 +1,13 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Runs the kernel microbenchmarks on the calling CPU, then /sbin/bench for
+// the user space ones, and waits for it. Prints one line per benchmark in
+// the format of bench-stats.h. Call from a kernel task, one run at a time.
+void bench_run(void);
+
+// Task for kernels built with BENCH_ON_BOOT: runs the suite, flushes the
+// console and exits QEMU through semihosting (needs -semihosting)
+void bench_boot_task(void* arg);
+
+#endif // BENCH_H
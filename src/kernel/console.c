@@ -7,6 +7,14 @@
 #include "vfs.h"
 #include "memory.h"
 #include "process.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "irq-bench.h"
+#include "bench.h"
+#include "klog.h"
+#include "trace.h"
+#include "profile.h"
+#include "serial-tx.h"
 
 #define WELCOME "Welcome to LaOS"
 #define LINE_MAX 256
@@ -224,6 +232,183 @@ void command_cat(char** argv, size_t argc) {
   k_printf("\n");
 }
 
+void command_lockstat(char** argv, size_t argc) {
+  (void)argv;
+  (void)argc;
+  spinlock_stats_print();
+}
+
+// Leading decimal digits of s, 0 if there are none
+static uint64_t parse_uint(const char* s) {
+  uint64_t value = 0;
+  for (const char* p = s; *p >= '0' && *p <= '9'; p++) {
+    value = value * 10 + (uint64_t)(*p - '0');
+  }
+  return value;
+}
+
+void command_meminfo(char** argv, size_t argc) {
+  if (argc > 1 && !strcmp(argv[1], "callers")) {
+    k_malloc_callers_print();
+    return;
+  }
+  k_malloc_stats_print();
+  k_printf_wait("console output dropped %lu B\n", serial_tx_dropped());
+}
+
+void command_irqbench(char** argv, size_t argc) {
+  uint32_t iterations = 1000;
+  if (argc > 1) {
+    iterations = (uint32_t)parse_uint(argv[1]);
+  }
+  irq_bench_run(iterations);
+}
+
+void command_bench(char** argv, size_t argc) {
+  (void)argv;
+  (void)argc;
+  bench_run();
+}
+
+void command_loglevel(char** argv, size_t argc) {
+  if (argc < 2) {
+    k_printf("Usage: loglevel <debug|info>\n");
+    return;
+  }
+  if (!strcmp(argv[1], "debug")) {
+    klog_set_console_level(KLOG_DEBUG);
+  }
+  else if (!strcmp(argv[1], "info")) {
+    klog_set_console_level(KLOG_INFO);
+  }
+  else {
+    k_printf("loglevel: unknown level %s\n", argv[1]);
+  }
+}
+
+void command_trace(char** argv, size_t argc) {
+  if (argc < 2) {
+    k_printf("Usage: trace <start|stop|dump>\n");
+    return;
+  }
+  if (!strcmp(argv[1], "start")) {
+    trace_start();
+  }
+  else if (!strcmp(argv[1], "stop")) {
+    trace_stop();
+  }
+  else if (!strcmp(argv[1], "dump")) {
+    trace_dump();
+  }
+  else {
+    k_printf("trace: unknown subcommand %s\n", argv[1]);
+  }
+}
+
+void command_profile(char** argv, size_t argc) {
+  if (argc < 2) {
+    k_printf("Usage: profile <start [cycles|instructions] [period]|stop|dump>\n");
+    return;
+  }
+  if (!strcmp(argv[1], "start")) {
+    ProfileSource source = PROFILE_CYCLES;
+    uint64_t period = 1000000;
+    if (argc > 2 && !strcmp(argv[2], "instructions")) {
+      source = PROFILE_INSTRUCTIONS;
+    }
+    else if (argc > 2 && strcmp(argv[2], "cycles")) {
+      k_printf("profile: unknown source %s\n", argv[2]);
+      return;
+    }
+    if (argc > 3) {
+      period = parse_uint(argv[3]);
+    }
+    if (profile_start(source, period) != 0) {
+      k_printf("profile: failed to start, check the period\n");
+    }
+  }
+  else if (!strcmp(argv[1], "stop")) {
+    profile_stop();
+  }
+  else if (!strcmp(argv[1], "dump")) {
+    profile_dump();
+  }
+  else {
+    k_printf("profile: unknown subcommand %s\n", argv[1]);
+  }
+}
+
+#define TOP_MAX_TASKS 128
+
+// Prints x/total as a percentage with one decimal
+static void print_percent(uint64_t x, uint64_t total) {
+  uint64_t permille = total > 0 ? x * 1000 / total : 0;
+  k_printf_wait("%lu.%lu%%", permille / 10, permille % 10);
+}
+
+// CPU shares are over the time since the previous call, or since boot
+void command_top(char** argv, size_t argc) {
+  (void)argv;
+  (void)argc;
+  static TaskStats stats[TOP_MAX_TASKS];
+  static struct {
+    task_id_t id;
+    uint64_t runtime_us;
+  } prev[TOP_MAX_TASKS];
+  static size_t prev_count = 0;
+  static uint64_t prev_now_us = 0;
+
+  uint64_t now_us;
+  size_t total = sched_get_task_stats(stats, TOP_MAX_TASKS, &now_us);
+  size_t count = total < TOP_MAX_TASKS ? total : TOP_MAX_TASKS;
+  uint64_t interval_us = now_us - prev_now_us;
+
+  uint64_t delta[TOP_MAX_TASKS];
+  for (size_t i = 0; i < count; i++) {
+    delta[i] = stats[i].runtime_us;
+    for (size_t j = 0; j < prev_count; j++) {
+      if (prev[j].id == stats[i].id) {
+        delta[i] -= prev[j].runtime_us;
+        break;
+      }
+    }
+  }
+
+  // Idle tasks come first, one per CPU
+  for (size_t i = 0; i < count && stats[i].idle; i++) {
+    k_printf_wait("CPU%u idle ", stats[i].cpu_id);
+    print_percent(delta[i], interval_us);
+    k_printf_wait("\t");
+  }
+  k_printf_wait("\nID\tCPU\tPID\tPRIO\tSTATE\tCPU%%\tRUN ms\tWAIT ms\tVOL\tINVOL\n");
+
+  for (size_t i = 0; i < count; i++) {
+    if (stats[i].idle) {
+      continue;
+    }
+    k_printf_wait("%ld\t%u\t", stats[i].id, stats[i].cpu_id);
+    if (stats[i].type == TASK_TYPE_USER) {
+      k_printf_wait("%d\t", stats[i].pid);
+    } else {
+      k_printf_wait("-\t");
+    }
+    k_printf_wait("%u\t%s\t", stats[i].priority, stats[i].state);
+    print_percent(delta[i], interval_us);
+    k_printf_wait("\t%lu\t%lu\t%u\t%u\n", stats[i].runtime_us / 1000, stats[i].wait_us / 1000,
+                  stats[i].nr_voluntary, stats[i].nr_involuntary);
+  }
+  if (total > count) {
+    k_printf_wait("%lu more tasks not shown\n", total - count);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    prev[i].id = stats[i].id;
+    prev[i].runtime_us = stats[i].runtime_us;
+  }
+  prev_count = count;
+  prev_now_us = now_us;
+}
+
 static void exec_command(const char* command) {
   StringTokens s = tokenize_string(command, ' ');
   if (s.count == 0 || strlen(s.tokens[0]) == 0) {
@@ -249,6 +434,30 @@ static void exec_command(const char* command) {
   else if (!strcmp(s.tokens[0], "cat")) {
     command_cat(s.tokens, s.count);
   }
+  else if (!strcmp(s.tokens[0], "lockstat")) {
+    command_lockstat(s.tokens, s.count);
+  }
+  else if (!strcmp(s.tokens[0], "meminfo")) {
+    command_meminfo(s.tokens, s.count);
+  }
+  else if (!strcmp(s.tokens[0], "irqbench")) {
+    command_irqbench(s.tokens, s.count);
+  }
+  else if (!strcmp(s.tokens[0], "bench")) {
+    command_bench(s.tokens, s.count);
+  }
+  else if (!strcmp(s.tokens[0], "loglevel")) {
+    command_loglevel(s.tokens, s.count);
+  }
+  else if (!strcmp(s.tokens[0], "trace")) {
+    command_trace(s.tokens, s.count);
+  }
+  else if (!strcmp(s.tokens[0], "top") || !strcmp(s.tokens[0], "ps")) {
+    command_top(s.tokens, s.count);
+  }
+  else if (!strcmp(s.tokens[0], "profile")) {
+    command_profile(s.tokens, s.count);
+  }
   else {
     k_printf("Unknown command: %s\n", s.tokens[0]);
   }
@@ -0,0 +1,33 @@
+// Voluntary context switch, see sched_switch in sched.c
+
+.section .text
+
+.equ PT_REGS_SP_EL0,   248
+.equ PT_REGS_ELR_EL1,  256
+.equ PT_REGS_SIZE,     272
+
+// void context_switch_save(TaskContext* ctx, Task* next, uint64_t spsr)
+// Builds a PtRegs frame (pt-regs.h) that resumes at the return address
+// with spsr, so that the task is resumed by the same exception return as
+// after an IRQ. Only callee-saved registers are stored, the caller has
+// given up the rest.
+.global context_switch_save
+context_switch_save:
+    sub sp, sp, #PT_REGS_SIZE
+    stp x19, x20, [sp, #152]
+    stp x21, x22, [sp, #168]
+    stp x23, x24, [sp, #184]
+    stp x25, x26, [sp, #200]
+    stp x27, x28, [sp, #216]
+    stp x29, x30, [sp, #232]
+    mrs x9, sp_el0
+    adr x10, resume
+    str x9, [sp, #PT_REGS_SP_EL0]
+    stp x10, x2, [sp, #PT_REGS_ELR_EL1]  // elr_el1, spsr_el1
+    mov x9, sp
+    str x9, [x0]            // ctx->regs
+    mov x0, x1
+    bl sched_switch_finish  // Doesn't return
+resume:
+    // Exception return has popped the frame and restored x19-x30
+    ret
@@ -43,44 +43,63 @@ vector_table_el1:
     b handle_serror_exception_lower_32 // SError
 
 
-// Push context macro
-.macro PUSH_CONTEXT
-    stp x0, x1, [sp, #-16]!
-    stp x2, x3, [sp, #-16]!
-    stp x4, x5, [sp, #-16]!
-    stp x6, x7, [sp, #-16]!
-    stp x8, x9, [sp, #-16]!
-    stp x10, x11, [sp, #-16]!
-    stp x12, x13, [sp, #-16]!
-    stp x14, x15, [sp, #-16]!
-    stp x16, x17, [sp, #-16]!
-    stp x18, x19, [sp, #-16]!
-    stp x20, x21, [sp, #-16]!
-    stp x22, x23, [sp, #-16]!
-    stp x24, x25, [sp, #-16]!
-    stp x26, x27, [sp, #-16]!
-    stp x28, x29, [sp, #-16]!
-    str x30, [sp, #-8]!
+// Exception frame, PtRegs in pt-regs.h. Built in one sweep below the
+// interrupted sp, with ELR, SPSR and SP_EL0 so that every exit (including
+// a switch to another task) restores the full state from it.
+.equ PT_REGS_SP_EL0,   248
+.equ PT_REGS_ELR_EL1,  256
+.equ PT_REGS_SPSR_EL1, 264
+.equ PT_REGS_SIZE,     272
+
+.macro KERNEL_ENTRY
+    sub sp, sp, #PT_REGS_SIZE
+    stp x0, x1, [sp, #0]
+    stp x2, x3, [sp, #16]
+    stp x4, x5, [sp, #32]
+    stp x6, x7, [sp, #48]
+    stp x8, x9, [sp, #64]
+    stp x10, x11, [sp, #80]
+    stp x12, x13, [sp, #96]
+    stp x14, x15, [sp, #112]
+    stp x16, x17, [sp, #128]
+    stp x18, x19, [sp, #144]
+    stp x20, x21, [sp, #160]
+    stp x22, x23, [sp, #176]
+    stp x24, x25, [sp, #192]
+    stp x26, x27, [sp, #208]
+    stp x28, x29, [sp, #224]
+    // x21-x23 are saved, x0-x7 stay intact for the syscall arguments
+    mrs x21, sp_el0
+    mrs x22, elr_el1
+    mrs x23, spsr_el1
+    stp x30, x21, [sp, #240]
+    stp x22, x23, [sp, #PT_REGS_ELR_EL1]
 .endm
 
-// Pop context macro
-.macro POP_CONTEXT
-    ldr x30, [sp], #8
-    ldp x28, x29, [sp], #16
-    ldp x26, x27, [sp], #16
-    ldp x24, x25, [sp], #16
-    ldp x22, x23, [sp], #16
-    ldp x20, x21, [sp], #16
-    ldp x18, x19, [sp], #16
-    ldp x16, x17, [sp], #16
-    ldp x14, x15, [sp], #16
-    ldp x12, x13, [sp], #16
-    ldp x10, x11, [sp], #16
-    ldp x8, x9, [sp], #16
-    ldp x6, x7, [sp], #16
-    ldp x4, x5, [sp], #16
-    ldp x2, x3, [sp], #16
-    ldp x0, x1, [sp], #16
+.macro KERNEL_EXIT
+    ldp x21, x22, [sp, #PT_REGS_ELR_EL1]
+    ldr x23, [sp, #PT_REGS_SP_EL0]
+    msr elr_el1, x21
+    msr spsr_el1, x22
+    msr sp_el0, x23
+    ldp x0, x1, [sp, #0]
+    ldp x2, x3, [sp, #16]
+    ldp x4, x5, [sp, #32]
+    ldp x6, x7, [sp, #48]
+    ldp x8, x9, [sp, #64]
+    ldp x10, x11, [sp, #80]
+    ldp x12, x13, [sp, #96]
+    ldp x14, x15, [sp, #112]
+    ldp x16, x17, [sp, #128]
+    ldp x18, x19, [sp, #144]
+    ldp x20, x21, [sp, #160]
+    ldp x22, x23, [sp, #176]
+    ldp x24, x25, [sp, #192]
+    ldp x26, x27, [sp, #208]
+    ldp x28, x29, [sp, #224]
+    ldr x30, [sp, #240]
+    add sp, sp, #PT_REGS_SIZE
+    eret
 .endm
 
 
@@ -90,44 +109,53 @@ handle_sync_exception_sp0:
 handle_sync_exception_spx:
 handle_sync_exception_lower_64:
 handle_sync_exception_lower_32:
-    PUSH_CONTEXT
+    KERNEL_ENTRY
     // Check exception syndrome reg for syscall
     mrs x9, esr_el1
     lsr x9, x9, #26
     cmp x9, #0x15
     beq is_syscall
+    cmp x9, #0x07           // FP/SIMD access trapped by CPACR_EL1
+    beq is_fpsimd_access
     bl sync_exception_handler
-    b ret_from_sync_exception
+    b ret_from_exception
 is_syscall:
     bl syscall_handler
-ret_from_sync_exception:
-    POP_CONTEXT
-    eret
+    b ret_from_exception
+is_fpsimd_access:
+    bl fpsimd_access_handler
+    b ret_from_exception
 
 handle_irq_exception_sp0:
 handle_irq_exception_spx:
 handle_irq_exception_lower_64:
 handle_irq_exception_lower_32:
-    PUSH_CONTEXT
+    KERNEL_ENTRY
     mov x0, sp
     bl irq_exception_handler
-    POP_CONTEXT
-    eret
+    b ret_from_exception
 
 handle_fiq_exception_sp0:
 handle_fiq_exception_spx:
 handle_fiq_exception_lower_64:
 handle_fiq_exception_lower_32:
-    PUSH_CONTEXT
+    KERNEL_ENTRY
     bl fiq_exception_handler
-    POP_CONTEXT
-    eret
+    b ret_from_exception
 
 handle_serror_exception_sp0:
 handle_serror_exception_spx:
 handle_serror_exception_lower_64:
 handle_serror_exception_lower_32:
-    PUSH_CONTEXT
+    KERNEL_ENTRY
     bl serror_exception_handler
-    POP_CONTEXT
-    eret
+    b ret_from_exception
+
+// void exception_return(PtRegs* regs)
+// Resumes whatever state regs holds, on the stack it is on. The scheduler
+// uses it to switch to a task, its frame is on top of its stack.
+.global exception_return
+exception_return:
+    mov sp, x0
+ret_from_exception:
+    KERNEL_EXIT
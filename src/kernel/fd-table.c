@@ -0,0 +1,179 @@
+#include "string.h"
+
+#include "fd-table.h"
+#include "memory.h"
+
+
+static inline bool fd_in_use(FDTable* table, int fd) {
+  return (table->used[fd / 64] & (1UL << (fd % 64))) != 0;
+}
+
+static inline void mark_fd(FDTable* table, int fd, bool in_use) {
+  if (in_use) {
+    table->used[fd / 64] |= (1UL << (fd % 64));
+  } else {
+    table->used[fd / 64] &= ~(1UL << (fd % 64));
+  }
+}
+
+// Find lowest free fd below capacity with one bitmap scan per 64 fds,
+// returns -1 if none. Lock must be held.
+static int find_free_fd(FDTable* table) {
+  for (uint32_t word = 0; word < FD_BITMAP_WORDS; word++) {
+    uint64_t free_bits = ~table->used[word];
+    if (free_bits != 0) {
+      int fd = word * 64 + __builtin_ctzl(free_bits);
+      return (fd < (int)table->capacity) ? fd : -1;
+    }
+  }
+  return -1;
+}
+
+// Grow table to fit at least min_capacity fds. Lock must be held.
+static int grow_table(FDTable* table, uint32_t min_capacity) {
+  // Capacity 0 means fd_table_destroy ran, a stale Process* may still
+  // reach the table. Don't bring it back to life.
+  if (min_capacity > FD_TABLE_MAX_SIZE || table->capacity == 0) {
+    return -1;
+  }
+
+  uint32_t new_capacity = table->capacity;
+  while (new_capacity < min_capacity) {
+    new_capacity *= 2;
+  }
+
+  VFSFileDescriptor** new_files = k_zalloc(new_capacity * sizeof(VFSFileDescriptor*));
+  if (new_files == NULL) {
+    return -1;
+  }
+
+  memcpy(new_files, table->files, table->capacity * sizeof(VFSFileDescriptor*));
+  k_free(table->files);
+  table->files = new_files;
+  table->capacity = new_capacity;
+
+  return 0;
+}
+
+int fd_table_init(FDTable* table) {
+  memset(table, 0, sizeof(FDTable));
+
+  table->files = k_zalloc(FD_TABLE_INITIAL_SIZE * sizeof(VFSFileDescriptor*));
+  if (table->files == NULL) {
+    return -1;
+  }
+  table->capacity = FD_TABLE_INITIAL_SIZE;
+
+  return 0;
+}
+
+void fd_table_destroy(FDTable* table) {
+  spinlock_acquire(&table->lock);
+
+  for (uint32_t fd = 0; fd < table->capacity; fd++) {
+    if (fd_in_use(table, fd)) {
+      vfs_close(table->files[fd]);
+    }
+  }
+
+  k_free(table->files);
+  table->files = NULL;
+  table->capacity = 0;
+  memset(table->used, 0, sizeof(table->used));
+
+  spinlock_release(&table->lock);
+}
+
+int fd_table_clone(FDTable* dest, FDTable* src) {
+  int ret = 0;
+
+  spinlock_acquire(&src->lock);
+  spinlock_acquire(&dest->lock);
+
+  if (dest->capacity < src->capacity && grow_table(dest, src->capacity) != 0) {
+    ret = -1;
+    goto out;
+  }
+
+  for (uint32_t fd = 0; fd < src->capacity; fd++) {
+    if (fd_in_use(src, fd)) {
+      dest->files[fd] = vfs_dup(src->files[fd]);
+      mark_fd(dest, fd, true);
+    }
+  }
+
+out:
+  spinlock_release(&dest->lock);
+  spinlock_release(&src->lock);
+  return ret;
+}
+
+int fd_table_install(FDTable* table, VFSFileDescriptor* file) {
+  spinlock_acquire(&table->lock);
+
+  int fd = find_free_fd(table);
+  if (fd == -1) {
+    // All fds below capacity are in use, next free one is at the old capacity
+    fd = table->capacity;
+    if (grow_table(table, table->capacity + 1) != 0) {
+      spinlock_release(&table->lock);
+      return -1;
+    }
+  }
+
+  table->files[fd] = file;
+  mark_fd(table, fd, true);
+
+  spinlock_release(&table->lock);
+  return fd;
+}
+
+int fd_table_install_at(FDTable* table, int fd, VFSFileDescriptor* file) {
+  if (fd < 0 || fd >= FD_TABLE_MAX_SIZE) {
+    return -1;
+  }
+
+  spinlock_acquire(&table->lock);
+
+  if ((uint32_t)fd >= table->capacity && grow_table(table, fd + 1) != 0) {
+    spinlock_release(&table->lock);
+    return -1;
+  }
+
+  if (fd_in_use(table, fd)) {
+    spinlock_release(&table->lock);
+    return -1;
+  }
+
+  table->files[fd] = file;
+  mark_fd(table, fd, true);
+
+  spinlock_release(&table->lock);
+  return fd;
+}
+
+VFSFileDescriptor* fd_table_get(FDTable* table, int fd) {
+  VFSFileDescriptor* file = NULL;
+
+  spinlock_acquire(&table->lock);
+  if (fd >= 0 && (uint32_t)fd < table->capacity && fd_in_use(table, fd)) {
+    file = vfs_dup(table->files[fd]);
+  }
+  spinlock_release(&table->lock);
+
+  return file;
+}
+
+VFSFileDescriptor* fd_table_remove(FDTable* table, int fd) {
+  VFSFileDescriptor* file = NULL;
+
+  spinlock_acquire(&table->lock);
+  if (fd >= 0 && (uint32_t)fd < table->capacity && fd_in_use(table, fd)) {
+    file = table->files[fd];
+    table->files[fd] = NULL;
+    mark_fd(table, fd, false);
+  }
+  spinlock_release(&table->lock);
+
+  return file;
+}
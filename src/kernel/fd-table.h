@@ -0,0 +1,45 @@
+#ifndef FD_TABLE_H
+#define FD_TABLE_H
+
+#include <stdint.h>
+
+#include "vfs.h"
+#include "spinlock.h"
+
+#define FD_TABLE_INITIAL_SIZE 16
+#define FD_TABLE_MAX_SIZE 256
+#define FD_BITMAP_WORDS (FD_TABLE_MAX_SIZE / 64)
+
+#if FD_TABLE_MAX_SIZE % 64
+#error "FD_TABLE_MAX_SIZE must be a multiple of 64"
+#endif
+
+// Per-process file descriptor table. Maps fds to shared open file objects.
+// Grows on demand from FD_TABLE_INITIAL_SIZE up to FD_TABLE_MAX_SIZE entries.
+typedef struct FDTable {
+  VFSFileDescriptor** files;
+  uint32_t capacity;
+  uint64_t used[FD_BITMAP_WORDS];  // Bit set if fd is in use
+  Spinlock lock;
+} FDTable;
+
+int fd_table_init(FDTable* table);
+// Closes all fds and frees the table
+void fd_table_destroy(FDTable* table);
+// Makes dest share all open files of src, dest must be initialized
+int fd_table_clone(FDTable* dest, FDTable* src);
+
+// Installs file to lowest free fd, returns the fd or -1 if table is full.
+// Takes over the caller's reference to file.
+int fd_table_install(FDTable* table, VFSFileDescriptor* file);
+// Installs file to the given fd, returns -1 if it is already in use
+int fd_table_install_at(FDTable* table, int fd, VFSFileDescriptor* file);
+
+// Returns a new reference to the open file at fd, or NULL.
+// Drop the reference with vfs_close after use.
+VFSFileDescriptor* fd_table_get(FDTable* table, int fd);
+
+// Removes fd from table and returns its reference to the open file, or NULL
+VFSFileDescriptor* fd_table_remove(FDTable* table, int fd);
+
+#endif // FD_TABLE_H
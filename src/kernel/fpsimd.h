@@ -0,0 +1,41 @@
+#ifndef FPSIMD_H
+#define FPSIMD_H
+
+#include <stdint.h>
+
+// The kernel is built with -mgeneral-regs-only and never touches these
+// registers, so only user tasks have FP/SIMD state. It is switched lazily:
+// EL0 traps on first use after a switch (CPACR_EL1.FPEN), and the state is
+// only moved when another task's state is still in the registers.
+
+#define CPACR_EL1_FPEN_SHIFT 20
+#define CPACR_EL1_FPEN_TRAP_EL0 (1UL << CPACR_EL1_FPEN_SHIFT)
+#define CPACR_EL1_FPEN_NO_TRAP  (3UL << CPACR_EL1_FPEN_SHIFT)
+
+// Exception class in ESR_EL1 for a trapped FP/SIMD access
+#define ESR_EC_FPSIMD_ACCESS 0x07
+
+typedef struct FPSIMDState {
+  uint64_t vregs[32][2];  // q0-q31
+  uint32_t fpsr;
+  uint32_t fpcr;
+} __attribute__((aligned(16))) FPSIMDState;
+
+// Offsets used by fpsimd.s
+_Static_assert(__builtin_offsetof(FPSIMDState, fpsr) == 512, "fpsimd.s expects fpsr at 512");
+_Static_assert(__builtin_offsetof(FPSIMDState, fpcr) == 516, "fpsimd.s expects fpcr at 516");
+
+// Copy the registers to or from state, EL1 access must not be trapped
+extern void fpsimd_save(FPSIMDState* state);
+extern void fpsimd_load(const FPSIMDState* state);
+
+// EL1 never traps. The next eret synchronizes the change.
+static inline void fpsimd_trap_el0(void) {
+  __asm__ __volatile__ ("msr cpacr_el1, %0" :: "r"(CPACR_EL1_FPEN_TRAP_EL0) : "memory");
+}
+
+static inline void fpsimd_allow_el0(void) {
+  __asm__ __volatile__ ("msr cpacr_el1, %0" :: "r"(CPACR_EL1_FPEN_NO_TRAP) : "memory");
+}
+
+#endif // FPSIMD_H
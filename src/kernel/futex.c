@@ -0,0 +1,112 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "futex.h"
+#include "armv8-a.h"
+#include "sched.h"
+#include "spinlock.h"
+
+// Lives on the stack of the waiting task while it's queued
+typedef struct FutexWaiter {
+  pid_t pid;
+  uintptr_t uaddr;
+  Task* task;
+  _Atomic bool woken;
+  struct FutexWaiter* next;
+} FutexWaiter;
+
+typedef struct FutexBucket {
+  Spinlock lock;
+  FutexWaiter* head;
+  FutexWaiter* tail;
+} FutexBucket;
+
+static FutexBucket futex_table[FUTEX_HASH_BUCKETS];
+
+static inline FutexBucket* get_bucket(pid_t pid, uintptr_t uaddr) {
+  // Words are 4 byte aligned, low bits carry no information
+  uint64_t key = (uaddr >> 2) ^ ((uint64_t)pid * 0x9E3779B97F4A7C15ULL);
+  key ^= key >> 29;
+  return &futex_table[key % FUTEX_HASH_BUCKETS];
+}
+
+int futex_wait(pid_t pid, uint32_t* uaddr, uint32_t expected) {
+  uintptr_t addr = (uintptr_t)uaddr;
+  if (addr == 0 || (addr & 0x3) != 0) {
+    return -1;
+  }
+
+  FutexBucket* bucket = get_bucket(pid, addr);
+
+  FutexWaiter waiter = {
+    .pid = pid,
+    .uaddr = addr,
+    .task = sched_get_cpu_current_task(),
+    .woken = false,
+    .next = NULL
+  };
+
+  spinlock_acquire(&bucket->lock);
+
+  // Waker changes the value before calling futex_wake, so checking it
+  // under the bucket lock closes the window for a lost wakeup
+  if (READ_AS_EL0_32(uaddr) != expected) {
+    spinlock_release(&bucket->lock);
+    return -1;
+  }
+
+  if (bucket->tail != NULL) {
+    bucket->tail->next = &waiter;
+  } else {
+    bucket->head = &waiter;
+  }
+  bucket->tail = &waiter;
+
+  spinlock_release(&bucket->lock);
+
+  while (!atomic_load_explicit(&waiter.woken, memory_order_acquire)) {
+    sched_block_current_task_unless(&waiter.woken);
+  }
+
+  return 0;
+}
+
+int futex_wake(pid_t pid, uint32_t* uaddr, int count) {
+  uintptr_t addr = (uintptr_t)uaddr;
+  FutexBucket* bucket = get_bucket(pid, addr);
+  int woken = 0;
+
+  spinlock_acquire(&bucket->lock);
+
+  FutexWaiter* prev = NULL;
+  FutexWaiter* w = bucket->head;
+  while (w != NULL && woken < count) {
+    FutexWaiter* next = w->next;
+
+    if (w->pid != pid || w->uaddr != addr) {
+      prev = w;
+      w = next;
+      continue;
+    }
+
+    // Unlink
+    if (prev != NULL) {
+      prev->next = next;
+    } else {
+      bucket->head = next;
+    }
+    if (bucket->tail == w) {
+      bucket->tail = prev;
+    }
+
+    // Waiter may return and free its stack as soon as woken is set
+    sched_wake_task_if(w->task, &w->woken);
+
+    woken++;
+    w = next;
+  }
+
+  spinlock_release(&bucket->lock);
+
+  return woken;
+}
@@ -0,0 +1,24 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <stdint.h>
+#include "sys/types.h"
+
+#define FUTEX_HASH_BUCKETS 64
+
+// Waiters are keyed by (pid, uaddr). A process has a single task and fork
+// copies memory instead of sharing it, so today nothing else can ever wake
+// a waiter: futex_wait only returns without blocking, when the value has
+// already changed. Useful once threads or shared mappings exist.
+
+// Blocks the calling task until woken with futex_wake, if the 32-bit user
+// word at uaddr still contains expected. The check and queueing are atomic
+// with respect to futex_wake. User L2 table of pid must be loaded.
+// Returns 0 when woken, -1 if the value didn't match or uaddr is invalid.
+int futex_wait(pid_t pid, uint32_t* uaddr, uint32_t expected);
+
+// Wakes up to count tasks waiting on uaddr of process pid.
+// Returns number of tasks woken.
+int futex_wake(pid_t pid, uint32_t* uaddr, int count);
+
+#endif // FUTEX_H
@@ -35,6 +35,8 @@
 #define C_PMR 0x04
 
 #define C_IAR 0x0C
+#define GICC_IAR_INTID_MASK 0x3FF
+#define GICC_IAR_SPURIOUS   1023u
 
 #define C_EOIR 0x10
 
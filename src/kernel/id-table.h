@@ -0,0 +1,66 @@
+#ifndef ID_TABLE_H
+#define ID_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Intrusive hash table from integer id to object, for task and process
+// lookups. Ids are handed out sequentially, so the low bits alone spread
+// them evenly and a lookup is O(1) for up to a few thousand live objects.
+// No locking, callers serialize writers. Lookups walk at most count nodes,
+// so they also terminate when racing a writer under a SeqCount, as long as
+// nodes are never freed back to the allocator.
+
+#define ID_TABLE_BUCKETS 1024
+
+#if ID_TABLE_BUCKETS & (ID_TABLE_BUCKETS - 1)
+#error "ID_TABLE_BUCKETS must be a power of 2"
+#endif
+
+typedef struct IdTableNode {
+  int64_t id;
+  struct IdTableNode* next;
+} IdTableNode;
+
+typedef struct IdTable {
+  IdTableNode* buckets[ID_TABLE_BUCKETS];
+  size_t count;
+} IdTable;
+
+#define ID_TABLE_ENTRY(node_ptr, type, member) \
+  ((type*)((uint8_t*)(node_ptr) - offsetof(type, member)))
+
+static inline IdTableNode** id_table_bucket(IdTable* table, int64_t id) {
+  return &table->buckets[(uint64_t)id & (ID_TABLE_BUCKETS - 1)];
+}
+
+static inline void id_table_insert(IdTable* table, IdTableNode* node, int64_t id) {
+  IdTableNode** bucket = id_table_bucket(table, id);
+  node->id = id;
+  node->next = *bucket;
+  *bucket = node;
+  table->count++;
+}
+
+static inline IdTableNode* id_table_find(IdTable* table, int64_t id) {
+  IdTableNode* node = *id_table_bucket(table, id);
+  for (size_t steps = 0; node != NULL && steps <= table->count; steps++) {
+    if (node->id == id) {
+      return node;
+    }
+    node = node->next;
+  }
+  return NULL;
+}
+
+static inline void id_table_remove(IdTable* table, IdTableNode* node) {
+  for (IdTableNode** link = id_table_bucket(table, node->id); *link != NULL; link = &(*link)->next) {
+    if (*link == node) {
+      *link = node->next;
+      table->count--;
+      return;
+    }
+  }
+}
+
+#endif // ID_TABLE_H
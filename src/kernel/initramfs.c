@@ -0,0 +1,413 @@
+#include <stdatomic.h>
+#include "fcntl.h"
+#include "string.h"
+
+#include "initramfs.h"
+#include "lz4.h"
+#include "memory.h"
+#include "spinlock.h"
+
+#define INITRAMFS_MAX_ENTRIES 128
+#define INITRAMFS_MAX_FILE_SIZE (2 * 1024 * 1024)  // Largest k_malloc block
+#define INITRAMFS_MAX_BLOCKS (INITRAMFS_MAX_FILE_SIZE / INITRAMFS_BLOCK_SIZE)
+#define ROOT_IDX 0
+
+_Static_assert(INITRAMFS_MAX_BLOCKS <= 32, "Block bitmap is 32 bits");
+
+// Decompressed contents of a file, created on first access and freed when
+// the last handle is closed. Files over 4 KB take a 2 MB k_malloc object,
+// those are too scarce to keep for files nobody has open.
+typedef struct InitRamFSCache {
+  Spinlock lock;  // Serializes decompression, open_count and freeing
+  uint8_t* data;
+  _Atomic uint32_t valid_blocks;  // Bitmap of decompressed blocks
+  uint32_t open_count;
+} InitRamFSCache;
+
+typedef struct InitRamFSHandle {
+  uint32_t index;
+  size_t offset;
+} InitRamFSHandle;
+
+typedef struct InitRamFS {
+  const uint8_t* image;
+  const InitRamFSHeader* header;
+  const InitRamFSEntry* entries;
+  const char* strings;
+  InitRamFSCache cache[INITRAMFS_MAX_ENTRIES];
+} InitRamFS;
+
+static InitRamFS initramfs;
+
+
+static void* initramfs_open(void *fs_data, const char *path, int flags, mode_t mode);
+static ssize_t initramfs_read(void *fs_data, void *file, void *buffer, size_t size);
+static ssize_t initramfs_write(void *fs_data, void *file, const void *buffer, size_t size);
+static ssize_t initramfs_pread(void *fs_data, void *file, void *buffer, size_t size, off_t offset);
+static ssize_t initramfs_pwrite(void *fs_data, void *file, const void *buffer, size_t size, off_t offset);
+static int initramfs_close(void *fs_data, void *file);
+static int initramfs_seek(void *fs_data, void *file, size_t offset);
+static int initramfs_mkdir(void* fs_data, const char* path);
+static int initramfs_readdir(void* fs_data, void* handle, char* buffer, size_t size);
+static int initramfs_remove(void* fs_data, const char* path);
+static int initramfs_stat(void* fs_data, const char* path, VFSStat* stat);
+
+VFSInterface initramfs_if = {
+  .open = initramfs_open,
+  .read = initramfs_read,
+  .write = initramfs_write,
+  .pread = initramfs_pread,
+  .pwrite = initramfs_pwrite,
+  .close = initramfs_close,
+  .seek = initramfs_seek,
+  .mkdir = initramfs_mkdir,
+  .readdir = initramfs_readdir,
+  .remove = initramfs_remove,
+  .stat = initramfs_stat
+};
+
+VFSInterface* initramfs_get_vfs_interface(void) {
+  return &initramfs_if;
+}
+
+void* initramfs_init(const void* image, size_t max_size) {
+  const InitRamFSHeader* header = (const InitRamFSHeader*)image;
+
+  if (max_size < sizeof(InitRamFSHeader)) {
+    return NULL;
+  }
+
+  for (unsigned i = 0; i < INITRAMFS_MAGIC_LEN; i++) {
+    if (header->magic[i] != INITRAMFS_MAGIC[i]) {
+      return NULL;
+    }
+  }
+
+  if (header->version != INITRAMFS_VERSION ||
+      header->image_size > max_size ||
+      header->num_entries == 0 ||
+      header->num_entries > INITRAMFS_MAX_ENTRIES) {
+    return NULL;
+  }
+
+  // Entry and string tables must be inside the image, entries are
+  // otherwise validated when they are used
+  size_t entries_end = (size_t)header->entry_table_offset
+                       + header->num_entries * sizeof(InitRamFSEntry);
+  if (entries_end > header->string_table_offset ||
+      header->string_table_offset >= header->image_size) {
+    return NULL;
+  }
+
+  InitRamFS* fs = &initramfs;
+  memset(fs, 0, sizeof(InitRamFS));
+  fs->image = (const uint8_t*)image;
+  fs->header = header;
+  fs->entries = (const InitRamFSEntry*)(fs->image + header->entry_table_offset);
+  fs->strings = (const char*)(fs->image + header->string_table_offset);
+
+  if (!(fs->entries[ROOT_IDX].flags & INITRAMFS_ENTRY_DIR)) {
+    return NULL;
+  }
+
+  return fs;
+}
+
+static const char* entry_path(InitRamFS* fs, const InitRamFSEntry* entry) {
+  size_t offset = (size_t)fs->header->string_table_offset + entry->name_offset;
+  if (offset >= fs->header->image_size) {
+    return NULL;
+  }
+  return fs->strings + entry->name_offset;
+}
+
+static int find_entry(InitRamFS* fs, const char* path) {
+  static const char root_str[2] = {PATH_SEPARATOR, '\0'};
+
+  if (path[0] == '\0') {
+    // Mount point itself
+    path = root_str;
+  }
+
+  for (uint32_t i = 0; i < fs->header->num_entries; i++) {
+    const char* entry_name = entry_path(fs, &fs->entries[i]);
+    if (entry_name != NULL && strcmp(entry_name, path) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int decompress_block(InitRamFS* fs, const InitRamFSEntry* entry,
+                            uint8_t* dest, uint32_t block) {
+  const uint32_t num_blocks =
+    (entry->size + INITRAMFS_BLOCK_SIZE - 1) / INITRAMFS_BLOCK_SIZE;
+  const size_t table_end = (size_t)entry->data_offset + (num_blocks + 1) * sizeof(uint32_t);
+
+  if (table_end > fs->header->image_size) {
+    return -1;
+  }
+
+  const uint32_t* block_table = (const uint32_t*)(fs->image + entry->data_offset);
+  uint32_t start = block_table[block];
+  uint32_t end = block_table[block + 1];
+
+  if (start > end || end > fs->header->image_size) {
+    return -1;
+  }
+
+  size_t block_offset = (size_t)block * INITRAMFS_BLOCK_SIZE;
+  size_t raw_size = entry->size - block_offset;
+  if (raw_size > INITRAMFS_BLOCK_SIZE) {
+    raw_size = INITRAMFS_BLOCK_SIZE;
+  }
+
+  const uint8_t* src = fs->image + start;
+  size_t src_size = end - start;
+
+  if (src_size == raw_size) {
+    // Stored without compression
+    memcpy(dest + block_offset, src, raw_size);
+    return 0;
+  }
+
+  ssize_t ret = lz4_decompress_block(src, src_size, dest + block_offset, raw_size);
+  if (ret != (ssize_t)raw_size) {
+    return -1;
+  }
+
+  return 0;
+}
+
+// Makes sure blocks covering [offset, offset + size) are decompressed
+static int load_range(InitRamFS* fs, uint32_t index, size_t offset, size_t size) {
+  const InitRamFSEntry* entry = &fs->entries[index];
+  InitRamFSCache* cache = &fs->cache[index];
+
+  uint32_t first = offset / INITRAMFS_BLOCK_SIZE;
+  uint32_t last = (offset + size - 1) / INITRAMFS_BLOCK_SIZE;
+  uint32_t needed = 0;
+  for (uint32_t b = first; b <= last; b++) {
+    needed |= (1U << b);
+  }
+
+  // Common case, everything is already there
+  if ((atomic_load_explicit(&cache->valid_blocks, memory_order_acquire) & needed) == needed) {
+    return 0;
+  }
+
+  int ret = 0;
+  spinlock_acquire(&cache->lock);
+
+  if (cache->data == NULL) {
+    cache->data = k_malloc(entry->size);
+    if (cache->data == NULL) {
+      ret = -1;
+      goto out;
+    }
+  }
+
+  uint32_t valid = atomic_load_explicit(&cache->valid_blocks, memory_order_relaxed);
+  for (uint32_t b = first; b <= last; b++) {
+    if (valid & (1U << b)) {
+      continue;  // Someone else got here first
+    }
+    if (decompress_block(fs, entry, cache->data, b) != 0) {
+      ret = -1;
+      goto out;
+    }
+    valid |= (1U << b);
+    atomic_store_explicit(&cache->valid_blocks, valid, memory_order_release);
+  }
+
+out:
+  spinlock_release(&cache->lock);
+  return ret;
+}
+
+static void* initramfs_open(void *fs_data, const char *path, int flags, mode_t mode) {
+  InitRamFS* fs = (InitRamFS*)fs_data;
+  (void)mode;
+
+  if ((flags & (O_WRONLY | O_RDWR | O_CREAT)) != 0) {
+    return NULL;  // Read-only
+  }
+
+  int index = find_entry(fs, path);
+  if (index < 0) {
+    return NULL;
+  }
+
+  const InitRamFSEntry* entry = &fs->entries[index];
+  if (!(entry->flags & INITRAMFS_ENTRY_DIR) && entry->size > INITRAMFS_MAX_FILE_SIZE) {
+    return NULL;  // Can't be cached
+  }
+
+  InitRamFSHandle* handle = k_zalloc(sizeof(InitRamFSHandle));
+  if (handle == NULL) {
+    return NULL;
+  }
+  handle->index = index;
+
+  // Cached data stays valid for as long as the handle is open
+  InitRamFSCache* cache = &fs->cache[index];
+  spinlock_acquire(&cache->lock);
+  cache->open_count++;
+  spinlock_release(&cache->lock);
+
+  return handle;
+}
+
+static ssize_t initramfs_pread(void *fs_data, void *handle, void *buffer, size_t size, off_t offset) {
+  InitRamFS* fs = (InitRamFS*)fs_data;
+  InitRamFSHandle* h = (InitRamFSHandle*)handle;
+  const InitRamFSEntry* entry = &fs->entries[h->index];
+
+  if (entry->flags & INITRAMFS_ENTRY_DIR) {
+    return -1;
+  }
+
+  if ((size_t)offset >= entry->size || size == 0) {
+    return 0;
+  }
+
+  size_t remaining = entry->size - offset;
+  size_t to_read = (size < remaining) ? size : remaining;
+
+  if (load_range(fs, h->index, offset, to_read) != 0) {
+    return -1;
+  }
+
+  memcpy(buffer, fs->cache[h->index].data + offset, to_read);
+
+  return to_read;
+}
+
+static ssize_t initramfs_read(void *fs_data, void *handle, void *buffer, size_t size) {
+  InitRamFSHandle* h = (InitRamFSHandle*)handle;
+
+  ssize_t ret = initramfs_pread(fs_data, handle, buffer, size, h->offset);
+  if (ret > 0) {
+    h->offset += ret;
+  }
+
+  return ret;
+}
+
+static ssize_t initramfs_write(void *fs_data, void *handle, const void *buffer, size_t size) {
+  (void)fs_data;
+  (void)handle;
+  (void)buffer;
+  (void)size;
+  return -1;
+}
+
+static ssize_t initramfs_pwrite(void *fs_data, void *handle, const void *buffer, size_t size, off_t offset) {
+  (void)fs_data;
+  (void)handle;
+  (void)buffer;
+  (void)size;
+  (void)offset;
+  return -1;
+}
+
+static int initramfs_close(void *fs_data, void *handle) {
+  InitRamFS* fs = (InitRamFS*)fs_data;
+  InitRamFSHandle* h = (InitRamFSHandle*)handle;
+  InitRamFSCache* cache = &fs->cache[h->index];
+
+  spinlock_acquire(&cache->lock);
+  if (--cache->open_count == 0 && cache->data != NULL) {
+    k_free(cache->data);
+    cache->data = NULL;
+    atomic_store_explicit(&cache->valid_blocks, 0, memory_order_relaxed);
+  }
+  spinlock_release(&cache->lock);
+
+  k_free(handle);
+  return 0;
+}
+
+static int initramfs_seek(void *fs_data, void *handle, size_t offset) {
+  InitRamFS* fs = (InitRamFS*)fs_data;
+  InitRamFSHandle* h = (InitRamFSHandle*)handle;
+
+  if (offset > fs->entries[h->index].size) {
+    return -1;  // Can't seek past end
+  }
+
+  h->offset = offset;
+  return 0;
+}
+
+static int initramfs_mkdir(void* fs_data, const char* path) {
+  (void)fs_data;
+  (void)path;
+  return -1;
+}
+
+static int initramfs_readdir(void* fs_data, void* handle, char* buffer, size_t size) {
+  InitRamFS* fs = (InitRamFS*)fs_data;
+  InitRamFSHandle* h = (InitRamFSHandle*)handle;
+
+  if (!(fs->entries[h->index].flags & INITRAMFS_ENTRY_DIR)) {
+    return -1;
+  }
+
+  size_t written = 0;
+
+  for (uint32_t i = 0; i < fs->header->num_entries; i++) {
+    if (i == ROOT_IDX || fs->entries[i].parent_index != h->index) {
+      continue;
+    }
+
+    const char* path = entry_path(fs, &fs->entries[i]);
+    if (path == NULL) {
+      continue;
+    }
+
+    // Extract just the filename from the full path
+    const char* name = path;
+    for (const char* p = path; *p; p++) {
+      if (*p == PATH_SEPARATOR && *(p + 1)) {
+        name = p + 1;
+      }
+    }
+
+    // Output is just a list of filenames, same as RamFS
+    size_t name_len = strlen(name);
+    if ((written + name_len + 1) < size) {
+      strcpy(buffer + written, name);
+      written += name_len;
+      buffer[written++] = ' ';
+    }
+  }
+
+  if (written > 0) {
+    buffer[written - 1] = '\0';  // Replace last space with null
+  } else {
+    buffer[0] = '\0';
+  }
+
+  return 0;
+}
+
+static int initramfs_remove(void* fs_data, const char* path) {
+  (void)fs_data;
+  (void)path;
+  return -1;
+}
+
+static int initramfs_stat(void* fs_data, const char* path, VFSStat* stat) {
+  InitRamFS* fs = (InitRamFS*)fs_data;
+
+  int index = find_entry(fs, path);
+  if (index < 0) {
+    return -1;
+  }
+
+  stat->size = fs->entries[index].size;
+  stat->is_directory = (fs->entries[index].flags & INITRAMFS_ENTRY_DIR) != 0;
+
+  return 0;
+}
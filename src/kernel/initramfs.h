@@ -0,0 +1,56 @@
+#ifndef INITRAMFS_H
+#define INITRAMFS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "vfs.h"
+
+/*
+ * Read-only initial filesystem image, loaded to memory before boot and
+ * created on the host with src/initramfs/mkinitramfs.py.
+ *
+ * Layout, all integers little endian and offsets relative to image start:
+ *   InitRamFSHeader
+ *   InitRamFSEntry[num_entries]   entry 0 is the root directory
+ *   string table                  null terminated absolute paths
+ *   file data                     per file a block table followed by blocks
+ *
+ * File data is split into INITRAMFS_BLOCK_SIZE byte blocks, each compressed
+ * separately with LZ4. The block table has num_blocks + 1 offsets, so the
+ * compressed size of block i is table[i + 1] - table[i]. A block whose
+ * compressed size equals its uncompressed size is stored as is.
+ */
+
+#define INITRAMFS_MAGIC "LAOSIRFS"
+#define INITRAMFS_MAGIC_LEN 8
+#define INITRAMFS_VERSION 1
+#define INITRAMFS_BLOCK_SIZE (64 * 1024)
+
+#define INITRAMFS_ENTRY_DIR 0x1
+
+typedef struct InitRamFSHeader {
+  char magic[INITRAMFS_MAGIC_LEN];
+  uint32_t version;
+  uint32_t num_entries;
+  uint32_t entry_table_offset;
+  uint32_t string_table_offset;
+  uint32_t image_size;
+  uint32_t reserved;
+} InitRamFSHeader;
+
+typedef struct InitRamFSEntry {
+  uint32_t name_offset;  // Relative to string table
+  uint32_t flags;
+  uint32_t data_offset;  // Block table of the file
+  uint32_t compressed_size;
+  uint32_t size;
+  uint32_t parent_index;
+  uint32_t reserved[2];
+} InitRamFSEntry;
+
+// Validates the image at the given address, the image must stay in memory.
+// Returns fs_data for the VFS interface, or NULL if the image is invalid.
+void* initramfs_init(const void* image, size_t max_size);
+VFSInterface* initramfs_get_vfs_interface(void);
+
+#endif // INITRAMFS_H
@@ -0,0 +1,260 @@
+/**
+ * Asynchronous I/O ring worker
+ *
+ * Each ring has a kernel task that consumes SQEs published by the process
+ * and executes them with the same process_* file operations the syscalls
+ * use. In SQPOLL mode the worker polls the ring and yields when idle, until
+ * it has been idle for IO_RING_SQPOLL_IDLE_MS. Then it sets
+ * IO_RING_SQ_NEED_WAKEUP and sleeps like a non-polling worker, until
+ * io_ring_enter is called.
+ */
+
+#include <stdatomic.h>
+
+#include "string.h"
+
+#include "io-ring-kernel.h"
+#include "process.h"
+#include "memory.h"
+#include "sched.h"
+#include "sem.h"
+#include "user-access.h"
+#include "armv8-a.h"
+
+#define IO_RING_PATH_MAX 256
+#define IO_RING_SQPOLL_IDLE_MS 10
+
+typedef struct IORingContext {
+  pid_t pid;
+  IORing* ring;
+  uint32_t flags;
+  // Kernel private copies of the indices owned by the kernel,
+  // the process can't corrupt these through the shared memory
+  uint32_t sq_head;
+  uint32_t cq_tail;
+  KSemaphore submit_sem;
+  KSemaphore complete_sem;
+  _Atomic bool stop;
+  _Atomic bool stopped;
+} IORingContext;
+
+
+// Only cq_head comes from shared memory. A head outside the entries posted
+// but not yet consumed is bogus and reads as a full queue, so nothing
+// unconsumed gets overwritten.
+static inline uint32_t available_completions(IORingContext* ctx) {
+  uint32_t used = ctx->cq_tail
+                  - atomic_load_explicit(&ctx->ring->cq_head, memory_order_acquire);
+  return (used > IO_RING_ENTRIES) ? IO_RING_ENTRIES : used;
+}
+
+static int64_t do_open(IORingContext* ctx, const IORingSQE* sqe) {
+  char path[IO_RING_PATH_MAX];
+
+  process_load_l2_table(ctx->pid);
+  copy_string_from_user(path, (const char*)sqe->addr, sizeof(path));
+  process_unload_l2_table(ctx->pid);
+
+  return process_open_file(ctx->pid, path, sqe->flags, sqe->mode);
+}
+
+static int64_t do_read(IORingContext* ctx, const IORingSQE* sqe, bool positional) {
+  if (sqe->len == 0) {
+    return 0;
+  }
+
+  void* tmp_buffer = k_malloc(sqe->len);
+  if (tmp_buffer == NULL) {
+    return -1;
+  }
+
+  ssize_t ret = positional
+    ? process_pread_file(ctx->pid, sqe->fd, tmp_buffer, sqe->len, sqe->offset)
+    : process_read_file(ctx->pid, sqe->fd, tmp_buffer, sqe->len);
+
+  if (ret > 0) {
+    process_load_l2_table(ctx->pid);
+    copy_to_user((void*)sqe->addr, tmp_buffer, ret);
+    process_unload_l2_table(ctx->pid);
+  }
+
+  k_free(tmp_buffer);
+  return ret;
+}
+
+static int64_t do_write(IORingContext* ctx, const IORingSQE* sqe, bool positional) {
+  if (sqe->len == 0) {
+    return 0;
+  }
+
+  void* tmp_buffer = k_malloc(sqe->len);
+  if (tmp_buffer == NULL) {
+    return -1;
+  }
+
+  process_load_l2_table(ctx->pid);
+  copy_from_user(tmp_buffer, (const void*)sqe->addr, sqe->len);
+  process_unload_l2_table(ctx->pid);
+
+  ssize_t ret = positional
+    ? process_pwrite_file(ctx->pid, sqe->fd, tmp_buffer, sqe->len, sqe->offset)
+    : process_write_file(ctx->pid, sqe->fd, tmp_buffer, sqe->len);
+
+  k_free(tmp_buffer);
+  return ret;
+}
+
+static int64_t execute_sqe(IORingContext* ctx, const IORingSQE* sqe) {
+  switch (sqe->opcode) {
+  case IO_OP_NOP:
+    return 0;
+  case IO_OP_OPEN:
+    return do_open(ctx, sqe);
+  case IO_OP_CLOSE:
+    return process_close_file(ctx->pid, sqe->fd);
+  case IO_OP_READ:
+    return do_read(ctx, sqe, false);
+  case IO_OP_WRITE:
+    return do_write(ctx, sqe, false);
+  case IO_OP_PREAD:
+    return do_read(ctx, sqe, true);
+  case IO_OP_PWRITE:
+    return do_write(ctx, sqe, true);
+  default:
+    return -1;
+  }
+}
+
+static void post_completion(IORingContext* ctx, uint64_t user_data, int64_t res) {
+  // Wait for the process to make room in the completion queue
+  while (available_completions(ctx) >= IO_RING_ENTRIES) {
+    if (atomic_load(&ctx->stop)) {
+      return;
+    }
+    sched_yield();
+  }
+
+  IORingCQE* cqe = &ctx->ring->cqes[ctx->cq_tail & IO_RING_MASK];
+  cqe->user_data = user_data;
+  cqe->res = res;
+
+  ctx->cq_tail++;
+  atomic_store_explicit(&ctx->ring->cq_tail, ctx->cq_tail, memory_order_release);
+
+  (void)k_sem_try_post(&ctx->complete_sem);
+}
+
+// Returns the number of SQEs processed
+static uint32_t drain_submissions(IORingContext* ctx) {
+  uint32_t sq_tail = atomic_load_explicit(&ctx->ring->sq_tail, memory_order_acquire);
+  uint32_t processed = 0;
+
+  while (ctx->sq_head != sq_tail && !atomic_load(&ctx->stop)) {
+    // Copy the entry so the process can't change it while it is executed
+    IORingSQE sqe = ctx->ring->sqes[ctx->sq_head & IO_RING_MASK];
+
+    ctx->sq_head++;
+    atomic_store_explicit(&ctx->ring->sq_head, ctx->sq_head, memory_order_release);
+
+    int64_t res = execute_sqe(ctx, &sqe);
+    post_completion(ctx, sqe.user_data, res);
+    processed++;
+  }
+
+  return processed;
+}
+
+// SQPOLL worker found nothing to do, keeps polling until idle for too long
+static void sqpoll_idle(IORingContext* ctx, uint64_t* idle_since) {
+  uint64_t now = GET_TIMER_COUNT();
+  if (*idle_since == 0) {
+    *idle_since = now;
+  }
+  if (now - *idle_since < (uint64_t)GET_TIMER_FREQ() / 1000 * IO_RING_SQPOLL_IDLE_MS) {
+    sched_yield();
+    return;
+  }
+
+  // Publish the flag before the last look at sq_tail. io_ring_submit stores
+  // sq_tail before reading the flag, so either this sees the new entries or
+  // the process sees the flag and calls io_ring_enter.
+  atomic_store(&ctx->ring->sq_flags, IO_RING_SQ_NEED_WAKEUP);
+  if (atomic_load(&ctx->ring->sq_tail) == ctx->sq_head) {
+    k_sem_wait(&ctx->submit_sem);
+  }
+  atomic_store(&ctx->ring->sq_flags, 0);
+  *idle_since = 0;
+}
+
+static void io_ring_worker(void* arg) {
+  IORingContext* ctx = (IORingContext*)arg;
+  uint64_t idle_since = 0;
+
+  while (!atomic_load(&ctx->stop)) {
+    if (drain_submissions(ctx) > 0) {
+      idle_since = 0;
+      continue;
+    }
+
+    if (ctx->flags & IO_RING_SETUP_SQPOLL) {
+      sqpoll_idle(ctx, &idle_since);
+    } else {
+      k_sem_wait(&ctx->submit_sem);
+    }
+  }
+
+  atomic_store(&ctx->stopped, true);
+  sched_terminate_cpu_current_task();
+}
+
+IORingContext* io_ring_create(pid_t pid, IORing* ring, uint32_t flags) {
+  IORingContext* ctx = k_zalloc(sizeof(IORingContext));
+  if (ctx == NULL) {
+    return NULL;
+  }
+
+  memset(ring, 0, sizeof(IORing));
+  ring->flags = flags;
+
+  ctx->pid = pid;
+  ctx->ring = ring;
+  ctx->flags = flags;
+  // Pending wakeups are coalesced, one is enough to drain everything
+  k_sem_init(&ctx->submit_sem, 0, 1);
+  k_sem_init(&ctx->complete_sem, 0, IO_RING_ENTRIES);
+
+  if (sched_create_kernel_task(io_ring_worker, ctx) == NO_TASK) {
+    k_free(ctx);
+    return NULL;
+  }
+
+  return ctx;
+}
+
+void io_ring_destroy(IORingContext* ctx) {
+  atomic_store(&ctx->stop, true);
+  (void)k_sem_try_post(&ctx->submit_sem);
+  (void)k_sem_try_post(&ctx->complete_sem);
+
+  while (!atomic_load(&ctx->stopped)) {
+    sched_yield();
+  }
+
+  k_free(ctx);
+}
+
+int io_ring_enter(IORingContext* ctx, uint32_t min_complete) {
+  if (min_complete > IO_RING_ENTRIES) {
+    min_complete = IO_RING_ENTRIES;
+  }
+
+  // An SQPOLL worker may have gone idle, a spurious post only makes its
+  // next idle wait return once
+  (void)k_sem_try_post(&ctx->submit_sem);
+
+  while (available_completions(ctx) < min_complete && !atomic_load(&ctx->stop)) {
+    k_sem_wait(&ctx->complete_sem);
+  }
+
+  return available_completions(ctx);
+}
@@ -0,0 +1,23 @@
+#ifndef IO_RING_KERNEL_H
+#define IO_RING_KERNEL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "io-ring.h"
+
+typedef struct IORingContext IORingContext;
+
+// Starts a kernel worker draining the given ring on behalf of process pid.
+// `ring` is the kernel address of the memory shared with the process.
+IORingContext* io_ring_create(pid_t pid, IORing* ring, uint32_t flags);
+
+// Stops the worker and frees the context, waits until the worker
+// no longer accesses the ring or the process memory
+void io_ring_destroy(IORingContext* ctx);
+
+// Wakes the worker to process new submissions and blocks until at least
+// min_complete completions are available. Returns number of available completions.
+int io_ring_enter(IORingContext* ctx, uint32_t min_complete);
+
+#endif // IO_RING_KERNEL_H
@@ -1,25 +1,44 @@
 #include <stdarg.h>
-#include <stdarg.h>
 #include "pl011.h"
 #include "stdio.h"
+#include "string.h"
 #include "io.h"
 #include "serial-buffer.h"
-#include "spinlock.h"
+#include "serial-tx.h"
+#include "sched.h"
 
-static Spinlock k_puts_lock = {0};
+// Output goes through the TX ring, so callers only pay for a copy. After a
+// fatal exception it is written out synchronously instead.
 
 void k_putchar(const char c) {
-  pl011_putc(c);
+  if (serial_tx_in_panic()) {
+    pl011_putc(c);
+    return;
+  }
+  serial_tx_write(&c, 1);
 }
 
 void k_puts(const char* s) {
-  char* tmp = (char*)s;
-  spinlock_acquire(&k_puts_lock);
-  while(*tmp) {
-    k_putchar(*tmp);
-    tmp++;
+  if (serial_tx_in_panic()) {
+    while (*s) {
+      pl011_putc(*s++);
+    }
+    return;
   }
-  spinlock_release(&k_puts_lock);
+  serial_tx_write(s, strlen(s));
+}
+
+void k_puts_wait(const char* s) {
+  size_t len = strlen(s);
+  while (len > 0 && !serial_tx_in_panic()) {
+    size_t written = serial_tx_write_partial(s, len);
+    s += written;
+    len -= written;
+    if (len > 0) {
+      sched_yield();
+    }
+  }
+  k_puts(s);
 }
 
 char k_getchar(void) {
@@ -34,4 +53,14 @@ void k_printf(const char* format, ...) {
   va_end(args);
 
   k_puts(buffer);
+}
+
+void k_printf_wait(const char* format, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+
+  k_puts_wait(buffer);
 }
\ No newline at end of file
@@ -5,11 +5,16 @@
 
 void k_putchar(const char c);
 void k_puts(const char* s);
+// Same, but waits for output space instead of dropping what doesn't fit.
+// For bulk output from tasks, yields while waiting.
+void k_puts_wait(const char* s);
 
 char k_getchar(void);
 char* k_gets(char* s, int max_len);
 
 void k_printf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+// k_printf through k_puts_wait, for multi-line reports from console commands
+void k_printf_wait(const char* format, ...) __attribute__((format(printf, 1, 2)));
 
 #endif // IO_H
 
@@ -0,0 +1,133 @@
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "ipi.h"
+#include "gic.h"
+#include "armv8-a.h"
+#include "spinlock.h"
+#include "percpu.h"
+
+typedef struct IPICall {
+  IPIFunction func;
+  void* arg;
+  _Atomic bool* done;  // NULL if caller doesn't wait
+} IPICall;
+
+// Calls pending for one CPU
+typedef struct IPICallQueue {
+  Spinlock lock;
+  uint32_t head;
+  uint32_t tail;
+  IPICall calls[IPI_CALL_QUEUE_SIZE];
+} __attribute__((aligned(CACHE_LINE_SIZE))) IPICallQueue;
+
+static IPICallQueue call_queues[NUM_CPUS] = {
+  [0 ... NUM_CPUS - 1] = { .lock = { .used_from_irq = true } }
+};
+
+void ipi_init_cpu(void) {
+  // SGI enables and priorities are banked per CPU
+  gicd_enable_irq(SGI_START + IPI_RESCHEDULE);
+  gicd_enable_irq(SGI_START + IPI_CALL_FUNCTION);
+  gicd_enable_irq(SGI_START + IPI_BENCH);
+  gicd_set_irq_priority(SGI_START + IPI_RESCHEDULE, 0);
+  gicd_set_irq_priority(SGI_START + IPI_CALL_FUNCTION, 0);
+  gicd_set_irq_priority(SGI_START + IPI_BENCH, 0);
+}
+
+void ipi_send_reschedule(uint32_t cpu) {
+  if (cpu >= NUM_CPUS) {
+    return;
+  }
+  (void)gicd_send_sgi(IPI_RESCHEDULE, 1u << cpu);
+}
+
+static int queue_call(uint32_t cpu, IPIFunction func, void* arg, _Atomic bool* done) {
+  IPICallQueue* queue = &call_queues[cpu];
+
+  while (1) {
+    spinlock_acquire(&queue->lock);
+    if (queue->tail - queue->head < IPI_CALL_QUEUE_SIZE) {
+      IPICall* call = &queue->calls[queue->tail % IPI_CALL_QUEUE_SIZE];
+      call->func = func;
+      call->arg = arg;
+      call->done = done;
+      queue->tail++;
+      spinlock_release(&queue->lock);
+      break;
+    }
+    spinlock_release(&queue->lock);
+    // Full, target will drain it soon
+    __asm__ __volatile__("yield");
+  }
+
+  return gicd_send_sgi(IPI_CALL_FUNCTION, 1u << cpu);
+}
+
+int ipi_call_function(uint32_t cpu, IPIFunction func, void* arg, bool wait) {
+  if (cpu >= NUM_CPUS || func == NULL) {
+    return -1;
+  }
+
+  if (cpu == THIS_CPU_ID()) {
+    func(arg);
+    return 0;
+  }
+
+  _Atomic bool done = false;
+  if (queue_call(cpu, func, arg, wait ? &done : NULL) != 0) {
+    return -1;
+  }
+
+  while (wait && !atomic_load_explicit(&done, memory_order_acquire)) {
+    __asm__ __volatile__("yield");
+  }
+
+  return 0;
+}
+
+void ipi_call_function_all(IPIFunction func, void* arg, bool include_self, bool wait) {
+  uint32_t self = THIS_CPU_ID();
+  _Atomic bool done[NUM_CPUS];
+
+  // Queue everywhere first so that the calls run in parallel
+  for (uint32_t cpu = 0; cpu < NUM_CPUS; cpu++) {
+    atomic_store(&done[cpu], true);
+    if (cpu != self) {
+      atomic_store(&done[cpu], false);
+      (void)queue_call(cpu, func, arg, wait ? &done[cpu] : NULL);
+    }
+  }
+
+  if (include_self) {
+    func(arg);
+  }
+
+  for (uint32_t cpu = 0; wait && cpu < NUM_CPUS; cpu++) {
+    while (!atomic_load_explicit(&done[cpu], memory_order_acquire)) {
+      __asm__ __volatile__("yield");
+    }
+  }
+}
+
+void ipi_call_function_irq_handler(uint32_t cpu_id) {
+  IPICallQueue* queue = &call_queues[cpu_id];
+
+  // Run calls without holding the lock, they may queue new calls
+  while (1) {
+    spinlock_acquire(&queue->lock);
+    if (queue->head == queue->tail) {
+      spinlock_release(&queue->lock);
+      break;
+    }
+    IPICall call = queue->calls[queue->head % IPI_CALL_QUEUE_SIZE];
+    queue->head++;
+    spinlock_release(&queue->lock);
+
+    call.func(call.arg);
+
+    if (call.done != NULL) {
+      atomic_store_explicit(call.done, true, memory_order_release);
+    }
+  }
+}
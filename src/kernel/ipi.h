@@ -0,0 +1,34 @@
+#ifndef IPI_H
+#define IPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Software generated interrupts used for inter-processor interrupts
+#define IPI_RESCHEDULE     0u
+#define IPI_CALL_FUNCTION  1u
+#define IPI_BENCH          2u  // Sent to self by irq-bench.c
+
+#define IPI_CALL_QUEUE_SIZE 16
+
+typedef void (*IPIFunction)(void* arg);
+
+// Enables IPIs on the calling CPU, call on each CPU after gicc_enable
+void ipi_init_cpu(void);
+
+// Makes cpu run its scheduler as soon as possible
+void ipi_send_reschedule(uint32_t cpu);
+
+// Runs func(arg) on cpu from IRQ context. If wait is set, returns after
+// func has completed. Don't wait with interrupts masked, the target might
+// be waiting for us. Runs func directly if cpu is the calling CPU.
+// Returns 0 on success, -1 if cpu is invalid.
+int ipi_call_function(uint32_t cpu, IPIFunction func, void* arg, bool wait);
+
+// Same on all other CPUs, and on the calling CPU too if include_self is set
+void ipi_call_function_all(IPIFunction func, void* arg, bool include_self, bool wait);
+
+// Called by the IRQ dispatcher for IPI_CALL_FUNCTION
+void ipi_call_function_irq_handler(uint32_t cpu_id);
+
+#endif // IPI_H
@@ -0,0 +1,63 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "irq-bench.h"
+#include "armv8-a.h"
+#include "gic.h"
+#include "io.h"
+#include "ipi.h"
+#include "percpu.h"
+
+static volatile uint64_t handler_cycles;
+static _Atomic bool handler_done;
+
+void irq_bench_irq_handler(void) {
+  handler_cycles = GET_CYCLE_COUNT();
+  atomic_store_explicit(&handler_done, true, memory_order_release);
+}
+
+typedef struct {
+  uint64_t min;
+  uint64_t sum;
+} CycleStat;
+
+static inline void add_sample(CycleStat* stat, uint64_t cycles) {
+  if (cycles < stat->min) {
+    stat->min = cycles;
+  }
+  stat->sum += cycles;
+}
+
+void irq_bench_run(uint32_t iterations) {
+  if (iterations == 0) {
+    return;
+  }
+
+  ENABLE_CYCLE_COUNTER();
+
+  // Timer IRQs and task switches can land in a sample, min filters them out
+  CycleStat total = {UINT64_MAX, 0};
+  CycleStat entry = {UINT64_MAX, 0};
+  CycleStat exit = {UINT64_MAX, 0};
+  uint32_t cpu = THIS_CPU_ID();
+
+  for (uint32_t i = 0; i < iterations; i++) {
+    atomic_store_explicit(&handler_done, false, memory_order_relaxed);
+
+    uint64_t start = GET_CYCLE_COUNT();
+    (void)gicd_send_sgi(IPI_BENCH, 1u << cpu);
+    // Taken on this CPU, so once this is seen the IRQ has returned
+    while (!atomic_load_explicit(&handler_done, memory_order_acquire)) {
+    }
+    uint64_t end = GET_CYCLE_COUNT();
+
+    add_sample(&total, end - start);
+    add_sample(&entry, handler_cycles - start);
+    add_sample(&exit, end - handler_cycles);
+  }
+
+  k_printf("irqbench CPU%u, %u iterations, cycles min/avg\r\n", cpu, iterations);
+  k_printf("  send to return:    %lu/%lu\r\n", total.min, total.sum / iterations);
+  k_printf("  send to handler:   %lu/%lu\r\n", entry.min, entry.sum / iterations);
+  k_printf("  handler to return: %lu/%lu\r\n", exit.min, exit.sum / iterations);
+}
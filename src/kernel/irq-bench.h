@@ -0,0 +1,14 @@
+#ifndef IRQ_BENCH_H
+#define IRQ_BENCH_H
+
+#include <stdint.h>
+
+// Measures IRQ entry to exit with the cycle counter. Sends IPI_BENCH to the
+// calling CPU and times how long it takes to reach the handler and to get
+// back from it. Call from a task with interrupts unmasked, prints results.
+void irq_bench_run(uint32_t iterations);
+
+// Called by the IRQ dispatcher for IPI_BENCH
+void irq_bench_irq_handler(void);
+
+#endif // IRQ_BENCH_H
@@ -10,38 +10,86 @@
 #include "armv8-a.h"
 #include "sched.h"
 #include "serial-buffer.h"
+#include "serial-tx.h"
+#include "klog.h"
+#include "trace.h"
+#include "profile.h"
+#include "ipi.h"
+#include "percpu.h"
+#include "irq-bench.h"
 
 
 void sync_exception_handler(void) {
+  serial_tx_panic();
+  // Records leading up to the crash, may race with the drain task
+  klog_drain();
   k_puts("sync_exception_handler\r\n");
   cpu_dump_registers(k_printf);
   while(1);
 }
 
-void irq_exception_handler(uintptr_t sp_after_ctx_save) {
-  uint32_t cpu_id = GET_CPU_ID();
-  uint32_t int_id = gicc_get_intid_and_ack(cpu_id);
+// Returns to the trapped instruction, which then runs with the task's state
+void fpsimd_access_handler(void) {
+  if (sched_fpsimd_access() != 0) {
+    // Kernel code is built without FP/SIMD, this is a bug
+    sync_exception_handler();
+  }
+}
+
+void irq_exception_handler(PtRegs* regs) {
+  uint32_t cpu_id = THIS_CPU_ID();
+  // For SGIs IAR also holds the source CPU, EOIR must get the whole value
+  uint32_t iar = gicc_get_intid_and_ack(cpu_id);
+  uint32_t int_id = iar & GICC_IAR_INTID_MASK;
+  TRACE(TRACE_IRQ_ENTRY, int_id, 0, 0);
 
   switch (int_id) {
-  case UART_IRQ:
-    serial_buffer_put(pl011_getc());
+  case SGI_START + IPI_RESCHEDULE:
+    sched_timer_irq_handler(iar, cpu_id, regs);
+    break;
+  case SGI_START + IPI_CALL_FUNCTION:
+    ipi_call_function_irq_handler(cpu_id);
     break;
+  case SGI_START + IPI_BENCH:
+    irq_bench_irq_handler();
+    break;
+  case GICC_IAR_SPURIOUS:
+    TRACE(TRACE_IRQ_EXIT, int_id, 0, 0);
+    return;  // Nothing to acknowledge
+  case UART_IRQ: {
+    uint32_t status = pl011_get_masked_irq_status();
+    if (status & (UARTIMSC_RXIM | UARTIMSC_RTIM)) {
+      while (!pl011_rx_fifo_empty()) {
+        serial_buffer_put(pl011_getc());
+      }
+    }
+    if (status & UARTIMSC_TXIM) {
+      serial_tx_irq_handler();
+    }
+    break;
+  }
   case EL1_PHY_TIM_IRQ:
-    sched_timer_irq_handler(EL1_PHY_TIM_IRQ, cpu_id, sp_after_ctx_save);
+    sched_timer_irq_handler(iar, cpu_id, regs);
+    break;
+  case PMU_IRQ:
+    profile_irq_handler(regs);
     break;
   default:
     k_printf("Got unknown IRQ with ID %x on CPU%u\n", int_id, cpu_id);
     break;
   }
-  gicc_end_irq(int_id, cpu_id);
+  TRACE(TRACE_IRQ_EXIT, int_id, 0, 0);
+  gicc_end_irq(iar, cpu_id);
 }
 
 void fiq_exception_handler(void) {
+  serial_tx_panic();
   k_puts("fiq_exception_handler\r\n");
   while(1);
 }
 
 void serror_exception_handler(void) {
+  serial_tx_panic();
   k_puts("serror_exception_handler\r\n");
   cpu_dump_registers(k_printf);
   while(1);
@@ -0,0 +1,223 @@
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "klog.h"
+#include "armv8-a.h"
+#include "io.h"
+#include "lf-queue.h"
+#include "log.h"
+#include "percpu.h"
+#include "sched.h"
+#include "stdio.h"
+
+#define KLOG_RING_CAPACITY 256  // Records per CPU
+#define KLOG_DRAIN_INTERVAL_US 10000
+#define KLOG_DRAIN_BATCH 64  // Records per wakeup of the drain task
+#define KLOG_LINE_MAX 256
+
+typedef struct KLogRecord {
+  const char* fmt;
+  uint64_t timestamp;  // Physical counter, common to all CPUs
+  uint8_t level;
+  uint8_t nargs;
+  uint8_t cpu_id;
+  uint64_t args[KLOG_MAX_ARGS];
+} KLogRecord;
+
+// Producers are the owning CPU's tasks and the IRQ handlers that interrupt
+// them, so the ring needs multi-producer pushes even though it's per CPU
+typedef struct KLogRing {
+  MPSCQueue queue;
+  _Atomic size_t dropped;
+  __attribute__((aligned(8))) uint8_t buffer[MPSC_QUEUE_BUFFER_SIZE(KLOG_RING_CAPACITY, sizeof(KLogRecord))];
+} KLogRing;
+
+static KLogRing klog_rings[NUM_CPUS];
+static _Atomic bool klog_ready = false;
+static _Atomic KLogLevel console_level = KLOG_INFO;
+
+// Drain side state, one record looked ahead from each CPU for merging
+static KLogRecord pending[NUM_CPUS];
+static bool pending_valid[NUM_CPUS];
+static size_t dropped_reported = 0;
+
+void klog_init(void) {
+  for (uint32_t i = 0; i < NUM_CPUS; i++) {
+    mpsc_queue_init(&klog_rings[i].queue, klog_rings[i].buffer,
+                    KLOG_RING_CAPACITY, sizeof(KLogRecord));
+    atomic_init(&klog_rings[i].dropped, 0);
+  }
+  klog_ready = true;
+}
+
+void klog_write(KLogLevel level, const char* fmt, unsigned nargs, ...) {
+  if (!klog_ready) {
+    return;
+  }
+
+  KLogRecord record = {
+    .fmt = fmt,
+    .timestamp = GET_TIMER_COUNT(),
+    .level = (uint8_t)level,
+    .nargs = (uint8_t)(nargs < KLOG_MAX_ARGS ? nargs : KLOG_MAX_ARGS),
+    .cpu_id = (uint8_t)THIS_CPU_ID()
+  };
+
+  // Every variadic argument takes a whole register or stack slot on
+  // AArch64, narrower ones are truncated back when formatted
+  va_list args;
+  va_start(args, nargs);
+  for (unsigned i = 0; i < record.nargs; i++) {
+    record.args[i] = va_arg(args, uint64_t);
+  }
+  va_end(args);
+
+  KLogRing* ring = &klog_rings[record.cpu_id];
+  if (!mpsc_queue_push(&ring->queue, &record)) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+  }
+}
+
+// Ends the line with a marker naming the conversion starting at spec
+static void unsupported_conversion(const char* spec, char* out, size_t size) {
+  char name[16];
+  size_t n = 0;
+  name[n++] = *spec++;
+  while (*spec != '\0' && n < sizeof(name) - 1) {
+    char c = *spec++;
+    name[n++] = c;
+    bool is_letter = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    if (is_letter && c != 'l' && c != 'h' && c != 'z' && c != 'j' && c != 't' && c != 'L') {
+      break;  // Conversion character ends the specifier
+    }
+  }
+  name[n] = '\0';
+  (void)snprintf(out, size, "<klog: unsupported conversion %s>\n", name);
+}
+
+// Formats one conversion at a time with snprintf, casting the stored value
+// to the type the specifier expects. Only the conversions listed in klog.h
+// are understood. Anything else (flags, width, other length modifiers)
+// would be mis-rendered, so the rest of the record is replaced with a
+// marker.
+static void format_record(const KLogRecord* record, char* out, size_t size) {
+  size_t len = 0;
+  unsigned arg = 0;
+  const char* p = record->fmt;
+
+  while (*p != '\0' && len + 1 < size) {
+    if (*p != '%') {
+      out[len++] = *p++;
+      continue;
+    }
+
+    const char* start = p++;
+    bool is_long = false;
+    if (*p == 'l') {
+      is_long = true;
+      p++;
+    }
+    char conv = *p;
+
+    if (conv == '%' && !is_long) {
+      out[len++] = '%';
+      p++;
+      continue;
+    }
+
+    char spec[4] = { '%', 'l', conv, '\0' };
+    if (!is_long) {
+      spec[1] = conv;
+      spec[2] = '\0';
+    }
+
+    int written;
+    if (arg >= record->nargs) {
+      break;  // More conversions than arguments
+    } else if (conv == 's' && !is_long) {
+      written = snprintf(&out[len], size - len, spec, (const char*)record->args[arg]);
+    } else if (conv == 'd') {
+      written = is_long ? snprintf(&out[len], size - len, spec, (long)record->args[arg])
+                        : snprintf(&out[len], size - len, spec, (int)record->args[arg]);
+    } else if (conv == 'u' || conv == 'x') {
+      written = is_long ? snprintf(&out[len], size - len, spec, (unsigned long)record->args[arg])
+                        : snprintf(&out[len], size - len, spec, (unsigned)record->args[arg]);
+    } else {
+      unsupported_conversion(start, &out[len], size - len);
+      return;
+    }
+    arg++;
+    p++;
+
+    if (written > 0) {
+      len += (size_t)written;
+      if (len >= size) {
+        len = size - 1;
+      }
+    }
+  }
+  out[len] = '\0';
+}
+
+// Prints up to max records in timestamp order
+static size_t drain_records(size_t max) {
+  size_t consumed = 0;
+
+  while (consumed < max) {
+    int oldest = -1;
+    for (uint32_t i = 0; i < NUM_CPUS; i++) {
+      if (!pending_valid[i]) {
+        pending_valid[i] = mpsc_queue_pop(&klog_rings[i].queue, &pending[i]);
+      }
+      if (pending_valid[i] && (oldest < 0 || pending[i].timestamp < pending[oldest].timestamp)) {
+        oldest = (int)i;
+      }
+    }
+    if (oldest < 0) {
+      break;
+    }
+
+    if (pending[oldest].level >= console_level) {
+      char line[KLOG_LINE_MAX];
+      format_record(&pending[oldest], line, sizeof(line));
+      k_puts(line);
+    }
+    pending_valid[oldest] = false;
+    consumed++;
+  }
+
+  size_t dropped = 0;
+  for (uint32_t i = 0; i < NUM_CPUS; i++) {
+    dropped += atomic_load_explicit(&klog_rings[i].dropped, memory_order_relaxed);
+  }
+  if (dropped != dropped_reported) {
+    k_printf(LOG_KERNEL "klog: %lu records dropped\n", dropped - dropped_reported);
+    dropped_reported = dropped;
+  }
+
+  return consumed;
+}
+
+size_t klog_drain(void) {
+  return drain_records(SIZE_MAX);
+}
+
+void klog_drain_task(void* arg) {
+  (void)arg;
+
+  // Formatting is deferred work, it shouldn't compete with anything else
+  (void)sched_set_priority(sched_get_cpu_current_task_id(), SCHED_PRIORITY_BACKGROUND);
+
+  // Bounded batches with a sleep in between, debug records from every
+  // context switch would otherwise keep the task busy for good
+  while (1) {
+    (void)drain_records(KLOG_DRAIN_BATCH);
+    sched_sleep_cpu_current_task(KLOG_DRAIN_INTERVAL_US);
+  }
+}
+
+void klog_set_console_level(KLogLevel level) {
+  console_level = level;
+}
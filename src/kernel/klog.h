@@ -0,0 +1,51 @@
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <stddef.h>
+
+// Binary kernel log. klog() only stores the format pointer and raw argument
+// values in the calling CPU's lock-free ring, so it's cheap enough for hot
+// paths and safe from IRQ handlers and with scheduler locks held. A drain
+// task formats records later, merged across CPUs by timestamp.
+//
+// Arguments are stored as 64-bit values and converted by the conversion
+// specifier when formatted, so %s arguments must outlive the record, use
+// only string literals and other static strings.
+//
+// Formats are limited to what the libc snprintf handles: %d, %u, %x with an
+// optional l, %s and %%. No flags, width, precision or other length
+// modifiers (e.g. %08lx, %zu). A record using one prints an "unsupported
+// conversion" marker from that point on instead of guessed output.
+
+typedef enum {
+  KLOG_DEBUG,
+  KLOG_INFO
+} KLogLevel;
+
+#define KLOG_MAX_ARGS 12
+
+#define KLOG_NARGS(...) \
+  KLOG_NARGS_(0, ##__VA_ARGS__, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define KLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, n, ...) n
+
+#define klog(level, fmt, ...) \
+  klog_write((level), (fmt), KLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+
+// Call once on the primary CPU after percpu_init, records before that are
+// discarded
+void klog_init(void);
+
+void klog_write(KLogLevel level, const char* fmt, unsigned nargs, ...);
+
+// Formats and prints all queued records at or above the console level.
+// Returns the number of records consumed. Single consumer, normally only
+// the drain task calls this.
+size_t klog_drain(void);
+
+// Kernel task entry, drains the rings periodically at background priority
+void klog_drain_task(void* arg);
+
+// Records below this level are consumed without printing, default KLOG_INFO
+void klog_set_console_level(KLogLevel level);
+
+#endif // KLOG_H
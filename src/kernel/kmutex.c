@@ -0,0 +1,135 @@
+#include <stddef.h>
+
+#include "kmutex.h"
+
+// Owner used before the scheduler has started on this CPU
+#define KMUTEX_BOOT_OWNER ((task_id_t)(-2))
+
+// Lives on the stack of the sleeping task
+struct KMutexWaiter {
+  Task* task;
+  task_id_t task_id;
+  uint8_t priority;
+  _Atomic bool woken;
+  KMutexWaiter* next;
+};
+
+static inline task_id_t current_owner_id(void) {
+  task_id_t id = sched_get_cpu_current_task_id();
+  return (id == NO_TASK) ? KMUTEX_BOOT_OWNER : id;
+}
+
+static inline bool try_take(KMutex* mutex, task_id_t me) {
+  task_id_t expected = KMUTEX_NO_OWNER;
+  return atomic_compare_exchange_strong_explicit(&mutex->owner, &expected, me,
+                                                 memory_order_acquire,
+                                                 memory_order_relaxed);
+}
+
+// Keeps waiters sorted by priority, FIFO among equal priorities
+static void insert_waiter(KMutex* mutex, KMutexWaiter* waiter) {
+  KMutexWaiter** link = &mutex->waiters;
+  while (*link != NULL && (*link)->priority >= waiter->priority) {
+    link = &(*link)->next;
+  }
+  waiter->next = *link;
+  *link = waiter;
+}
+
+void kmutex_init(KMutex* mutex) {
+  atomic_store(&mutex->owner, KMUTEX_NO_OWNER);
+  mutex->wait_lock = (Spinlock){0};
+  mutex->waiters = NULL;
+}
+
+int kmutex_trylock(KMutex* mutex) {
+  return try_take(mutex, current_owner_id()) ? 0 : -1;
+}
+
+void kmutex_lock(KMutex* mutex) {
+  task_id_t me = current_owner_id();
+
+  if (try_take(mutex, me)) {
+    return;
+  }
+
+  // Owner is likely to release soon if it's running, sleeping would cost
+  // more than waiting for it
+  for (uint32_t i = 0; i < KMUTEX_SPIN_LIMIT; i++) {
+    task_id_t owner = atomic_load_explicit(&mutex->owner, memory_order_relaxed);
+    if (owner == KMUTEX_NO_OWNER) {
+      if (try_take(mutex, me)) {
+        return;
+      }
+      continue;
+    }
+    if (!sched_is_task_running(owner)) {
+      break;
+    }
+    __asm__ __volatile__("yield");
+  }
+
+  KMutexWaiter waiter = {
+    .task = sched_get_cpu_current_task(),
+    .task_id = me,
+    .priority = sched_get_priority(me),
+    .woken = false,
+    .next = NULL
+  };
+
+  spinlock_acquire(&mutex->wait_lock);
+
+  // Owner can only change under wait_lock from now on, unless it's free
+  if (try_take(mutex, me)) {
+    spinlock_release(&mutex->wait_lock);
+    return;
+  }
+
+  insert_waiter(mutex, &waiter);
+
+  // Priority inheritance, owner runs at least at our priority
+  sched_boost_priority(atomic_load_explicit(&mutex->owner, memory_order_relaxed),
+                       waiter.priority);
+
+  spinlock_release(&mutex->wait_lock);
+
+  // Ownership is handed over directly by kmutex_unlock before waking
+  while (!atomic_load_explicit(&waiter.woken, memory_order_acquire)) {
+    sched_block_current_task_unless(&waiter.woken);
+  }
+}
+
+void kmutex_unlock(KMutex* mutex) {
+  task_id_t me = atomic_load_explicit(&mutex->owner, memory_order_relaxed);
+
+  spinlock_acquire(&mutex->wait_lock);
+
+  KMutexWaiter* next = mutex->waiters;
+  if (next == NULL) {
+    atomic_store_explicit(&mutex->owner, KMUTEX_NO_OWNER, memory_order_release);
+    spinlock_release(&mutex->wait_lock);
+    sched_restore_priority(me);
+    return;
+  }
+
+  mutex->waiters = next->next;
+
+  // Hand off to the highest priority waiter, so that new arrivals can't
+  // steal the mutex before it gets to run
+  task_id_t next_id = next->task_id;
+  Task* next_task = next->task;
+  atomic_store_explicit(&mutex->owner, next_id, memory_order_release);
+
+  // New owner inherits from the remaining waiters
+  if (mutex->waiters != NULL) {
+    sched_boost_priority(next_id, mutex->waiters->priority);
+  }
+
+  // Waiter may return as soon as woken is set
+  sched_wake_task_if(next_task, &next->woken);
+
+  spinlock_release(&mutex->wait_lock);
+
+  // Only the boost of this mutex is dropped, nested KMutexes are not tracked
+  sched_restore_priority(me);
+}
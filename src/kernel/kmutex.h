@@ -0,0 +1,38 @@
+#ifndef KMUTEX_H
+#define KMUTEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "sched.h"
+#include "spinlock.h"
+
+// Iterations to spin while the owner is running before going to sleep
+#define KMUTEX_SPIN_LIMIT 1000
+
+// Task ids start from 1, so zero initialized mutex is unlocked
+#define KMUTEX_NO_OWNER ((task_id_t)0)
+
+typedef struct KMutexWaiter KMutexWaiter;
+
+// Sleeping mutex for long critical sections in task context. Not usable
+// from IRQ context. Contended lock spins while the owner is running on
+// another CPU, then sleeps. Waiters are woken in priority order and the
+// owner inherits the highest waiter priority until it unlocks.
+typedef struct KMutex {
+  _Atomic task_id_t owner;  // KMUTEX_NO_OWNER when unlocked
+  Spinlock wait_lock;       // Protects waiters and ownership handoff
+  KMutexWaiter* waiters;
+} KMutex;
+
+#define KMUTEX_INIT { KMUTEX_NO_OWNER, {0}, NULL }
+
+void kmutex_init(KMutex* mutex);
+// Not reentrant
+void kmutex_lock(KMutex* mutex);
+// Returns 0 if the mutex was taken, -1 if it's held by someone else
+int kmutex_trylock(KMutex* mutex);
+void kmutex_unlock(KMutex* mutex);
+
+#endif /* KMUTEX_H */
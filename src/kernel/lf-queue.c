@@ -0,0 +1,171 @@
+#include "string.h"
+
+#include "lf-queue.h"
+
+static inline bool is_power_of_2(size_t n) {
+  return n != 0 && (n & (n - 1)) == 0;
+}
+
+static inline bool is_aligned_8(const void* p) {
+  return ((uintptr_t)p & 7) == 0;
+}
+
+/* SPSC */
+
+int spsc_queue_init(SPSCQueue* q, void* buffer, size_t capacity, size_t elem_size) {
+  if (q == NULL || buffer == NULL || elem_size == 0 || !is_power_of_2(capacity)) {
+    return -1;
+  }
+
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  q->mask = capacity - 1;
+  q->elem_size = elem_size;
+  q->buffer = buffer;
+  return 0;
+}
+
+bool spsc_queue_push(SPSCQueue* q, const void* elem) {
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+  if (head - tail > q->mask) {
+    return false;
+  }
+
+  memcpy(&q->buffer[(head & q->mask) * q->elem_size], elem, q->elem_size);
+  atomic_store_explicit(&q->head, head + 1, memory_order_release);
+  return true;
+}
+
+bool spsc_queue_pop(SPSCQueue* q, void* out) {
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+  if (tail == head) {
+    return false;
+  }
+
+  memcpy(out, &q->buffer[(tail & q->mask) * q->elem_size], q->elem_size);
+  atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+size_t spsc_queue_count(SPSCQueue* q) {
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+  size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+  return head - tail;
+}
+
+/* MPMC */
+
+// Cell sequence numbers tell whose turn it is. For position pos:
+// seq == pos        free, a producer can claim it
+// seq == pos + 1    full, a consumer can claim it
+// seq == pos + capacity  free again for the next lap
+static inline _Atomic size_t* cell_seq(MPMCQueue* q, size_t pos) {
+  return (_Atomic size_t*)&q->buffer[(pos & q->mask) * q->cell_size];
+}
+
+static inline void* cell_data(MPMCQueue* q, size_t pos) {
+  return &q->buffer[(pos & q->mask) * q->cell_size + sizeof(size_t)];
+}
+
+int mpmc_queue_init(MPMCQueue* q, void* buffer, size_t capacity, size_t elem_size) {
+  if (q == NULL || buffer == NULL || elem_size == 0 || !is_power_of_2(capacity) ||
+      !is_aligned_8(buffer)) {
+    return -1;
+  }
+
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  q->mask = capacity - 1;
+  q->elem_size = elem_size;
+  q->cell_size = MPMC_QUEUE_CELL_SIZE(elem_size);
+  q->buffer = buffer;
+
+  for (size_t i = 0; i < capacity; i++) {
+    atomic_init(cell_seq(q, i), i);
+  }
+  return 0;
+}
+
+bool mpmc_queue_push(MPMCQueue* q, const void* elem) {
+  size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+  while (1) {
+    size_t seq = atomic_load_explicit(cell_seq(q, pos), memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+    if (diff == 0) {
+      // Free, try to claim it. On failure pos is updated to the current head.
+      if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;  // Consumer hasn't freed it yet, full
+    } else {
+      // Another producer claimed it
+      pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    }
+  }
+
+  memcpy(cell_data(q, pos), elem, q->elem_size);
+  atomic_store_explicit(cell_seq(q, pos), pos + 1, memory_order_release);
+  return true;
+}
+
+bool mpmc_queue_pop(MPMCQueue* q, void* out) {
+  size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+  while (1) {
+    size_t seq = atomic_load_explicit(cell_seq(q, pos), memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return false;  // Not written yet, empty
+    } else {
+      // Another consumer took it
+      pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    }
+  }
+
+  memcpy(out, cell_data(q, pos), q->elem_size);
+  atomic_store_explicit(cell_seq(q, pos), pos + q->mask + 1, memory_order_release);
+  return true;
+}
+
+/* MPSC */
+
+int mpsc_queue_init(MPSCQueue* q, void* buffer, size_t capacity, size_t elem_size) {
+  if (q == NULL) {
+    return -1;
+  }
+  return mpmc_queue_init(&q->queue, buffer, capacity, elem_size);
+}
+
+bool mpsc_queue_push(MPSCQueue* q, const void* elem) {
+  return mpmc_queue_push(&q->queue, elem);
+}
+
+bool mpsc_queue_pop(MPSCQueue* q, void* out) {
+  MPMCQueue* mq = &q->queue;
+  size_t pos = atomic_load_explicit(&mq->tail, memory_order_relaxed);
+  size_t seq = atomic_load_explicit(cell_seq(mq, pos), memory_order_acquire);
+
+  // Empty, or the producer that claimed it hasn't finished writing
+  if (seq != pos + 1) {
+    return false;
+  }
+
+  memcpy(out, cell_data(mq, pos), mq->elem_size);
+  atomic_store_explicit(&mq->tail, pos + 1, memory_order_relaxed);
+  atomic_store_explicit(cell_seq(mq, pos), pos + mq->mask + 1, memory_order_release);
+  return true;
+}
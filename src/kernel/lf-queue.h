@@ -0,0 +1,72 @@
+#ifndef LF_QUEUE_H
+#define LF_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bounded lock-free queues for elements of any fixed size. Elements are
+// copied in and out. The caller provides the storage, capacity must be a
+// power of 2 and the buffer 8-byte aligned. Push returns false when full,
+// pop returns false when empty.
+//
+// SPSCQueue: one producer and one consumer at a time
+// MPSCQueue: any number of producers, one consumer
+// MPMCQueue: any number of both (Vyukov's bounded queue)
+//
+// None of them sleeps or masks interrupts, so they can be used from IRQ
+// handlers. Combine with a WaitQueue to block on empty/full.
+
+#define LF_QUEUE_CACHE_LINE 64
+
+#define SPSC_QUEUE_BUFFER_SIZE(capacity, elem_size) \
+  ((size_t)(capacity) * (elem_size))
+
+// Each MPSC/MPMC cell holds a sequence number followed by the element
+#define MPMC_QUEUE_CELL_SIZE(elem_size) \
+  ((sizeof(size_t) + (elem_size) + 7) & ~(size_t)7)
+#define MPMC_QUEUE_BUFFER_SIZE(capacity, elem_size) \
+  ((size_t)(capacity) * MPMC_QUEUE_CELL_SIZE(elem_size))
+#define MPSC_QUEUE_BUFFER_SIZE(capacity, elem_size) \
+  MPMC_QUEUE_BUFFER_SIZE(capacity, elem_size)
+
+typedef struct SPSCQueue {
+  // Producer and consumer indices on their own cache lines
+  __attribute__((aligned(LF_QUEUE_CACHE_LINE))) _Atomic size_t head;
+  __attribute__((aligned(LF_QUEUE_CACHE_LINE))) _Atomic size_t tail;
+  __attribute__((aligned(LF_QUEUE_CACHE_LINE))) size_t mask;
+  size_t elem_size;
+  uint8_t* buffer;
+} SPSCQueue;
+
+typedef struct MPMCQueue {
+  __attribute__((aligned(LF_QUEUE_CACHE_LINE))) _Atomic size_t head;
+  __attribute__((aligned(LF_QUEUE_CACHE_LINE))) _Atomic size_t tail;
+  __attribute__((aligned(LF_QUEUE_CACHE_LINE))) size_t mask;
+  size_t elem_size;
+  size_t cell_size;
+  uint8_t* buffer;
+} MPMCQueue;
+
+// Same cells as MPMCQueue, the single consumer doesn't need CAS
+typedef struct MPSCQueue {
+  MPMCQueue queue;
+} MPSCQueue;
+
+// Returns 0 on success, -1 if capacity is not a power of 2 or args are invalid
+int spsc_queue_init(SPSCQueue* q, void* buffer, size_t capacity, size_t elem_size);
+bool spsc_queue_push(SPSCQueue* q, const void* elem);
+bool spsc_queue_pop(SPSCQueue* q, void* out);
+// Exact only when called from the producer or consumer side
+size_t spsc_queue_count(SPSCQueue* q);
+
+int mpsc_queue_init(MPSCQueue* q, void* buffer, size_t capacity, size_t elem_size);
+bool mpsc_queue_push(MPSCQueue* q, const void* elem);
+bool mpsc_queue_pop(MPSCQueue* q, void* out);
+
+int mpmc_queue_init(MPMCQueue* q, void* buffer, size_t capacity, size_t elem_size);
+bool mpmc_queue_push(MPMCQueue* q, const void* elem);
+bool mpmc_queue_pop(MPMCQueue* q, void* out);
+
+#endif // LF_QUEUE_H
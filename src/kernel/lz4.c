@@ -0,0 +1,75 @@
+#include <stdint.h>
+
+#include "lz4.h"
+
+#define LZ4_MIN_MATCH 4
+
+// Reads extended length bytes following a nibble value of 15
+static inline int read_length(const uint8_t** ip, const uint8_t* iend, size_t* length) {
+  uint8_t b;
+  do {
+    if (*ip >= iend) {
+      return -1;
+    }
+    b = *(*ip)++;
+    *length += b;
+  } while (b == 255);
+  return 0;
+}
+
+ssize_t lz4_decompress_block(const void* src, size_t src_size,
+                             void* dest, size_t dest_size) {
+  const uint8_t* ip = (const uint8_t*)src;
+  const uint8_t* const iend = ip + src_size;
+  uint8_t* op = (uint8_t*)dest;
+  uint8_t* const ostart = op;
+  uint8_t* const oend = op + dest_size;
+
+  while (ip < iend) {
+    uint8_t token = *ip++;
+
+    // Literals
+    size_t literal_length = token >> 4;
+    if (literal_length == 15 && read_length(&ip, iend, &literal_length) != 0) {
+      return -1;
+    }
+    if (literal_length > (size_t)(iend - ip) || literal_length > (size_t)(oend - op)) {
+      return -1;
+    }
+    for (size_t i = 0; i < literal_length; i++) {
+      *op++ = *ip++;
+    }
+
+    // Last sequence has only literals
+    if (ip >= iend) {
+      break;
+    }
+
+    // Match
+    if (iend - ip < 2) {
+      return -1;
+    }
+    size_t offset = ip[0] | ((size_t)ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - ostart)) {
+      return -1;
+    }
+
+    size_t match_length = token & 0xF;
+    if (match_length == 15 && read_length(&ip, iend, &match_length) != 0) {
+      return -1;
+    }
+    match_length += LZ4_MIN_MATCH;
+    if (match_length > (size_t)(oend - op)) {
+      return -1;
+    }
+
+    // Byte by byte, since the match may overlap the output
+    const uint8_t* match = op - offset;
+    for (size_t i = 0; i < match_length; i++) {
+      *op++ = *match++;
+    }
+  }
+
+  return op - ostart;
+}
@@ -0,0 +1,13 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Decompresses one LZ4 block (raw block format, no frame header).
+// Returns number of bytes written to dest, or -1 if the input is malformed
+// or doesn't fit into dest_size bytes.
+ssize_t lz4_decompress_block(const void* src, size_t src_size,
+                             void* dest, size_t dest_size);
+
+#endif // LZ4_H
@@ -19,11 +19,18 @@
 #include "mmu.h"
 #include "vfs.h"
 #include "ramfs.h"
+#include "initramfs.h"
 #include "log.h"
 #include "process.h"
+#include "ipi.h"
+#include "percpu.h"
+#include "klog.h"
+#include "pmu.h"
+#include "bench.h"
 
-#define INIT_BIN_LOAD_ADDR 0x70000000UL 
-#define INIT_BIN_PATH      "/sbin/init"
+#define INITRAMFS_LOAD_ADDR   0x70000000UL
+#define INITRAMFS_MAX_SIZE    0x4000000UL  // Sanity limit for the image size
+#define INITRAMFS_MOUNT_POINT "/sbin"
 
 const char* INITIAL_RAMFS_DIRECTORIES[] = {
   "/sbin",
@@ -38,20 +45,6 @@ void console_loop_task(void* arg) {
 }
 
 
-static int copy_init_bin_from_memory_to_file(VFSFileDescriptor* fd, uint8_t* src) {
-  const size_t init_bin_size = (1024 * 512);
-
-  size_t bytes_written = vfs_write(fd, src, init_bin_size);
-
-  if (bytes_written != init_bin_size) {
-    k_printf(LOG_FS "Failed to write to init binary file in RamFS\n");
-    k_printf(LOG_FS "Wrote 0x%lx bytes\n", bytes_written);
-    return -1;
-  }
-
-  return 0;
-}
-
 int setup_ramfs(void) {
   // Allocate 64 MB for ramfs
   static uint8_t ramfs_buffer[0x4000000];
@@ -87,21 +80,19 @@ int setup_ramfs(void) {
   }
   k_printf(LOG_FS "Created initial RamFS directories\n");
 
-
-  VFSFileDescriptor* init_process_fd = vfs_open(INIT_BIN_PATH, O_CREAT | O_RDWR, 0);
-  if (init_process_fd == NULL) {
-    k_printf(LOG_FS "Failed to create file %s for init process\n", INIT_BIN_PATH);
+  // Init binary and friends come from the image loaded by QEMU, contents
+  // are decompressed only when they are read
+  void* initramfs = initramfs_init((const void*)INITRAMFS_LOAD_ADDR, INITRAMFS_MAX_SIZE);
+  if (initramfs == NULL) {
+    k_printf(LOG_FS "No valid initramfs image at 0x%lx\n", INITRAMFS_LOAD_ADDR);
     return -1;
   }
-  k_printf(LOG_FS "Created init process file %s in RamFS\n", INIT_BIN_PATH);
 
-  int ret = copy_init_bin_from_memory_to_file(init_process_fd, (uint8_t*)INIT_BIN_LOAD_ADDR);
-  if (ret != 0) {
-    k_printf(LOG_FS "Failed to copy init process binary from 0x%lx to RamFS\n", INIT_BIN_LOAD_ADDR);
+  if (vfs_mount(INITRAMFS_MOUNT_POINT, initramfs_get_vfs_interface(), initramfs) != 0) {
+    k_printf(LOG_FS "Failed to mount initramfs at %s\n", INITRAMFS_MOUNT_POINT);
     return -1;
   }
-
-  vfs_close(init_process_fd);
+  k_printf(LOG_FS "Mounted initramfs at %s\n", INITRAMFS_MOUNT_POINT);
 
   // Placeholder console file for console output, since we don't have a real device driver yet
   VFSFileDescriptor* console_fd = vfs_open("/dev/console", O_CREAT, 0);
@@ -117,6 +108,8 @@ int setup_ramfs(void) {
 static _Atomic bool primary_cpu_started = false;
 
 int c_entry() {
+  percpu_init();
+  klog_init();
   mmu_init();
   
   pl011_enable();
@@ -134,6 +127,10 @@ int c_entry() {
   
   gicd_enable();
   gicc_enable(GET_CPU_ID());
+  ipi_init_cpu();
+  pmu_init_cpu();
+  // For user space timing, e.g. /sbin/bench
+  ENABLE_EL0_TIMER_COUNT();
 
   UNMASK_ALL_INTERRUPTS();
 
@@ -161,6 +158,8 @@ int c_entry() {
 }
 
 int c_entry_secondary_core(void) {
+  percpu_init();
+
   while (!primary_cpu_started) {
     // Wait for primary CPU to finish init
   }
@@ -173,12 +172,20 @@ int c_entry_secondary_core(void) {
   gicd_enable_irq(EL1_PHY_TIM_IRQ);
   gicc_set_priority_mask(0xFF, cpu_id);
   gicc_enable(cpu_id);
+  ipi_init_cpu();
+  pmu_init_cpu();
+  ENABLE_EL0_TIMER_COUNT();
 
   switch (cpu_id) {
   case 1:
+#ifdef BENCH_ON_BOOT
+    sched_create_kernel_task(bench_boot_task, NULL);
+#else
     sched_create_kernel_task(console_loop_task, NULL);
+#endif
     break;
   case 2:
+    sched_create_kernel_task(klog_drain_task, NULL);
     break;
   case 3:
     break;
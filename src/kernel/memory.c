@@ -4,7 +4,9 @@
 
 #include "memory.h"
 #include "spinlock.h"
+#include "trace.h"
 #include "mmu.h"
+#include "io.h"
 
 #define OBJECT_SIZE_SMALL  256
 #define OBJECT_SIZE_MEDIUM 4096
@@ -45,7 +47,21 @@ static int recently_freed_cache_small[CACHE_SIZE] = {-1, -1, -1, -1};
 static int recently_freed_cache_medium[CACHE_SIZE] = {-1, -1, -1, -1};
 static int recently_freed_cache_large[CACHE_SIZE] = {-1, -1, -1, -1};
 
-Spinlock k_malloc_lock = {0};
+static uint32_t requested_small[NUM_OBJECTS_SMALL];
+static uint32_t requested_medium[NUM_OBJECTS_MEDIUM];
+static uint32_t requested_large[NUM_OBJECTS_LARGE];
+
+#if K_MALLOC_TRACK_CALLERS
+static uintptr_t callers_small[NUM_OBJECTS_SMALL];
+static uintptr_t callers_medium[NUM_OBJECTS_MEDIUM];
+static uintptr_t callers_large[NUM_OBJECTS_LARGE];
+#endif
+
+// Protected by k_malloc_lock like the pools
+static uint64_t oversize_failures = 0;
+static uint64_t invalid_frees = 0;  // Double frees and pointers outside the pools
+
+Spinlock k_malloc_lock = SPINLOCK_INITIALIZER("k_malloc");
 
 typedef enum {
   POOL_NONE,
@@ -55,11 +71,17 @@ typedef enum {
 } PoolType;
 
 typedef struct {
+  const char* name;
   void* pool_base;
   bool* allocated;
   int* cache;
   size_t object_size;
   int num_objects;
+  uint32_t* requested;  // Size asked for, per object in use
+#if K_MALLOC_TRACK_CALLERS
+  uintptr_t* callers;  // Return address of the k_malloc call, per object in use
+#endif
+  KMallocPoolStats stats;
 } PoolInfo;
 
 typedef struct {
@@ -69,25 +91,43 @@ typedef struct {
 
 static PoolInfo pool_infos[NUM_POOLS] = {
   {
+    .name = "small",
     .pool_base = object_pool_small,
     .allocated = allocated_small,
     .cache = recently_freed_cache_small,
     .object_size = OBJECT_SIZE_SMALL,
     .num_objects = NUM_OBJECTS_SMALL,
+    .requested = requested_small,
+#if K_MALLOC_TRACK_CALLERS
+    .callers = callers_small,
+#endif
+    .stats = { .object_size = OBJECT_SIZE_SMALL, .num_objects = NUM_OBJECTS_SMALL },
   },
   {
+    .name = "medium",
     .pool_base = object_pool_medium,
     .allocated = allocated_medium,
     .cache = recently_freed_cache_medium,
     .object_size = OBJECT_SIZE_MEDIUM,
     .num_objects = NUM_OBJECTS_MEDIUM,
+    .requested = requested_medium,
+#if K_MALLOC_TRACK_CALLERS
+    .callers = callers_medium,
+#endif
+    .stats = { .object_size = OBJECT_SIZE_MEDIUM, .num_objects = NUM_OBJECTS_MEDIUM },
   },
   {
+    .name = "large",
     .pool_base = object_pool_large,
     .allocated = allocated_large,
     .cache = recently_freed_cache_large,
     .object_size = OBJECT_SIZE_LARGE,
     .num_objects = NUM_OBJECTS_LARGE,
+    .requested = requested_large,
+#if K_MALLOC_TRACK_CALLERS
+    .callers = callers_large,
+#endif
+    .stats = { .object_size = OBJECT_SIZE_LARGE, .num_objects = NUM_OBJECTS_LARGE },
   }
 };
 
@@ -102,14 +142,15 @@ static PoolType get_pool_type(size_t size) {
   return POOL_NONE;
 }
 
-static void* alloc_from_pool(PoolInfo* pool) {
+// Returns index of the allocated object, -1 if none are free
+static int alloc_from_pool(PoolInfo* pool) {
   // Check recently freed cache first
   for (int i = 0; i < CACHE_SIZE; i++) {
     if (pool->cache[i] != -1) {
       int idx = pool->cache[i];
       pool->allocated[idx] = true;
       pool->cache[i] = -1;
-      return (uint8_t*)pool->pool_base + (idx * pool->object_size);
+      return idx;
     }
   }
 
@@ -117,11 +158,11 @@ static void* alloc_from_pool(PoolInfo* pool) {
   for (int i = 0; i < pool->num_objects; i++) {
     if (!pool->allocated[i]) {
       pool->allocated[i] = true;
-      return (uint8_t*)pool->pool_base + (i * pool->object_size);
+      return i;
     }
   }
 
-  return NULL;  // No free objects
+  return -1;  // No free objects
 }
 
 static PointerInfo get_pointer_info(void* ptr) {
@@ -143,25 +184,51 @@ static PointerInfo get_pointer_info(void* ptr) {
   return (PointerInfo){POOL_NONE, -1};
 }
 
-void* k_malloc(size_t size) {
+static void* malloc_from(size_t size, uintptr_t caller) {
   if (size < 1) {
     return NULL;
   }
 
   PoolType pool_type = get_pool_type(size);
   if (pool_type == POOL_NONE) {
+    spinlock_acquire(&k_malloc_lock);
+    oversize_failures++;
+    spinlock_release(&k_malloc_lock);
     return NULL;  // Size too large
   }
 
+  PoolInfo* pool = &pool_infos[pool_type - 1];
+  void* ptr = NULL;
+
   spinlock_acquire(&k_malloc_lock);
-  void* ptr = alloc_from_pool(&pool_infos[pool_type - 1]);
+  int index = alloc_from_pool(pool);
+  if (index >= 0) {
+    ptr = (uint8_t*)pool->pool_base + (index * pool->object_size);
+    pool->requested[index] = (uint32_t)size;
+#if K_MALLOC_TRACK_CALLERS
+    pool->callers[index] = caller;
+#endif
+    pool->stats.allocations++;
+    pool->stats.requested_bytes += size;
+    if (++pool->stats.in_use > pool->stats.peak) {
+      pool->stats.peak = pool->stats.in_use;
+    }
+  } else {
+    pool->stats.failures++;
+  }
   spinlock_release(&k_malloc_lock);
 
+  (void)caller;
+  TRACE(TRACE_KMALLOC, 0, size, ptr);
   return ptr;
 }
 
+void* k_malloc(size_t size) {
+  return malloc_from(size, (uintptr_t)__builtin_return_address(0));
+}
+
 void* k_zalloc(size_t size) {
-  void* ret = k_malloc(size);
+  void* ret = malloc_from(size, (uintptr_t)__builtin_return_address(0));
   if (ret != NULL) {
     memset(ret, 0, size);
   }
@@ -174,20 +241,27 @@ void k_free(void* ptr) {
   }
 
   PointerInfo info = get_pointer_info(ptr);
+
+  spinlock_acquire(&k_malloc_lock);
+
   if (info.type == POOL_NONE || info.index == -1) {
+    invalid_frees++;
+    spinlock_release(&k_malloc_lock);
     return;  // Pointer not in any pool
   }
 
-  spinlock_acquire(&k_malloc_lock);
-
   PoolInfo* pool = &pool_infos[info.type - 1];
 
   if (!pool->allocated[info.index]) {
+    invalid_frees++;
     spinlock_release(&k_malloc_lock);
     return;  // Double free
   }
 
   pool->allocated[info.index] = false;
+  pool->stats.frees++;
+  pool->stats.in_use--;
+  pool->stats.requested_bytes -= pool->requested[info.index];
 
   // Add to recently freed cache
   for (int i = 0; i < CACHE_SIZE; i++) {
@@ -200,6 +274,83 @@ void k_free(void* ptr) {
   spinlock_release(&k_malloc_lock);
 }
 
+void k_malloc_stats_print(void) {
+  KMallocPoolStats stats[NUM_POOLS];
+  uint64_t oversize;
+  uint64_t invalid;
+
+  // Copied under the lock so that each pool's numbers agree
+  spinlock_acquire(&k_malloc_lock);
+  for (int p = 0; p < NUM_POOLS; p++) {
+    stats[p] = pool_infos[p].stats;
+  }
+  oversize = oversize_failures;
+  invalid = invalid_frees;
+  spinlock_release(&k_malloc_lock);
+
+  for (int p = 0; p < NUM_POOLS; p++) {
+    KMallocPoolStats* s = &stats[p];
+    // Internal fragmentation, space in objects beyond what was asked for
+    uint64_t wasted = s->in_use * s->object_size - s->requested_bytes;
+    k_printf_wait("%s (%lu B): in use %u/%u, peak %u, allocs %lu, frees %lu, failed %lu, wasted %lu B\n",
+                  pool_infos[p].name, s->object_size, s->in_use, s->num_objects, s->peak,
+                  s->allocations, s->frees, s->failures, wasted);
+  }
+  k_printf_wait("oversize requests failed %lu, invalid frees %lu\n", oversize, invalid);
+}
+
+#define CALLERS_MAX 64
+
+void k_malloc_callers_print(void) {
+#if K_MALLOC_TRACK_CALLERS
+  static struct {
+    uintptr_t caller;
+    int pool;
+    uint32_t count;
+    uint64_t bytes;
+  } callers[CALLERS_MAX];
+  uint32_t num_callers = 0;
+  uint32_t untracked = 0;
+
+  spinlock_acquire(&k_malloc_lock);
+  for (int p = 0; p < NUM_POOLS; p++) {
+    PoolInfo* pool = &pool_infos[p];
+    for (int i = 0; i < pool->num_objects; i++) {
+      if (!pool->allocated[i]) {
+        continue;
+      }
+      uint32_t c = 0;
+      while (c < num_callers && (callers[c].caller != pool->callers[i] || callers[c].pool != p)) {
+        c++;
+      }
+      if (c == num_callers) {
+        if (num_callers == CALLERS_MAX) {
+          untracked++;
+          continue;
+        }
+        callers[c].caller = pool->callers[i];
+        callers[c].pool = p;
+        callers[c].count = 0;
+        callers[c].bytes = 0;
+        num_callers++;
+      }
+      callers[c].count++;
+      callers[c].bytes += pool->requested[i];
+    }
+  }
+  spinlock_release(&k_malloc_lock);
+
+  for (uint32_t c = 0; c < num_callers; c++) {
+    k_printf_wait("0x%lx %s: %u objects, %lu B requested\n", callers[c].caller,
+                  pool_infos[callers[c].pool].name, callers[c].count, callers[c].bytes);
+  }
+  if (untracked > 0) {
+    k_printf_wait("%u objects from other callers\n", untracked);
+  }
+#else
+  k_printf_wait("Caller tracking disabled, set K_MALLOC_TRACK_CALLERS in memory.h\n");
+#endif
+}
 
 int allocate_user_memory_block(uint64_t* l2_table, bool executable,
                                VirtualMemoryMapping* out_mapping) {
@@ -253,8 +404,9 @@ void free_user_memory_block(VirtualMemoryMapping* mapping) {
     return;
   }
 
-  // Invalidate L2 entry
+  // Invalidate L2 entry, other CPUs may still have it cached
   *(mapping->l2_entry) = DESC_INVALID;
+  mmu_invalidate_user_va(mapping->va);
 
   // Free physical memory back to kernel
   k_free(mapping->pa);
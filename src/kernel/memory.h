@@ -3,13 +3,36 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 
+// Set to 0 to stop recording the caller of each allocation
+#define K_MALLOC_TRACK_CALLERS 1
+
 // Kernel malloc with object pool allocation and spinlock protection
 void* k_malloc(size_t size);
 void* k_zalloc(size_t size);
 void k_free(void* ptr);
 
+// Occupancy and counters of one size class
+typedef struct KMallocPoolStats {
+  size_t object_size;
+  uint32_t num_objects;
+  uint32_t in_use;
+  uint32_t peak;            // Highest in_use seen
+  uint64_t allocations;
+  uint64_t frees;
+  uint64_t failures;        // Pool was exhausted
+  uint64_t requested_bytes; // Sum of the sizes asked for by objects in use
+} KMallocPoolStats;
+
+// Per-pool counters, plus failed oversize requests and frees of pointers
+// not allocated
+void k_malloc_stats_print(void);
+// Lists objects in use grouped by the code that allocated them, to spot
+// leaks by comparing runs. Needs K_MALLOC_TRACK_CALLERS.
+void k_malloc_callers_print(void);
+
 typedef struct VirtualMemoryMapping {
   void* va;
   void* pa;
@@ -1,35 +1,54 @@
 #include "armv8-a.h"
 #include "string.h"
 #include "mmu.h"
-#include "spinlock.h"
 #include "memory.h"
+#include "ipi.h"
+#include "percpu.h"
+#include "spinlock.h"
 
-// Needs 4KB alignment
-__attribute__((aligned(4096)))
-static uint64_t l1_page_table[NUM_CPUS][L1_PAGE_TABLE_ENTRIES];
+#define KERNEL_ATTRS (UXN | AF | SH_INNER | INDX_NORMAL_WB | AP_RW_EL1)
 
 // Kernel base address from linker script
 extern uint64_t kernel_base[];
 extern uint64_t device_memory_base[];
 
-static Spinlock mmu_lock = {0};
+// Kernel gigabyte in 2MB blocks, shared by all CPUs
+__attribute__((aligned(4096)))
+static uint64_t kernel_l2_table[L2_PAGE_TABLE_ENTRIES];
+
+static bool kernel_tables_built = false;
+static Spinlock kernel_tables_lock = SPINLOCK_INITIALIZER("mmu");
+
+static inline uint64_t kernel_block_base(void) {
+  return (uint64_t)kernel_base & ~(BLOCK_SIZE_L1 - 1);
+}
+
+// Primary CPU builds these before secondaries are started
+static void build_kernel_tables(void) {
+  for (uint64_t i = 0; i < L2_PAGE_TABLE_ENTRIES; i++) {
+    kernel_l2_table[i] = KERNEL_ATTRS | (kernel_block_base() + i * BLOCK_SIZE_L2) | DESC_BLOCK;
+  }
+  kernel_tables_built = true;
+}
 
 void mmu_init(void) {
-  uint32_t cpu_id = GET_CPU_ID();
+  uint64_t* l1_page_table = THIS_CPU_VAR(l1_page_table);
   
   // Userspace
-  l1_page_table[cpu_id][0] = DESC_INVALID;
+  l1_page_table[0] = DESC_INVALID;
   
-  // Kernel
-  const uint64_t kernel_block_base = (uint64_t)kernel_base & ~(BLOCK_SIZE_L1 - 1);
-  l1_page_table[cpu_id][1] = UXN | kernel_block_base | AF | SH_INNER | INDX_NORMAL_WB | AP_RW_EL1 | DESC_BLOCK;
+  // Kernel, through an L2 table so that single pages can be unmapped
+  if (!kernel_tables_built) {
+    build_kernel_tables();
+  }
+  l1_page_table[1] = DESC_TABLE | ((uint64_t)kernel_l2_table & OA_MASK);
   
   // Unused (also seems to be unaccessable in QEMU)
-  l1_page_table[cpu_id][2] = DESC_INVALID;
+  l1_page_table[2] = DESC_INVALID;
   
   // MMIO
   const uint64_t mmio_block_base = (uint64_t)device_memory_base & ~(BLOCK_SIZE_L1 - 1);
-  l1_page_table[cpu_id][3] = PXN | UXN | mmio_block_base | AF | INDX_DEVICE | AP_RW_EL1 | DESC_BLOCK;
+  l1_page_table[3] = PXN | UXN | mmio_block_base | AF | INDX_DEVICE | AP_RW_EL1 | DESC_BLOCK;
 
   // Configure MAIR_EL1 with memory attribute attributes
   uint64_t mair = (MAIR_DEVICE_nGnRnE << 0)     // Index 0
@@ -40,7 +59,7 @@ void mmu_init(void) {
   // We have VAs until 0xFFFFFFFF = 32-bit address space
   __asm__ __volatile__ ("msr tcr_el1, %0" :: "r"(32UL));
 
-  // Load L1 page table
+  // Load this CPU's own L1 page table
   __asm__ __volatile__ ("msr ttbr0_el1, %0" :: "r"((uint64_t)l1_page_table));
 
   // Barriers
@@ -73,27 +92,96 @@ void mmu_free_user_l2_table(uint64_t* l2_table) {
   }
 }
 
+static inline void invalidate_local_tlb(void) {
+  __asm__ __volatile__ (
+    "dsb ishst\n"           // Ensure page table write is visible
+    "tlbi vmalle1\n"        // Invalidate all TLB entries of this CPU only
+    "dsb nsh\n"             // Wait for invalidation to complete
+    "isb\n"                 // Synchronize
+    ::: "memory"
+  );
+}
+
+// Each CPU only writes its own L1 table (the shootdown below runs on the
+// owning CPU too), so no lock and no broadcast invalidation is needed
 void mmu_set_user_l2_table(uint64_t* l2_table) {
-  uint32_t cpu_id = GET_CPU_ID();
-  spinlock_acquire(&mmu_lock);
-  
+  uint64_t* l1_page_table = THIS_CPU_VAR(l1_page_table);
+
   if (l2_table == NULL) {
     // Invalidate user mappings
-    l1_page_table[cpu_id][0] = DESC_INVALID;
+    l1_page_table[0] = DESC_INVALID;
   } else {
     // Create L1 table descriptor pointing to L2 table
     uint64_t desc = DESC_TABLE | ((uint64_t)l2_table & OA_MASK);
-    l1_page_table[cpu_id][0] = desc;
+    l1_page_table[0] = desc;
   }
   
-  // TLB invalidation after page table modification
+  invalidate_local_tlb();
+}
+
+static void drop_user_l2_table_ipi(void* arg) {
+  uint64_t* l1_page_table = THIS_CPU_VAR(l1_page_table);
+  uint64_t desc = DESC_TABLE | ((uint64_t)arg & OA_MASK);
+
+  if (l1_page_table[0] == desc) {
+    l1_page_table[0] = DESC_INVALID;
+    invalidate_local_tlb();
+  }
+}
+
+void mmu_shootdown_user_l2_table(uint64_t* l2_table) {
+  if (l2_table != NULL) {
+    ipi_call_function_all(drop_user_l2_table_ipi, l2_table, true, true);
+  }
+}
+
+int mmu_unmap_kernel_page(void* va) {
+  uint64_t addr = (uint64_t)va;
+  if ((addr & (PAGE_SIZE - 1)) != 0 || addr < kernel_block_base() ||
+      addr >= kernel_block_base() + BLOCK_SIZE_L1) {
+    return -1;
+  }
+
+  uint64_t offset = addr - kernel_block_base();
+  uint64_t* l2_entry = &kernel_l2_table[offset / BLOCK_SIZE_L2];
+  uint64_t l3_index = (offset % BLOCK_SIZE_L2) / PAGE_SIZE;
+
+  spinlock_acquire(&kernel_tables_lock);
+
+  if ((*l2_entry & (DESC_TABLE)) != (DESC_TABLE)) {
+    // Still a block, split it into pages with the same attributes. The
+    // table comes from the 4 KB pool, which is page aligned.
+    uint64_t* l3_table = k_malloc(L3_PAGE_TABLE_ENTRIES * sizeof(uint64_t));
+    if (l3_table == NULL) {
+      spinlock_release(&kernel_tables_lock);
+      return -1;
+    }
+    uint64_t block_base = *l2_entry & ~(BLOCK_SIZE_L2 - 1) & OA_MASK;
+    for (uint64_t i = 0; i < L3_PAGE_TABLE_ENTRIES; i++) {
+      l3_table[i] = KERNEL_ATTRS | (block_base + i * PAGE_SIZE) | DESC_PAGE;
+    }
+
+    // Break-before-make, nothing else may use this block meanwhile
+    *l2_entry = DESC_INVALID;
+    __asm__ __volatile__ ("dsb ishst; tlbi vmalle1is; dsb ish; isb" ::: "memory");
+    *l2_entry = DESC_TABLE | ((uint64_t)l3_table & OA_MASK);
+  }
+
+  uint64_t* l3_table = (uint64_t*)(*l2_entry & OA_MASK);
+  l3_table[l3_index] = DESC_INVALID;
+  mmu_invalidate_user_va(va);  // Same broadcast invalidation by VA
+
+  spinlock_release(&kernel_tables_lock);
+  return 0;
+}
+
+void mmu_invalidate_user_va(const void* va) {
+  // Broadcast to all CPUs by hardware, no IPI needed
   __asm__ __volatile__ (
-    "dsb ishst\n"           // Ensure page table write is visible
-    "tlbi vmalle1is\n"      // Invalidate all TLB entries (inner shareable)
-    "dsb ish\n"             // Wait for invalidation to complete
-    "isb\n"                 // Synchronize
-    ::: "memory"
+    "dsb ishst\n"
+    "tlbi vaae1is, %0\n"    // All ASIDs, inner shareable
+    "dsb ish\n"
+    "isb\n"
+    :: "r"((uintptr_t)va >> 12) : "memory"
   );
-  
-  spinlock_release(&mmu_lock);
 }
@@ -11,6 +11,9 @@
 // Table entries
 #define L1_PAGE_TABLE_ENTRIES 4    // For 32-bit VA space with 1GB blocks
 #define L2_PAGE_TABLE_ENTRIES 512  // 512 * 2MB = 1GB coverage
+#define L3_PAGE_TABLE_ENTRIES 512  // 512 * 4KB = 2MB coverage
+
+#define PAGE_SIZE 0x1000UL
 
 /*
 Page table descriptor bits:
@@ -106,5 +109,14 @@ void mmu_init(void);
 uint64_t* mmu_create_user_l2_table(void);
 void mmu_free_user_l2_table(uint64_t* l2_table);
 void mmu_set_user_l2_table(uint64_t* l2_table);
+// Unloads l2_table from every CPU still having it loaded, waits for all CPUs.
+// Call before freeing the table, not with interrupts masked.
+void mmu_shootdown_user_l2_table(uint64_t* l2_table);
+// Drops TLB entries of a user VA on all CPUs after its mapping was changed
+void mmu_invalidate_user_va(const void* va);
+// Makes a kernel page fault on access, e.g. a stack guard page. Splits the
+// 2MB block around it into pages, so nothing else in that block may be in
+// use while the first page of the block is unmapped. Returns 0 on success.
+int mmu_unmap_kernel_page(void* va);
 
 #endif // MMU_H
\ No newline at end of file
@@ -0,0 +1,17 @@
+#include <stddef.h>
+
+#include "percpu.h"
+
+__attribute__((section(".percpu")))
+PerCPU percpu_areas[NUM_CPUS];
+
+void percpu_init(void) {
+  uint32_t cpu_id = GET_CPU_ID();
+  PerCPU* area = &percpu_areas[cpu_id];
+
+  area->cpu_id = cpu_id;
+  area->current_task = NULL;
+  area->irq_off_depth = 0;
+
+  __asm__ __volatile__ ("msr tpidr_el1, %0" :: "r"(area) : "memory");
+}
@@ -0,0 +1,51 @@
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include <stdint.h>
+
+#include "armv8-a.h"
+#include "mmu.h"
+
+struct Task;
+
+// State owned by one CPU. Each CPU's area lives in the .percpu section on
+// its own cache lines, and TPIDR_EL1 points to it.
+typedef struct PerCPU {
+  // First so that the table gets the alignment TTBR0_EL1 needs
+  uint64_t l1_page_table[L1_PAGE_TABLE_ENTRIES];
+  uint32_t cpu_id;
+  struct Task* current_task;
+  // Scheduler state, written under the sched_ctx lock. task_list is a ring
+  // of the tasks placed on this CPU, idle task excluded.
+  struct Task* idle_task;
+  struct Task* task_list;
+  uint32_t task_count;
+  // Terminated task this CPU switched away from, freed at the next switch
+  // when its stack is no longer in use
+  struct Task* dead_task;
+  // User task whose FP/SIMD state is in this CPU's registers
+  struct Task* fpsimd_owner;
+  // Nesting of held spinlocks that mask interrupts, and DAIF from before
+  // the outermost one was taken
+  uint32_t irq_off_depth;
+  uint32_t irq_saved_daif;
+} __attribute__((aligned(CACHE_LINE_SIZE))) PerCPU;
+
+extern PerCPU percpu_areas[NUM_CPUS];
+
+// Call first thing on each CPU, before any spinlock is used
+void percpu_init(void);
+
+// Tasks never migrate, so the pointer stays valid for the calling task and
+// the compiler may keep it in a register
+static inline PerCPU* this_cpu(void) {
+  PerCPU* area;
+  __asm__ ("mrs %0, tpidr_el1" : "=r"(area));
+  return area;
+}
+
+#define THIS_CPU_VAR(field) (this_cpu()->field)
+#define PER_CPU_VAR(cpu, field) (percpu_areas[(cpu)].field)
+#define THIS_CPU_ID() THIS_CPU_VAR(cpu_id)
+
+#endif // PERCPU_H
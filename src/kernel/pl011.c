@@ -13,6 +13,8 @@ static inline uint32_t pl011_read_reg32(uint64_t offset) {
 }
 
 void pl011_enable(void) {
+  // FIFOs let the TX interrupt refill many characters at once
+  pl011_write_reg32(UARTLCR_H, pl011_read_reg32(UARTLCR_H) | UARTLCR_H_FEN);
   pl011_write_reg32(UARTCR, 
     pl011_read_reg32(UARTCR) | UARTCR_UARTEN | UARTCR_RXE | UARTCR_TXE);
 }
@@ -26,23 +28,45 @@ int pl011_rx_full(void) {
   return res;
 }
 
+int pl011_tx_fifo_full(void) {
+  return (pl011_read_reg32(UARTFR) & UARTFR_TXFF);
+}
+
+int pl011_rx_fifo_empty(void) {
+  return (pl011_read_reg32(UARTFR) & UARTFR_RXFE);
+}
+
 void pl011_putc(const char c) {
   while (pl011_busy()) {}
   pl011_write_reg32(UARTDR, c);
 }
 
+void pl011_write_data(const char c) {
+  pl011_write_reg32(UARTDR, c);
+}
+
 char pl011_getc(void) {
-  while (!pl011_rx_full()) {}
+  while (pl011_rx_fifo_empty()) {}
   return (char)(pl011_read_reg32(UARTDR) & 0xFF);
 }
 
 void pl011_set_rx_irq(bool enable) {
   uint32_t read = pl011_read_reg32(UARTIMSC);
   if (enable) {
-    pl011_write_reg32(UARTIMSC, read | UARTIMSC_RXIM);
+    pl011_write_reg32(UARTIMSC, read | UARTIMSC_RXIM | UARTIMSC_RTIM);
+  }
+  else {
+    pl011_write_reg32(UARTIMSC, read & ~(UARTIMSC_RXIM | UARTIMSC_RTIM));
+  }
+}
+
+void pl011_set_tx_irq(bool enable) {
+  uint32_t read = pl011_read_reg32(UARTIMSC);
+  if (enable) {
+    pl011_write_reg32(UARTIMSC, read | UARTIMSC_TXIM);
   }
   else {
-    pl011_write_reg32(UARTIMSC, read & ~UARTIMSC_RXIM);
+    pl011_write_reg32(UARTIMSC, read & ~UARTIMSC_TXIM);
   }
 }
 
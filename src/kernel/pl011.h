@@ -8,6 +8,7 @@
 
 #define UARTFR 0x18
 #define UARTFR_BUSY (1u << 3u)
+#define UARTFR_RXFE (1u << 4u)
 #define UARTFR_TXFF (1u << 5u)
 #define UARTFR_RXFF (1u << 6u)
 
@@ -22,6 +23,7 @@
 #define UARTIMSC 0x38
 #define UARTIMSC_RXIM (1u << 4u)
 #define UARTIMSC_TXIM (1u << 5u)
+#define UARTIMSC_RTIM (1u << 6u)
 
 #define UARTRIS 0x3C
 #define UARTRIS_RXRIS (1u << 4u)
@@ -32,9 +34,18 @@
 void pl011_enable(void);
 int pl011_busy(void);
 int pl011_rx_full(void);
+int pl011_tx_fifo_full(void);
+int pl011_rx_fifo_empty(void);
+// Waits until the transmitter is idle, for synchronous output
 void pl011_putc(const char c);
+// No waiting, check pl011_tx_fifo_full first
+void pl011_write_data(const char c);
 char pl011_getc(void);
+// Also enables the receive timeout interrupt, so that characters left
+// below the FIFO trigger level are delivered too
 void pl011_set_rx_irq(bool enable);
+// Raised while the TX FIFO is at or below its trigger level
+void pl011_set_tx_irq(bool enable);
 uint32_t pl011_get_raw_irq_status(void);
 uint32_t pl011_get_masked_irq_status(void);
 void pl011_print_info(void (*printf_func)(const char* format, ...));
@@ -29,5 +29,8 @@
 #define SYS_TIMER_C2_IRQ  (VC_IRQ_BASE + 2)
 #define SYS_TIMER_C3_IRQ  (VC_IRQ_BASE + 3)
 
+// PMU overflow PPI of each core, as wired by QEMU's raspi4b model
+#define PMU_IRQ           (16 + 7)
+
 
 #endif // PLATFORM_H
\ No newline at end of file
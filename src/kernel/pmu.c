@@ -0,0 +1,84 @@
+#include <stdint.h>
+
+#include "pmu.h"
+#include "gic.h"
+#include "platform.h"
+
+#define PMU_WRITE(reg, value) \
+    asm volatile ("msr " #reg ", %0" : : "r"((uint64_t)(value)))
+#define PMU_READ(reg) ({ \
+    uint64_t _value; \
+    asm volatile ("mrs %0, " #reg : "=r"(_value)); \
+    _value; \
+})
+
+void pmu_init_cpu(void) {
+  PMU_WRITE(pmcntenclr_el0, 0xFFFFFFFFu);
+  PMU_WRITE(pmintenclr_el1, 0xFFFFFFFFu);
+  PMU_WRITE(pmovsclr_el0, 0xFFFFFFFFu);
+  // Count at EL0 and EL1
+  PMU_WRITE(pmccfiltr_el0, 0);
+  PMU_WRITE(pmcr_el0, PMCR_E | PMCR_P | PMCR_C | PMCR_LC);
+  asm volatile ("isb" ::: "memory");
+
+  // PPIs are banked, this enables it for the calling CPU
+  gicd_enable_irq(PMU_IRQ);
+  gicd_set_irq_priority(PMU_IRQ, 0);
+}
+
+uint32_t pmu_num_counters(void) {
+  return (uint32_t)(PMU_READ(pmcr_el0) >> PMCR_N_SHIFT) & PMCR_N_MASK;
+}
+
+void pmu_set_event(uint32_t counter, uint32_t event) {
+  if (counter == PMU_CYCLE_COUNTER) {
+    return;  // Fixed to cycles
+  }
+  PMU_WRITE(pmselr_el0, counter);
+  asm volatile ("isb" ::: "memory");
+  // Filter bits left zero, counts at EL0 and EL1
+  PMU_WRITE(pmxevtyper_el0, event);
+}
+
+void pmu_write_counter(uint32_t counter, uint64_t value) {
+  if (counter == PMU_CYCLE_COUNTER) {
+    PMU_WRITE(pmccntr_el0, value);
+    return;
+  }
+  PMU_WRITE(pmselr_el0, counter);
+  asm volatile ("isb" ::: "memory");
+  PMU_WRITE(pmxevcntr_el0, (uint32_t)value);
+}
+
+uint64_t pmu_read_counter(uint32_t counter) {
+  if (counter == PMU_CYCLE_COUNTER) {
+    return PMU_READ(pmccntr_el0);
+  }
+  PMU_WRITE(pmselr_el0, counter);
+  asm volatile ("isb" ::: "memory");
+  return PMU_READ(pmxevcntr_el0) & 0xFFFFFFFFu;
+}
+
+void pmu_enable_counters(uint32_t mask) {
+  PMU_WRITE(pmcntenset_el0, mask);
+  asm volatile ("isb" ::: "memory");
+}
+
+void pmu_disable_counters(uint32_t mask) {
+  PMU_WRITE(pmcntenclr_el0, mask);
+  asm volatile ("isb" ::: "memory");
+}
+
+void pmu_enable_overflow_irq(uint32_t mask) {
+  PMU_WRITE(pmintenset_el1, mask);
+}
+
+void pmu_disable_overflow_irq(uint32_t mask) {
+  PMU_WRITE(pmintenclr_el1, mask);
+}
+
+uint32_t pmu_read_clear_overflow(void) {
+  uint32_t overflowed = (uint32_t)PMU_READ(pmovsclr_el0);
+  PMU_WRITE(pmovsclr_el0, overflowed);
+  return overflowed;
+}
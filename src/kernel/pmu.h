@@ -0,0 +1,42 @@
+#ifndef PMU_H
+#define PMU_H
+
+#include <stdint.h>
+
+// PMUv3 of the calling CPU. Counters are numbered like the PMCNTEN and
+// PMOVS bitmasks: event counters from 0, the cycle counter is 31.
+
+#define PMU_CYCLE_COUNTER 31u
+
+// Common architectural events
+#define PMU_EVENT_INST_RETIRED 0x08u
+#define PMU_EVENT_CPU_CYCLES   0x11u
+
+#define PMCR_E  (1u << 0)   // Enable
+#define PMCR_P  (1u << 1)   // Reset event counters
+#define PMCR_C  (1u << 2)   // Reset cycle counter
+#define PMCR_LC (1u << 6)   // Cycle counter overflows at 64 bits
+#define PMCR_N_SHIFT 11
+#define PMCR_N_MASK  0x1Fu
+
+// Resets and enables the PMU and unmasks its overflow PPI, call on each
+// CPU after gicc_enable
+void pmu_init_cpu(void);
+
+// Event counters implemented, the cycle counter is not included
+uint32_t pmu_num_counters(void);
+
+void pmu_set_event(uint32_t counter, uint32_t event);
+// Event counters are 32 bits, the cycle counter 64
+void pmu_write_counter(uint32_t counter, uint64_t value);
+uint64_t pmu_read_counter(uint32_t counter);
+
+// Masks have bit n set for counter n
+void pmu_enable_counters(uint32_t mask);
+void pmu_disable_counters(uint32_t mask);
+void pmu_enable_overflow_irq(uint32_t mask);
+void pmu_disable_overflow_irq(uint32_t mask);
+// Returns the counters that overflowed and clears their flags
+uint32_t pmu_read_clear_overflow(void);
+
+#endif // PMU_H
@@ -1,3 +1,5 @@
+#include <stdatomic.h>
+
 #include "string.h"
 
 #include "io.h"
@@ -9,52 +11,91 @@
 #include "mmu.h"
 #include "armv8-a.h"
 #include "elf-loader.h"
-#include "spinlock.h"
-
+#include "rwlock.h"
+#include "fd-table.h"
+#include "io-ring-kernel.h"
+#include "id-table.h"
 
-typedef struct FileDescriptor {
-  int fd;
-  VFSFileDescriptor* vfs_fd;
-} FileDescriptor;
+// Process descriptors are carved out of 4 KB k_malloc objects
+#define PROCESS_PAGE_SIZE 4096
 
 typedef struct Process {
   pid_t pid;
   task_id_t task_id;
   bool allocated;
-  FileDescriptor open_fds[MAX_OPEN_FDS];
+  FDTable fd_table;
+  IORingContext* io_ring;
+  // One ring per process. Set as the first step of io_ring_setup and
+  // cleared only if that setup fails. io_ring is assigned only at the end,
+  // so it can't serve as this check.
+  _Atomic bool io_ring_claimed;
   uint64_t* l2_table;
   VirtualMemoryMapping virtual_memory_mappings[MAX_VIRTUAL_MEMORY_MAPPINGS];
+  IdTableNode pid_node;
+  struct Process* next_free;
 } Process;
 
+#define PROCESSES_PER_PAGE (PROCESS_PAGE_SIZE / sizeof(Process))
+_Static_assert(PROCESSES_PER_PAGE > 0, "Process must fit in a page");
+
 typedef struct ProcessesContext {
-  Process processes[MAX_PROCESSES];
+  // Live processes by pid. Pages are never freed, so a Process pointer
+  // stays valid memory after the lock is released.
+  IdTable table;
+  Process* free_processes;
   pid_t pid_counter;
-  Spinlock lock;
+  // Lookups are far more common than creating or destroying processes
+  RWLock lock;
 } ProcessesContext;
 
 
 static ProcessesContext processes_ctx;
 
 static inline Process* get_process_by_pid(pid_t pid) {
-  for (int i = 0; i < MAX_PROCESSES; i++) {
-    if (processes_ctx.processes[i].allocated && processes_ctx.processes[i].pid == pid) {
-      return &processes_ctx.processes[i];
+  Process* process = NULL;
+
+  rwlock_read_acquire(&processes_ctx.lock);
+  IdTableNode* node = id_table_find(&processes_ctx.table, pid);
+  if (node != NULL) {
+    process = ID_TABLE_ENTRY(node, Process, pid_node);
+  }
+  rwlock_read_release(&processes_ctx.lock);
+
+  return process;
+}
+
+// Write lock must be held
+static Process* allocate_process(void) {
+  if (processes_ctx.free_processes == NULL) {
+    Process* page = k_zalloc(PROCESS_PAGE_SIZE);
+    if (page == NULL) {
+      return NULL;
+    }
+    for (size_t i = 0; i < PROCESSES_PER_PAGE; i++) {
+      page[i].next_free = processes_ctx.free_processes;
+      processes_ctx.free_processes = &page[i];
     }
   }
-  return NULL;
+
+  Process* p = processes_ctx.free_processes;
+  processes_ctx.free_processes = p->next_free;
+  p->next_free = NULL;
+  return p;
+}
+
+// Write lock must be held, p must not be in the table
+static void free_process(Process* p) {
+  memset(p, 0, sizeof(Process));
+  p->next_free = processes_ctx.free_processes;
+  processes_ctx.free_processes = p;
 }
 
 static Process* create_process(void) {
   Process *p = NULL;
 
-  spinlock_acquire(&processes_ctx.lock);
+  rwlock_write_acquire(&processes_ctx.lock);
 
-  for (int i = 0; i < MAX_PROCESSES; i++) {
-    if (!processes_ctx.processes[i].allocated) {
-      p = &processes_ctx.processes[i];
-      break;
-    }
-  }
+  p = allocate_process();
   if (p == NULL) {
     goto no_space;
   }
@@ -65,17 +106,24 @@ static Process* create_process(void) {
   if (p->l2_table == NULL) {
     goto mmu_create_user_l2_table_fail;
   }
+
+  if (fd_table_init(&p->fd_table) != 0) {
+    goto fd_table_init_fail;
+  }
   // First pid is 1
   p->pid = ++processes_ctx.pid_counter;
+  id_table_insert(&processes_ctx.table, &p->pid_node, p->pid);
 
-  spinlock_release(&processes_ctx.lock);
+  rwlock_write_release(&processes_ctx.lock);
 
   return p;
 
+fd_table_init_fail:
+  mmu_free_user_l2_table(p->l2_table);
 mmu_create_user_l2_table_fail:
-  p->allocated = false;
+  free_process(p);
 no_space:
-  spinlock_release(&processes_ctx.lock);
+  rwlock_write_release(&processes_ctx.lock);
   return NULL;
 }
 
@@ -85,16 +133,21 @@ int process_destroy(pid_t pid) {
     return -1;
   }
 
-  spinlock_acquire(&processes_ctx.lock);
-  for (int j = 0; j < MAX_OPEN_FDS; j++) {
-    if (process->open_fds[j].vfs_fd != NULL) {
-      if (vfs_close(process->open_fds[j].vfs_fd) != 0) {
-        k_printf(LOG_KERNEL "Failed to close fd %d for process %d during destruction\n",
-                  process->open_fds[j].fd, pid);
-      }
-    }
+  // Worker must be stopped before the ring memory and fds are freed
+  if (process->io_ring != NULL) {
+    io_ring_destroy(process->io_ring);
+    process->io_ring = NULL;
   }
 
+  // Another CPU may still have the address space loaded (e.g. a syscall
+  // handler), get it off there before the memory is freed. Blocked kernel
+  // tasks must not load it again when they resume either.
+  sched_forget_l2_table(process->l2_table);
+  mmu_shootdown_user_l2_table(process->l2_table);
+
+  rwlock_write_acquire(&processes_ctx.lock);
+  fd_table_destroy(&process->fd_table);
+
   for (int j = 0; j < MAX_VIRTUAL_MEMORY_MAPPINGS; j++) {
     if (process->virtual_memory_mappings[j].pa != NULL) {
       free_user_memory_block(&process->virtual_memory_mappings[j]);
@@ -105,11 +158,10 @@ int process_destroy(pid_t pid) {
 
   (void)sched_terminate_task(process->task_id);
 
-  memset(process->open_fds, 0, sizeof(process->open_fds));
-  memset(process->virtual_memory_mappings, 0, sizeof(process->virtual_memory_mappings));
-  memset(process, 0, sizeof(Process));
+  id_table_remove(&processes_ctx.table, &process->pid_node);
+  free_process(process);
 
-  spinlock_release(&processes_ctx.lock);
+  rwlock_write_release(&processes_ctx.lock);
   return 0;
 }
 
@@ -118,6 +170,10 @@ pid_t process_create_init_process(void) {
     return -1;
   }
 
+  return process_spawn("/sbin/init", GET_CPU_ID());
+}
+
+pid_t process_spawn(const char* path, uint32_t cpu_id) {
   Process* p = create_process();
 
   if (p == NULL) {
@@ -135,31 +191,33 @@ pid_t process_create_init_process(void) {
   }
 
 
-  VFSFileDescriptor* init_bin_fd = vfs_open("/sbin/init", O_RDONLY, 0);
-  if (init_bin_fd == NULL) {
+  VFSFileDescriptor* bin_fd = vfs_open(path, O_RDONLY, 0);
+  if (bin_fd == NULL) {
     goto destroy_process;
   }
 
   // Dummy console to reserve fd 1
   VFSFileDescriptor* console_fd = vfs_open("/dev/console", O_RDWR, 0);
   if (console_fd == NULL) {
-    goto destroy_process;
+    goto close_bin;
   }
 
-  p->open_fds[1].fd = 1;
-  p->open_fds[1].vfs_fd = console_fd;
+  if (fd_table_install_at(&p->fd_table, 1, console_fd) != 1) {
+    vfs_close(console_fd);
+    goto close_bin;
+  }
 
   VFSStat stat;
-  if (vfs_stat("/sbin/init", &stat) != 0) {
-    goto destroy_process;
+  if (vfs_stat(path, &stat) != 0) {
+    goto close_bin;
   }
 
   void *tmp_elf = k_malloc(stat.size);
   if (tmp_elf == NULL) {
-    goto destroy_process;
+    goto close_bin;
   }
 
-  if (vfs_read(init_bin_fd, tmp_elf, stat.size) != (ssize_t)stat.size) {
+  if (vfs_read(bin_fd, tmp_elf, stat.size) != (ssize_t)stat.size) {
     goto free_tmp_elf;
   }
 
@@ -169,19 +227,22 @@ pid_t process_create_init_process(void) {
     goto free_tmp_elf;
   }
 
-  task_id_t id = sched_create_user_task(entry_offset, p->l2_table, GET_CPU_ID(),
+  task_id_t id = sched_create_user_task(entry_offset, p->l2_table, cpu_id,
                                         STACK_TOP_VA, p->pid);
   if (id == NO_TASK) {
     goto free_tmp_elf;
   }
   p->task_id = id;
 
-  vfs_close(init_bin_fd);
+  k_free(tmp_elf);
+  vfs_close(bin_fd);
 
   return p->pid;
 
 free_tmp_elf:
   k_free(tmp_elf);
+close_bin:
+  vfs_close(bin_fd);
 destroy_process:
   (void)process_destroy(p->pid);
   return -1;
@@ -202,11 +263,9 @@ pid_t process_clone(pid_t parent_pid) {
 
   // Race here if parent gets destroyed here
 
-  // Copy open fds
-  for (int i = 0; i < MAX_OPEN_FDS; i++) {
-    if (parent->open_fds[i].vfs_fd != NULL) {
-      child->open_fds[i] = parent->open_fds[i];
-    }
+  // Child shares the open files and their offsets with the parent
+  if (fd_table_clone(&child->fd_table, &parent->fd_table) != 0) {
+    goto process_clone_error;
   }
 
   for (int i = 0; i < MAX_VIRTUAL_MEMORY_MAPPINGS; i++) {
@@ -221,9 +280,10 @@ pid_t process_clone(pid_t parent_pid) {
     }
   }
 
-  task_id_t id = sched_clone_user_task(parent->task_id, child->l2_table, child->pid, 2);
+  task_id_t id = sched_clone_user_task(parent->task_id, child->l2_table, child->pid,
+                                       sched_pick_cpu());
   if (id == NO_TASK) {
-    return -1;
+    goto process_clone_error;
   }
   child->task_id = id;
 
@@ -234,12 +294,16 @@ process_clone_error:
   return -1;
 }
 
+bool process_exists(pid_t pid) {
+  return get_process_by_pid(pid) != NULL;
+}
+
 int process_load_l2_table(pid_t pid) {
   Process* process = get_process_by_pid(pid);
   if (process == NULL) {
     return -1;
   }
-  mmu_set_user_l2_table(process->l2_table);
+  sched_set_current_l2_table(process->l2_table);
   return 0;
 }
 
@@ -248,7 +312,7 @@ int process_unload_l2_table(pid_t pid) {
   if (process == NULL) {
     return -1;
   }
-  mmu_set_user_l2_table(NULL);
+  sched_set_current_l2_table(NULL);
   return 0;
 }
 
@@ -265,43 +329,88 @@ int process_open_file(pid_t pid, const char* path, int flags, int mode) {
     return -1;
   }
 
-  for (int i = 0; i < MAX_OPEN_FDS; i++) {
-    if (process->open_fds[i].vfs_fd == NULL) {
-      process->open_fds[i].fd = i;
-      process->open_fds[i].vfs_fd = vfs_fd;
-      return i;
-    }
+  int fd = fd_table_install(&process->fd_table, vfs_fd);
+  if (fd < 0) {
+    vfs_close(vfs_fd);
   }
 
-  // No space for new fd
-  vfs_close(vfs_fd);
-  return -1;
+  return fd;
 }
 
-ssize_t process_write_file(pid_t pid, int fd, const void* buffer, size_t size) {
+// Returns a reference to the open file at fd, drop it with vfs_close
+static VFSFileDescriptor* get_process_vfs_fd(pid_t pid, int fd) {
   Process* process = get_process_by_pid(pid);
   if (process == NULL) {
-    return -1;
+    return NULL;
   }
 
-  if (fd < 0 || fd >= MAX_OPEN_FDS || process->open_fds[fd].vfs_fd == NULL) {
+  return fd_table_get(&process->fd_table, fd);
+}
+
+ssize_t process_write_file(pid_t pid, int fd, const void* buffer, size_t size) {
+  VFSFileDescriptor* vfs_fd = get_process_vfs_fd(pid, fd);
+  if (vfs_fd == NULL) {
     return -1;
   }
 
-  return vfs_write(process->open_fds[fd].vfs_fd, buffer, size);
+  ssize_t ret = vfs_write(vfs_fd, buffer, size);
+  vfs_close(vfs_fd);
+  return ret;
 }
 
 ssize_t process_read_file(pid_t pid, int fd, void* buffer, size_t size) {
-  Process* process = get_process_by_pid(pid);
-  if (process == NULL) {
+  VFSFileDescriptor* vfs_fd = get_process_vfs_fd(pid, fd);
+  if (vfs_fd == NULL) {
+    return -1;
+  }
+
+  ssize_t ret = vfs_read(vfs_fd, buffer, size);
+  vfs_close(vfs_fd);
+  return ret;
+}
+
+ssize_t process_pwrite_file(pid_t pid, int fd, const void* buffer, size_t size, off_t offset) {
+  VFSFileDescriptor* vfs_fd = get_process_vfs_fd(pid, fd);
+  if (vfs_fd == NULL) {
     return -1;
   }
 
-  if (fd < 0 || fd >= MAX_OPEN_FDS || process->open_fds[fd].vfs_fd == NULL) {
+  ssize_t ret = vfs_pwrite(vfs_fd, buffer, size, offset);
+  vfs_close(vfs_fd);
+  return ret;
+}
+
+ssize_t process_pread_file(pid_t pid, int fd, void* buffer, size_t size, off_t offset) {
+  VFSFileDescriptor* vfs_fd = get_process_vfs_fd(pid, fd);
+  if (vfs_fd == NULL) {
     return -1;
   }
 
-  return vfs_read(process->open_fds[fd].vfs_fd, buffer, size);
+  ssize_t ret = vfs_pread(vfs_fd, buffer, size, offset);
+  vfs_close(vfs_fd);
+  return ret;
+}
+
+ssize_t process_writev_file(pid_t pid, int fd, const struct iovec* iov, int iovcnt) {
+  VFSFileDescriptor* vfs_fd = get_process_vfs_fd(pid, fd);
+  if (vfs_fd == NULL) {
+    return -1;
+  }
+
+  ssize_t ret = vfs_writev(vfs_fd, iov, iovcnt);
+  vfs_close(vfs_fd);
+  return ret;
+}
+
+ssize_t process_readv_file(pid_t pid, int fd, const struct iovec* iov, int iovcnt) {
+  VFSFileDescriptor* vfs_fd = get_process_vfs_fd(pid, fd);
+  if (vfs_fd == NULL) {
+    return -1;
+  }
+
+  ssize_t ret = vfs_readv(vfs_fd, iov, iovcnt);
+  vfs_close(vfs_fd);
+  return ret;
 }
 
 int process_close_file(pid_t pid, int fd) {
@@ -310,12 +419,55 @@ int process_close_file(pid_t pid, int fd) {
     return -1;
   }
 
-  if (fd < 0 || fd >= MAX_OPEN_FDS || process->open_fds[fd].vfs_fd == NULL) {
+  VFSFileDescriptor* vfs_fd = fd_table_remove(&process->fd_table, fd);
+  if (vfs_fd == NULL) {
+    return -1;
+  }
+
+  return vfs_close(vfs_fd);
+}
+
+long process_io_ring_setup(pid_t pid, uint32_t flags) {
+  Process* process = get_process_by_pid(pid);
+  if (process == NULL || atomic_exchange(&process->io_ring_claimed, true)) {
+    return -1;
+  }
+
+  VirtualMemoryMapping* mapping = NULL;
+  for (int i = 0; i < MAX_VIRTUAL_MEMORY_MAPPINGS; i++) {
+    if (process->virtual_memory_mappings[i].pa == NULL) {
+      mapping = &process->virtual_memory_mappings[i];
+      break;
+    }
+  }
+  if (mapping == NULL) {
+    goto unclaim;
+  }
+
+  if (allocate_user_memory_block(process->l2_table, false, mapping) != 0) {
+    goto unclaim;
+  }
+
+  // Kernel accesses the ring through the physical address of the block
+  process->io_ring = io_ring_create(pid, (IORing*)mapping->pa, flags);
+  if (process->io_ring == NULL) {
+    free_user_memory_block(mapping);
+    memset(mapping, 0, sizeof(VirtualMemoryMapping));
+    goto unclaim;
+  }
+
+  return (long)mapping->va;
+
+unclaim:
+  atomic_store(&process->io_ring_claimed, false);
+  return -1;
+}
+
+int process_io_ring_enter(pid_t pid, uint32_t min_complete) {
+  Process* process = get_process_by_pid(pid);
+  if (process == NULL || process->io_ring == NULL) {
     return -1;
   }
 
-  int res = vfs_close(process->open_fds[fd].vfs_fd);
-  process->open_fds[fd].vfs_fd = NULL;
-  process->open_fds[fd].fd = 0;
-  return res;
+  return io_ring_enter(process->io_ring, min_complete);
 }
\ No newline at end of file
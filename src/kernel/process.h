@@ -2,20 +2,25 @@
 #define PROCESS_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "sys/types.h"
+#include "sys/uio.h"
 
 #define STACK_TOP_VA    0x600000
 
-#define MAX_PROCESSES 64
-#define MAX_OPEN_FDS 16
 #define MAX_VIRTUAL_MEMORY_MAPPINGS 16
 
 typedef int32_t pid_t;
 
 pid_t process_create_init_process(void);
+// Loads the ELF at path into a new process with fd 1 on the console and
+// starts it on cpu_id. Returns the pid or -1.
+pid_t process_spawn(const char* path, uint32_t cpu_id);
 int process_destroy(pid_t pid);
 pid_t process_clone(pid_t parent_pid);
+// False once the process has exited and been destroyed
+bool process_exists(pid_t pid);
 
 int process_load_l2_table(pid_t pid);
 int process_unload_l2_table(pid_t pid);
@@ -23,6 +28,16 @@ int process_unload_l2_table(pid_t pid);
 int process_open_file(pid_t pid, const char* path, int flags, int mode);
 ssize_t process_write_file(pid_t pid, int fd, const void* buffer, size_t size);
 ssize_t process_read_file(pid_t pid, int fd, void* buffer, size_t size);
+ssize_t process_pwrite_file(pid_t pid, int fd, const void* buffer, size_t size, off_t offset);
+ssize_t process_pread_file(pid_t pid, int fd, void* buffer, size_t size, off_t offset);
+// iov buffers must be kernel memory
+ssize_t process_writev_file(pid_t pid, int fd, const struct iovec* iov, int iovcnt);
+ssize_t process_readv_file(pid_t pid, int fd, const struct iovec* iov, int iovcnt);
 int process_close_file(pid_t pid, int fd);
 
+// Maps an asynchronous I/O ring to the process and starts its kernel worker.
+// Returns user address of the ring or -1 on failure, one ring per process.
+long process_io_ring_setup(pid_t pid, uint32_t flags);
+int process_io_ring_enter(pid_t pid, uint32_t min_complete);
+
 #endif // PROCESS_H
\ No newline at end of file
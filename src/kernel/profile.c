@@ -0,0 +1,203 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "profile.h"
+#include "armv8-a.h"
+#include "io.h"
+#include "ipi.h"
+#include "percpu.h"
+#include "pmu.h"
+#include "sched.h"
+#include "stdio.h"
+
+#define PROFILE_SAMPLES_PER_CPU 8192
+#define PROFILE_MAX_TASKS 64  // Distinct tasks listed by profile_dump
+
+// Event counter used for non-cycle sources
+#define PROFILE_EVENT_COUNTER 0u
+
+typedef struct ProfileSample {
+  uint64_t pc;
+  task_id_t task_id;
+} ProfileSample;
+
+// Written only by the owning CPU's PMU interrupt
+typedef struct ProfileBuffer {
+  uint32_t count;
+  uint32_t lost;
+  ProfileSample samples[PROFILE_SAMPLES_PER_CPU];
+} __attribute__((aligned(CACHE_LINE_SIZE))) ProfileBuffer;
+
+static ProfileBuffer profile_buffers[NUM_CPUS];
+
+static _Atomic bool profile_running = false;
+static ProfileSource profile_source;
+static uint64_t profile_period;
+
+static inline uint32_t source_counter(void) {
+  return profile_source == PROFILE_CYCLES ? PMU_CYCLE_COUNTER : PROFILE_EVENT_COUNTER;
+}
+
+// Counters count up and interrupt on overflow, so start period events below it
+static inline void reload_counter(void) {
+  pmu_write_counter(source_counter(), -profile_period);
+}
+
+static void start_cpu(void* arg) {
+  (void)arg;
+  uint32_t counter = source_counter();
+
+  if (profile_source == PROFILE_INSTRUCTIONS) {
+    pmu_set_event(counter, PMU_EVENT_INST_RETIRED);
+  }
+  reload_counter();
+  pmu_read_clear_overflow();
+  pmu_enable_overflow_irq(1u << counter);
+  pmu_enable_counters(1u << counter);
+}
+
+static void stop_cpu(void* arg) {
+  (void)arg;
+  uint32_t counter = source_counter();
+
+  pmu_disable_overflow_irq(1u << counter);
+  if (counter != PMU_CYCLE_COUNTER) {
+    pmu_disable_counters(1u << counter);  // Cycle counter keeps running for irq-bench
+  }
+  pmu_read_clear_overflow();
+}
+
+int profile_start(ProfileSource source, uint64_t period) {
+  if (period == 0) {
+    return -1;
+  }
+  if (source == PROFILE_INSTRUCTIONS && (pmu_num_counters() == 0 || period > UINT32_MAX)) {
+    return -1;
+  }
+
+  profile_stop();
+
+  for (uint32_t cpu = 0; cpu < NUM_CPUS; cpu++) {
+    profile_buffers[cpu].count = 0;
+    profile_buffers[cpu].lost = 0;
+  }
+  profile_source = source;
+  profile_period = period;
+  profile_running = true;
+
+  ipi_call_function_all(start_cpu, NULL, true, true);
+  return 0;
+}
+
+void profile_stop(void) {
+  if (!profile_running) {
+    return;
+  }
+  profile_running = false;
+  ipi_call_function_all(stop_cpu, NULL, true, true);
+}
+
+void profile_irq_handler(PtRegs* regs) {
+  uint32_t overflowed = pmu_read_clear_overflow();
+  if (!profile_running || !(overflowed & (1u << source_counter()))) {
+    return;
+  }
+
+  ProfileBuffer* buffer = &profile_buffers[THIS_CPU_ID()];
+  if (buffer->count < PROFILE_SAMPLES_PER_CPU) {
+    buffer->samples[buffer->count++] = (ProfileSample){
+      .pc = regs->elr_el1,
+      .task_id = sched_get_cpu_current_task_id()
+    };
+  } else {
+    buffer->lost++;
+  }
+  reload_counter();
+}
+
+// Shell sort by PC, so equal PCs end up next to each other
+static void sort_samples(ProfileSample* samples, uint32_t count) {
+  for (uint32_t gap = count / 2; gap > 0; gap /= 2) {
+    for (uint32_t i = gap; i < count; i++) {
+      ProfileSample tmp = samples[i];
+      uint32_t j = i;
+      for (; j >= gap && samples[j - gap].pc > tmp.pc; j -= gap) {
+        samples[j] = samples[j - gap];
+      }
+      samples[j] = tmp;
+    }
+  }
+}
+
+void profile_dump(void) {
+  profile_stop();
+
+  static struct {
+    task_id_t id;
+    uint32_t count;
+  } tasks[PROFILE_MAX_TASKS];
+  uint32_t num_tasks = 0;
+  uint32_t other_tasks = 0;
+  uint32_t total = 0;
+  char line[96];
+
+  snprintf(line, sizeof(line), "profile: begin source=%s period=%lu\n",
+           profile_source == PROFILE_CYCLES ? "cycles" : "instructions", profile_period);
+  k_puts_wait(line);
+
+  for (uint32_t cpu = 0; cpu < NUM_CPUS; cpu++) {
+    ProfileBuffer* buffer = &profile_buffers[cpu];
+    snprintf(line, sizeof(line), "profile: cpu %u samples %u lost %u\n",
+             cpu, buffer->count, buffer->lost);
+    k_puts_wait(line);
+    total += buffer->count;
+
+    for (uint32_t i = 0; i < buffer->count; i++) {
+      task_id_t id = buffer->samples[i].task_id;
+      uint32_t t = 0;
+      while (t < num_tasks && tasks[t].id != id) {
+        t++;
+      }
+      if (t == num_tasks) {
+        if (num_tasks == PROFILE_MAX_TASKS) {
+          other_tasks++;
+          continue;
+        }
+        tasks[num_tasks].id = id;
+        tasks[num_tasks].count = 0;
+        num_tasks++;
+      }
+      tasks[t].count++;
+    }
+  }
+
+  for (uint32_t t = 0; t < num_tasks; t++) {
+    snprintf(line, sizeof(line), "profile: task %ld %u\n", tasks[t].id, tasks[t].count);
+    k_puts_wait(line);
+  }
+  if (other_tasks > 0) {
+    snprintf(line, sizeof(line), "profile: task other %u\n", other_tasks);
+    k_puts_wait(line);
+  }
+
+  // PCs per CPU, the host side adds them up
+  for (uint32_t cpu = 0; cpu < NUM_CPUS; cpu++) {
+    ProfileBuffer* buffer = &profile_buffers[cpu];
+    sort_samples(buffer->samples, buffer->count);
+
+    uint32_t i = 0;
+    while (i < buffer->count) {
+      uint32_t run = 1;
+      while (i + run < buffer->count && buffer->samples[i + run].pc == buffer->samples[i].pc) {
+        run++;
+      }
+      snprintf(line, sizeof(line), "profile: pc %lx %u\n", buffer->samples[i].pc, run);
+      k_puts_wait(line);
+      i += run;
+    }
+  }
+
+  snprintf(line, sizeof(line), "profile: end total %u\n", total);
+  k_puts_wait(line);
+}
@@ -0,0 +1,28 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+#include "pt-regs.h"
+
+// Sampling profiler on PMU overflow interrupts. Every period events each
+// CPU records the interrupted PC and task id, until its buffer is full.
+// Dump over the console and symbolize with tools/symbolize-profile.py.
+
+typedef enum {
+  PROFILE_CYCLES,
+  PROFILE_INSTRUCTIONS
+} ProfileSource;
+
+// Clears old samples and starts sampling on all CPUs. Call from a task.
+// Returns -1 if period is 0 or too large for the counter, or if
+// instructions are requested and the PMU has no event counters.
+int profile_start(ProfileSource source, uint64_t period);
+void profile_stop(void);
+// Stops sampling and prints per-task and per-PC histograms
+void profile_dump(void);
+
+// Called by the IRQ dispatcher for PMU_IRQ
+void profile_irq_handler(PtRegs* regs);
+
+#endif // PROFILE_H
@@ -0,0 +1,30 @@
+#ifndef PT_REGS_H
+#define PT_REGS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Register frame saved on exception entry (KERNEL_ENTRY in el1_vectors.s)
+// and built by context_switch_save. Restoring one resumes the saved state
+// completely, whichever task it belongs to.
+typedef struct PtRegs {
+  uint64_t regs[31];  // x0-x30
+  uint64_t sp_el0;
+  uint64_t elr_el1;
+  uint64_t spsr_el1;
+} PtRegs;
+
+// Offsets hardcoded in el1_vectors.s and context-switch.s
+_Static_assert(offsetof(PtRegs, sp_el0) == 248, "PT_REGS_SP_EL0");
+_Static_assert(offsetof(PtRegs, elr_el1) == 256, "PT_REGS_ELR_EL1");
+_Static_assert(offsetof(PtRegs, spsr_el1) == 264, "PT_REGS_SPSR_EL1");
+_Static_assert(sizeof(PtRegs) == 272, "PT_REGS_SIZE");
+_Static_assert(sizeof(PtRegs) % 16 == 0, "Frame must keep sp 16-byte aligned");
+
+#define SPSR_EL0T 0x0
+#define SPSR_EL1H 0x5
+
+// Restores regs and erets, sp ends up just above the frame
+extern void exception_return(PtRegs* regs) __attribute__((noreturn));
+
+#endif // PT_REGS_H
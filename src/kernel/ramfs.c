@@ -3,38 +3,58 @@
 #include "ramfs.h"
 #include "string.h"
 #include "vfs.h"
+#include "rwlock.h"
+#include "spinlock.h"
 
 #define RAMFS_MAX_FILES 8
+#define RAMFS_MAX_HANDLES MAX_OPEN_FILES
 #define RAMFS_MAX_CHILDREN 4
 #define RAMFS_MAX_FILE_SIZE (1024 * 512)  // 512 kB max file size
 #define ROOT_IDX 0  // Root should always be at index 0 in files array
 
 typedef struct RamFSFile RamFSFile;
 
+/*
+ * Locking:
+ * - tree_lock protects file allocation, paths and the parent/children links
+ * - handles_lock protects the handle table and open_count of each file
+ * - lock of each file protects its data and size
+ * Order is tree_lock -> handles_lock -> file lock. read/write/seek only
+ * take the file lock, since an open file can't be removed.
+ */
+
 typedef struct RamFSFile {
   char path[NAME_MAX];
-  uint8_t data[RAMFS_MAX_FILE_SIZE];
+  RWLock lock;
+  uint32_t open_count;  // Number of handles referring to this file
   size_t size;
   bool is_directory;
   bool is_allocated;
   RamFSFile* parent;
   RamFSFile* children[RAMFS_MAX_CHILDREN];
+  uint8_t data[RAMFS_MAX_FILE_SIZE];
 } RamFSFile;
 
+// Each open creates an independent handle with its own offset.
+// A single handle must not be used concurrently.
 typedef struct RamFSHandle {
   RamFSFile *file;
   size_t offset;
 } RamFSHandle;
 
 typedef struct RamFS {
+  RWLock tree_lock;
+  Spinlock handles_lock;
   RamFSFile files[RAMFS_MAX_FILES];
-  RamFSHandle handles[RAMFS_MAX_FILES];
+  RamFSHandle handles[RAMFS_MAX_HANDLES];
 } RamFS;
 
 
 static void* ramfs_open(void *fs_data, const char *path, int flags, mode_t mode);
 static ssize_t ramfs_read(void *fs_data, void *file, void *buffer, size_t size);
 static ssize_t ramfs_write(void *fs_data, void *file, const void *buffer, size_t size);
+static ssize_t ramfs_pread(void *fs_data, void *file, void *buffer, size_t size, off_t offset);
+static ssize_t ramfs_pwrite(void *fs_data, void *file, const void *buffer, size_t size, off_t offset);
 static int ramfs_close(void *fs_data, void *file);
 static int ramfs_seek(void *fs_data, void *file, size_t offset);
 static int ramfs_mkdir(void* fs_data, const char* path);
@@ -46,6 +66,8 @@ VFSInterface ramfs_if = {
   .open = ramfs_open,
   .read = ramfs_read,
   .write = ramfs_write,
+  .pread = ramfs_pread,
+  .pwrite = ramfs_pwrite,
   .close = ramfs_close,
   .seek = ramfs_seek,
   .mkdir = ramfs_mkdir,
@@ -120,8 +142,10 @@ static RamFSFile* create_file(RamFS *fs, const char *path, bool is_dir) {
 
   int child_slot_in_parent = -1;
   for (int i = 0; i < RAMFS_MAX_CHILDREN; i++) {
-    if (child_slot_in_parent == -1 && parent->children[i] == NULL) {
-      child_slot_in_parent = i;
+    if (parent->children[i] == NULL) {
+      if (child_slot_in_parent == -1) {
+        child_slot_in_parent = i;
+      }
       continue;
     }
     if (strcmp(parent->children[i]->path, path) == 0) {
@@ -176,93 +200,160 @@ static int destroy_file(RamFSFile* file) {
   return 0;
 }
 
-// Allocate handle for file, returns NULL if no space
-// or if a handle already exists for the given file i.e. it is already open
+// Allocate new handle for file, returns NULL if no space.
+// Any number of handles may refer to the same file.
 static RamFSHandle* allocate_handle(RamFS* fs, RamFSFile* file) {
-  RamFSHandle* handle_candidate = NULL;
-  for (int i = 0; i < MAX_OPEN_FILES; i++) {
-    RamFSHandle* handle = &fs->handles[i];
-    if (handle_candidate == NULL && handle->file == NULL) {
-      handle_candidate = handle;
-      continue;
-    }
-    if (handle->file == file) {
-      goto file_already_open;
+  RamFSHandle* handle = NULL;
+
+  spinlock_acquire(&fs->handles_lock);
+  for (int i = 0; i < RAMFS_MAX_HANDLES; i++) {
+    if (fs->handles[i].file == NULL) {
+      handle = &fs->handles[i];
+      handle->file = file;
+      handle->offset = 0;
+      file->open_count++;
+      break;
     }
   }
+  spinlock_release(&fs->handles_lock);
 
-  handle_candidate->file = file;
-  handle_candidate->offset = 0;
-
-  return handle_candidate;
-
-file_already_open:
-  // Todo: return error code
-  return NULL;
+  return handle;
 }
 
 static void* ramfs_open(void *fs_data, const char *path, int flags, mode_t mode) {
   RamFS *fs = (RamFS*)fs_data;
-  RamFSFile *file = find_file(fs, path);
   (void)mode; // Unused for now, since we don't implement permissions
 
-  if ((file == NULL) && (flags & O_CREAT)) {
-    file = create_file(fs, path, false);
+  // Common case, file exists and only shared access to the tree is needed
+  rwlock_read_acquire(&fs->tree_lock);
+  RamFSFile *file = find_file(fs, path);
+  if (file != NULL) {
+    RamFSHandle *handle = allocate_handle(fs, file);
+    rwlock_read_release(&fs->tree_lock);
+    return handle;
   }
-  if (file == NULL) {
+  rwlock_read_release(&fs->tree_lock);
+
+  if (!(flags & O_CREAT)) {
     return NULL;
   }
 
-  RamFSHandle *handle = allocate_handle(fs, file);
-  if (handle == NULL && (flags & O_CREAT)) {
-    destroy_file(file);
+  rwlock_write_acquire(&fs->tree_lock);
+
+  // Someone may have created it in between
+  bool created = false;
+  file = find_file(fs, path);
+  if (file == NULL) {
+    file = create_file(fs, path, false);
+    created = true;
   }
 
+  RamFSHandle *handle = NULL;
+  if (file != NULL) {
+    handle = allocate_handle(fs, file);
+    if (handle == NULL && created) {
+      destroy_file(file);
+    }
+  }
+
+  rwlock_write_release(&fs->tree_lock);
+
   return handle;
 }
 
-static ssize_t ramfs_read(void *fs_data, void *handle, void *buffer, size_t size) {
+static ssize_t ramfs_pread(void *fs_data, void *handle, void *buffer, size_t size, off_t offset) {
   (void)fs_data;
   RamFSHandle *h = (RamFSHandle*)handle;
-  
-  size_t remaining = h->file->size - h->offset;
-  size_t to_read = (size < remaining) ? size : remaining;
-  
-  memcpy(buffer, h->file->data + h->offset, to_read);
-  h->offset += to_read;
-  
+  RamFSFile *file = h->file;
+
+  rwlock_read_acquire(&file->lock);
+
+  size_t to_read = 0;
+  if ((size_t)offset < file->size) {
+    size_t remaining = file->size - offset;
+    to_read = (size < remaining) ? size : remaining;
+    memcpy(buffer, file->data + offset, to_read);
+  }
+
+  rwlock_read_release(&file->lock);
+
   return to_read;
 }
 
-static ssize_t ramfs_write(void *fs_data, void *handle, const void *buffer, size_t size) {
+static ssize_t ramfs_pwrite(void *fs_data, void *handle, const void *buffer, size_t size, off_t offset) {
   (void)fs_data;
   RamFSHandle *h = (RamFSHandle*)handle;
-  
-  size_t space = RAMFS_MAX_FILE_SIZE - h->offset;
+
+  RamFSFile *file = h->file;
+
+  if ((size_t)offset > RAMFS_MAX_FILE_SIZE) {
+    return -1;
+  }
+
+  size_t space = RAMFS_MAX_FILE_SIZE - offset;
   size_t to_write = (size < space) ? size : space;
-  
-  memcpy(h->file->data + h->offset, buffer, to_write);
-  h->offset += to_write;
-  
-  if (h->offset > h->file->size) {
-    h->file->size = h->offset;
+
+  rwlock_write_acquire(&file->lock);
+
+  // The slot may hold data of a removed file, don't expose it in the hole
+  if ((size_t)offset > file->size) {
+    memset(file->data + file->size, 0, offset - file->size);
   }
-  
-  return (int)to_write;
+
+  memcpy(file->data + offset, buffer, to_write);
+
+  if (offset + to_write > file->size) {
+    file->size = offset + to_write;
+  }
+
+  rwlock_write_release(&file->lock);
+
+  return to_write;
+}
+
+static ssize_t ramfs_read(void *fs_data, void *handle, void *buffer, size_t size) {
+  RamFSHandle *h = (RamFSHandle*)handle;
+
+  ssize_t ret = ramfs_pread(fs_data, handle, buffer, size, h->offset);
+  if (ret > 0) {
+    h->offset += ret;
+  }
+
+  return ret;
+}
+
+static ssize_t ramfs_write(void *fs_data, void *handle, const void *buffer, size_t size) {
+  RamFSHandle *h = (RamFSHandle*)handle;
+
+  ssize_t ret = ramfs_pwrite(fs_data, handle, buffer, size, h->offset);
+  if (ret > 0) {
+    h->offset += ret;
+  }
+
+  return ret;
 }
 
 static int ramfs_close(void *fs_data, void *handle) {
-  (void)fs_data;
+  RamFS *fs = (RamFS*)fs_data;
   RamFSHandle *h = (RamFSHandle*)handle;
+
+  spinlock_acquire(&fs->handles_lock);
+  h->file->open_count--;
   memset(h, 0, sizeof(RamFSHandle));
+  spinlock_release(&fs->handles_lock);
+
   return 0;
 }
 
 static int ramfs_seek(void *fs_data, void *handle, size_t offset) {
   (void)fs_data;
   RamFSHandle *h = (RamFSHandle*)handle;
-  
-  if (offset > h->file->size) {
+
+  rwlock_read_acquire(&h->file->lock);
+  size_t file_size = h->file->size;
+  rwlock_read_release(&h->file->lock);
+
+  if (offset > file_size) {
     return -1;  // Can't seek past end
   }
   
@@ -272,29 +363,29 @@ static int ramfs_seek(void *fs_data, void *handle, size_t offset) {
 
 static int ramfs_mkdir(void* fs_data, const char* path) {
   RamFS *fs = (RamFS*)fs_data;
-  RamFSFile *file = find_file(fs, path);
-  
-  if (!file) {
-    file = create_file(fs, path, true);
-  } else {
-    return -1;
-  }
+  int ret = -1;
 
-  if (!file) {
-    return -1;
+  rwlock_write_acquire(&fs->tree_lock);
+
+  if (find_file(fs, path) == NULL && create_file(fs, path, true) != NULL) {
+    ret = 0;
   }
 
-  return 0;
+  rwlock_write_release(&fs->tree_lock);
+
+  return ret;
 }
 
 static int ramfs_readdir(void* fs_data, void* handle, char* buffer, size_t size) {
-  (void)fs_data;
+  RamFS *fs = (RamFS*)fs_data;
   RamFSHandle *h = (RamFSHandle*)handle;
 
   if (!h->file->is_directory) {
     return -1;
   }
 
+  rwlock_read_acquire(&fs->tree_lock);
+
   size_t written = 0;
 
   for (unsigned i = 0; i < RAMFS_MAX_CHILDREN; i++) {
@@ -318,6 +409,8 @@ static int ramfs_readdir(void* fs_data, void* handle, char* buffer, size_t size)
     }
   }
 
+  rwlock_read_release(&fs->tree_lock);
+
   if (written > 0) {
     buffer[written - 1] = '\0';  // Replace last space with null
   } else {
@@ -329,31 +422,48 @@ static int ramfs_readdir(void* fs_data, void* handle, char* buffer, size_t size)
 
 static int ramfs_remove(void* fs_data, const char* path) {
   RamFS* fs = (RamFS*)fs_data;
+  int ret = -1;
 
-  RamFSFile* file = find_file(fs_data, path);
+  rwlock_write_acquire(&fs->tree_lock);
+
+  RamFSFile* file = find_file(fs, path);
   if (file == NULL) {
-    return -1; // File doesn't exist
+    goto out; // File doesn't exist
   }
 
-  for (int i = 0; i < MAX_OPEN_FILES; i++) {
-    if (fs->handles[i].file == file) {
-      return -1; // Can't, if someone has opened this file
-    }
+  // New handles can't be created while tree_lock is held exclusively
+  spinlock_acquire(&fs->handles_lock);
+  bool is_open = (file->open_count > 0);
+  spinlock_release(&fs->handles_lock);
+
+  if (is_open) {
+    goto out; // Can't, if someone has opened this file
   }
 
-  return destroy_file(file);
+  ret = destroy_file(file);
+
+out:
+  rwlock_write_release(&fs->tree_lock);
+  return ret;
 }
 
 static int ramfs_stat(void* fs_data, const char* path, VFSStat* stat) {
   RamFS* fs = (RamFS*)fs_data;
 
+  rwlock_read_acquire(&fs->tree_lock);
+
   RamFSFile* file = find_file(fs, path);
   if (file == NULL) {
+    rwlock_read_release(&fs->tree_lock);
     return -1; // File doesn't exist
   }
 
+  rwlock_read_acquire(&file->lock);
   stat->size = file->size;
+  rwlock_read_release(&file->lock);
   stat->is_directory = file->is_directory;
 
+  rwlock_read_release(&fs->tree_lock);
+
   return 0;
 }
\ No newline at end of file
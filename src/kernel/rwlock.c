@@ -0,0 +1,44 @@
+#include "rwlock.h"
+
+static inline void cpu_relax(void) {
+  __asm__ __volatile__("yield");
+}
+
+void rwlock_read_acquire(RWLock* lock) {
+  while (1) {
+    while (atomic_load_explicit(&lock->writers_waiting, memory_order_relaxed) > 0) {
+      cpu_relax();
+    }
+
+    int32_t state = atomic_load_explicit(&lock->state, memory_order_relaxed);
+    if (state != RWLOCK_WRITER &&
+        atomic_compare_exchange_weak_explicit(&lock->state, &state, state + 1,
+                                              memory_order_acquire,
+                                              memory_order_relaxed)) {
+      return;
+    }
+    cpu_relax();
+  }
+}
+
+void rwlock_read_release(RWLock* lock) {
+  atomic_fetch_sub_explicit(&lock->state, 1, memory_order_release);
+}
+
+void rwlock_write_acquire(RWLock* lock) {
+  atomic_fetch_add_explicit(&lock->writers_waiting, 1, memory_order_relaxed);
+
+  int32_t expected = 0;
+  while (!atomic_compare_exchange_weak_explicit(&lock->state, &expected, RWLOCK_WRITER,
+                                                memory_order_acquire,
+                                                memory_order_relaxed)) {
+    expected = 0;
+    cpu_relax();
+  }
+
+  atomic_fetch_sub_explicit(&lock->writers_waiting, 1, memory_order_relaxed);
+}
+
+void rwlock_write_release(RWLock* lock) {
+  atomic_store_explicit(&lock->state, 0, memory_order_release);
+}
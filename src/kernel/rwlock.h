@@ -0,0 +1,25 @@
+#ifndef RWLOCK_H
+#define RWLOCK_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Reader-writer spinlock, any number of readers or one writer.
+// Writers are preferred: new readers wait while a writer is waiting.
+// Not IRQ safe, don't use from IRQ context.
+typedef struct RWLock {
+  // Number of readers holding the lock, or RWLOCK_WRITER if held by a writer
+  _Atomic int32_t state;
+  _Atomic uint32_t writers_waiting;
+} RWLock;
+
+#define RWLOCK_WRITER (-1)
+#define RWLOCK_INIT {0, 0}
+
+// Not reentrant
+void rwlock_read_acquire(RWLock* lock);
+void rwlock_read_release(RWLock* lock);
+void rwlock_write_acquire(RWLock* lock);
+void rwlock_write_release(RWLock* lock);
+
+#endif /* RWLOCK_H */
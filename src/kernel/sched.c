@@ -2,181 +2,40 @@
  * Scheduler
  * 
  * TODO
- * - Refactor id - idx
  * - Refactor task creation functions, currently duplicate code
  * - Add task termination and cleanup
  * - Split code into common and CPU-core-specific parts 
  */
 
+#include <stddef.h>
 #include "string.h"
 #include "armv8-a.h"
 #include "sched.h"
 #include "io.h"
 #include "log.h"
+#include "klog.h"
+#include "trace.h"
 #include "spinlock.h"
+#include "seqlock.h"
 #include "mmu.h"
+#include "memory.h"
+#include "id-table.h"
+#include "ipi.h"
+#include "gic.h"
+#include "percpu.h"
+#include "fpsimd.h"
+#include "pt-regs.h"
 
 #define TASK_STACK_SIZE 0x4000  // 16 KB
+#define TASK_GUARD_SIZE 0x1000  // Unmapped page below each stack
+#define TASK_STACK_SLOT_SIZE (TASK_GUARD_SIZE + TASK_STACK_SIZE)
+// Tasks are allocated in 2 MB chunks, one k_malloc large object each
+#define TASK_CHUNK_SIZE BLOCK_SIZE_L2
+#define TASKS_PER_CHUNK (TASK_CHUNK_SIZE / TASK_STACK_SLOT_SIZE - 1)
 #define US_TO_CNTP_TVAL(us) ((us) * GET_TIMER_FREQ() / 1000000ULL)
-#define IDLE_TASK_INDEX MAX_TASKS  // Idle tasks are placed at the end of the task list
-
-#define ENABLE_LOG 0
-#if ENABLE_LOG
-#define LOG(...) \
-    do { \
-      k_printf(__VA_ARGS__); \
-    } while (0)
-#else
-#define LOG(...) \
-    do {} while (0);
-#endif
-
-// Switch context to task that has been initialized but not run yet
-#define INITIAL_JUMP_TO_KERNEL_TASK(task_ctx, param) \
-  do { \
-    __asm__ __volatile__ ( \
-      "mov sp, %0\n" \
-      "mov x0, %1\n" \
-      "br %2\n" \
-      : \
-      : "r" (task_ctx.sp_el1), "r" (param), "r" (task_ctx.pc) \
-      : "x0", "memory" \
-    ); \
-    __builtin_unreachable(); \
-  } while (0)
-
-// Switch context from IRQ context to task that has been initialized but not run yet
-#define INITIAL_JUMP_TO_KERNEL_TASK_FROM_IRQ(task_ctx, param) \
-  do { \
-    __asm__ __volatile__ ( \
-      "mrs x0, spsr_el1\n" \
-      "bic x0, x0, #0xF\n" \
-      "mov x1, #0x5\n" \
-      "orr x0, x0, x1\n" \
-      "msr spsr_el1, x0\n" \
-      "mov sp, %0\n" \
-      "msr elr_el1, %2\n" \
-      "mov x0, %1\n" \
-      "eret\n" \
-      : \
-      : "r" (task_ctx.sp_el1), "r" (param), "r" (task_ctx.pc) \
-      : "x0", "x1", "memory" \
-    ); \
-    __builtin_unreachable(); \
-  } while (0)
-
-#define INITIAL_JUMP_TO_USER_TASK_FROM_IRQ(task_ctx) \
-  do { \
-    __asm__ __volatile__ ( \
-      "mrs x0, spsr_el1\n" \
-      "bic x0, x0, #0xF\n"\
-      "msr spsr_el1, x0\n" \
-      "mov sp, %0\n" \
-      "msr elr_el1, %1\n" \
-      "msr sp_el0, %2\n" \
-      "eret\n" \
-      : \
-      : "r" (task_ctx.sp_el1), "r" (task_ctx.pc), "r" (task_ctx.sp_el0) \
-      : "x0", "memory" \
-    ); \
-    __builtin_unreachable(); \
-  } while (0)
-
-// Save exception link register (program counter to restore) to task context
-#define SAVE_ELR_EL1(task_ctx) \
-  do { \
-    __asm__ __volatile__ ( \
-      "mrs x0, elr_el1\n" \
-      "str x0, [%0]\n" \
-      : \
-      : "r" (&task_ctx.pc) \
-      : "x0", "memory" \
-    ); \
-  } while (0)
-
-// Save user stack pointer to task context, used for restoring context on task switch
-#define SAVE_SP_EL0(task_ctx) \
-  do { \
-    __asm__ __volatile__ ( \
-      "mrs x0, sp_el0\n" \
-      "str x0, [%0]\n" \
-      : \
-      : "r" (&task_ctx.sp_el0) \
-      : "x0", "memory" \
-    ); \
-  } while (0)
-
-
-// Restore full context from IRQ context and return from exception
-// Assumes that task_ctx.sp_el1 points to the saved context on the stack,
-// starting from x30 down to x0
-// Jumps to task_ctx.pc with eret after restoring.
-#define RESTORE_KERNEL_CONTEXT_FROM_IRQ(task_ctx) \
-  do { \
-    __asm__ __volatile__ ( \
-      "mrs x0, spsr_el1\n" \
-      "bic x0, x0, #0xF\n" \
-      "mov x1, #0x5\n" \
-      "orr x0, x0, x1\n" \
-      "msr spsr_el1, x0\n" \
-      "msr elr_el1, %0\n" \
-      "mov sp, %1\n" \
-      "ldr x30, [sp], #8\n" \
-      "ldp x28, x29, [sp], #16\n" \
-      "ldp x26, x27, [sp], #16\n" \
-      "ldp x24, x25, [sp], #16\n" \
-      "ldp x22, x23, [sp], #16\n" \
-      "ldp x20, x21, [sp], #16\n" \
-      "ldp x18, x19, [sp], #16\n" \
-      "ldp x16, x17, [sp], #16\n" \
-      "ldp x14, x15, [sp], #16\n" \
-      "ldp x12, x13, [sp], #16\n" \
-      "ldp x10, x11, [sp], #16\n" \
-      "ldp x8, x9, [sp], #16\n" \
-      "ldp x6, x7, [sp], #16\n" \
-      "ldp x4, x5, [sp], #16\n" \
-      "ldp x2, x3, [sp], #16\n" \
-      "ldp x0, x1, [sp], #16\n" \
-      "eret\n" \
-      : \
-      : "r" (task_ctx.pc), "r" (task_ctx.sp_el1) \
-      : "x0", "x1", "memory" \
-    ); \
-    __builtin_unreachable(); \
-  } while (0)
-
-#define RESTORE_USER_CONTEXT_FROM_IRQ(task_ctx) \
-  do { \
-    __asm__ __volatile__ ( \
-      "mrs x0, spsr_el1\n" \
-      "bic x0, x0, #0x0F\n"\
-      "msr spsr_el1, x0\n" \
-      "msr elr_el1, %0\n" \
-      "msr sp_el0, %1\n" \
-      "mov sp, %2\n" \
-      "ldr x30, [sp], #8\n" \
-      "ldp x28, x29, [sp], #16\n" \
-      "ldp x26, x27, [sp], #16\n" \
-      "ldp x24, x25, [sp], #16\n" \
-      "ldp x22, x23, [sp], #16\n" \
-      "ldp x20, x21, [sp], #16\n" \
-      "ldp x18, x19, [sp], #16\n" \
-      "ldp x16, x17, [sp], #16\n" \
-      "ldp x14, x15, [sp], #16\n" \
-      "ldp x12, x13, [sp], #16\n" \
-      "ldp x10, x11, [sp], #16\n" \
-      "ldp x8, x9, [sp], #16\n" \
-      "ldp x6, x7, [sp], #16\n" \
-      "ldp x4, x5, [sp], #16\n" \
-      "ldp x2, x3, [sp], #16\n" \
-      "ldp x0, x1, [sp], #16\n" \
-      "eret\n" \
-      : \
-      : "r" (task_ctx.pc), "r" (task_ctx.sp_el0), "r" (task_ctx.sp_el1) \
-      : "x0", "memory" \
-    ); \
-    __builtin_unreachable(); \
-  } while (0)
+
+// Binary log records, cheap enough to keep on, see klog.h
+#define LOG(...) klog(KLOG_DEBUG, __VA_ARGS__)
 
 typedef enum {
   TASK_STATE_NONE, // Not allocated
@@ -188,42 +47,88 @@ typedef enum {
 } TaskState;
 
 typedef struct TaskContext {
-  // Stack where context is saved during IRQ, used for restoring context on task switch
-  uintptr_t sp_el1;
-  // User stack pointer if user task
-  uintptr_t sp_el0;
-  // Program counter to jump to when starting the task for the first time or restoring context
-  uintptr_t pc;
+  // Frame on the task's own stack that resumes it, from the IRQ that
+  // preempted it, from sched_switch or built when the task was created
+  PtRegs* regs;
 } TaskContext;
 
+// Used by context-switch.s
+_Static_assert(offsetof(TaskContext, regs) == 0, "context-switch.s expects regs at 0");
+
+// Saves callee-saved registers and a frame resuming with spsr into
+// ctx->regs, then continues in sched_switch_finish(next). Returns once the
+// task is resumed.
+extern void context_switch_save(TaskContext* ctx, struct Task* next, uint64_t spsr);
+void sched_switch_finish(struct Task* next);
+
+// Scheduler scans read only the first cache line, a context switch adds
+// the one holding ctx. Stacks are allocated separately in the same chunk.
 typedef struct Task {
-  task_id_t id;
-  int index;
+  // Hot, read for every task on each scheduling decision
   TaskState state;
-  TaskContext ctx;
-  void *param; // Parameter for kernel task function
-  uint64_t sleep_until;  // Timer count value when task should wake up
   uint32_t cpu_id;
+  uint8_t base_priority;
+  uint8_t priority;  // Effective priority, base_priority or boosted by a KMutex waiter
+  task_id_t id;
+  uint64_t sleep_until;  // Timer count value when task should wake up
+  // Ring of the tasks on cpu_id, next also links free descriptors
+  struct Task* next;
+  struct Task* prev;
+
+  // Warm, used when switching to or from the task
+  TaskContext ctx;
   TaskType type;
+  bool fpsimd_used;  // Has FP/SIMD state, kept at the top of its stack slot
+  // User address space loaded when switching to the task. A kernel task's
+  // is borrowed from a process with sched_set_current_l2_table.
   uint64_t* l2_table;
+  // Accounting in timer counts, charged on each tick and switch
+  uint64_t state_since;  // When the task last started running or waiting
+  uint64_t runtime;
+  uint64_t wait_time;  // Ready but not running
+  uint32_t nr_voluntary;  // Switched out after blocking or yielding
+  uint32_t nr_involuntary;  // Preempted
+
+  // Cold
   pid_t pid;  // pid of corresponding user process, 0 if not user task
-  
-  uint8_t pre_stack_padding[256];
-  __attribute__((aligned(16))) // AArch64 requires 16-byte alignment
-  uint8_t stack[TASK_STACK_SIZE];
-  uint8_t post_stack_padding[256];
-
-} Task;
+  uint8_t* stack;  // Lowest address of the stack, TASK_STACK_SIZE long
+  IdTableNode id_node;  // In sched_ctx.task_table while the task is live
+} __attribute__((aligned(CACHE_LINE_SIZE))) Task;
+
+// Descriptors fill the first slot, the rest are stack slots. Each stack
+// slot is a guard page followed by the stack growing down towards it, so
+// an overflow faults instead of running into the next task's stack.
+// Chunks are never freed, so a Task pointer always points to some Task.
+typedef struct TaskChunk {
+  union {
+    Task tasks[TASKS_PER_CHUNK];
+    uint8_t descriptor_slot[TASK_STACK_SLOT_SIZE];
+  };
+  uint8_t stacks[TASKS_PER_CHUNK][TASK_STACK_SLOT_SIZE];
+} TaskChunk;
+
+_Static_assert(sizeof(Task) * TASKS_PER_CHUNK <= TASK_STACK_SLOT_SIZE,
+               "Task descriptors must fit in one slot");
+_Static_assert(sizeof(TaskChunk) <= TASK_CHUNK_SIZE, "TaskChunk must fit in a 2 MB block");
+
+// First chunk is static so that idle tasks don't depend on k_malloc. The
+// section is 2 MB aligned and padded (see link.ld) so that only this chunk
+// is in the block that mmu_unmap_kernel_page splits into pages.
+__attribute__((section(".task_chunks"), aligned(TASK_GUARD_SIZE)))
+static TaskChunk first_task_chunk;
 
 typedef struct SchedContext {
   bool initialized;
   Spinlock lock;
-  uint32_t current_task_count;
+  // Bumped under lock whenever task_table changes, so that id -> task
+  // lookups can be done without taking lock
+  SeqCount task_table_seq;
+  IdTable task_table;  // Live tasks by id, idle tasks excluded
+  Task* free_tasks;
+  uint32_t task_chunks;
   uint32_t total_tasks_created;
-  Task* current_task[NUM_CPUS];
   uint64_t time_slice_cntp_tval;
   EndIRQCallback end_irq_callback;
-  Task task_list[MAX_TASKS + NUM_CPUS];  // Last NUM_CPUS tasks are reserved for idle tasks, one per CPU
 } SchedContext;
 
 
@@ -242,28 +147,152 @@ static int clear_task(Task* task) {
     return -1;
   }
 
-  int index = task->index;
+  uint8_t* stack = task->stack;
   memset(task, 0, sizeof(Task));
 
-  // Restore index
-  task->index = index;
+  // Restore slot properties
+  task->stack = stack;
 
   return 0;
 }
 
+// Unmaps the guard pages and links the descriptors into a list. Nothing may
+// use the chunk meanwhile, splitting its block into pages is not atomic.
+static void init_task_chunk(TaskChunk* chunk) {
+  memset(chunk->tasks, 0, sizeof(chunk->tasks));
+  for (uint32_t i = 0; i < TASKS_PER_CHUNK; i++) {
+    Task* task = &chunk->tasks[i];
+    task->stack = &chunk->stacks[i][TASK_GUARD_SIZE];
+    task->next = (i + 1 < TASKS_PER_CHUNK) ? &chunk->tasks[i + 1] : NULL;
+    if (mmu_unmap_kernel_page(&chunk->stacks[i][0]) != 0) {
+      k_printf(LOG_SCHED "No guard page for task stack 0x%lx\r\n", (uint64_t)task->stack);
+    }
+  }
+}
+
+// sched_ctx lock must be held
+static void add_task_chunk_locked(TaskChunk* chunk) {
+  chunk->tasks[TASKS_PER_CHUNK - 1].next = sched_ctx.free_tasks;
+  sched_ctx.free_tasks = &chunk->tasks[0];
+  sched_ctx.task_chunks++;
+}
+
+// sched_ctx lock must be held. If no descriptors are free, the lock is
+// dropped while a new chunk is set up.
 static Task* allocate_task(void) {
-  for (uint32_t i = 0; i < MAX_TASKS; i++) {
-    Task *task = &sched_ctx.task_list[i];
-    if (task->state == TASK_STATE_TERMINATED) {
-      clear_task(task);
-      return task;
+  if (sched_ctx.free_tasks == NULL) {
+    unlock_sched_ctx();
+    TaskChunk* chunk = k_malloc(sizeof(TaskChunk));
+    if (chunk != NULL) {
+      init_task_chunk(chunk);
     }
-    if (task->state == TASK_STATE_NONE) {
-      // Already initialized
-      return task;
+    lock_sched_ctx();
+
+    if (chunk != NULL) {
+      add_task_chunk_locked(chunk);
+    }
+    if (sched_ctx.free_tasks == NULL) {
+      return NULL;
     }
   }
-  return NULL;
+
+  Task* task = sched_ctx.free_tasks;
+  sched_ctx.free_tasks = task->next;
+  task->next = NULL;
+  return task;
+}
+
+// Above the kernel stack, so it costs no descriptor space. Only user
+// tasks ever get here.
+static inline FPSIMDState* task_fpsimd_state(Task* task) {
+  return (FPSIMDState*)&task->stack[TASK_STACK_SIZE - sizeof(FPSIMDState)];
+}
+
+static inline uintptr_t task_stack_top(Task* task) {
+  return (uintptr_t)task_fpsimd_state(task);
+}
+
+// sched_ctx lock must be held. Adds the task to its CPU's ring, before the
+// current task so that it is scanned last in the round.
+static void link_task_locked(Task* task) {
+  PerCPU* cpu = &percpu_areas[task->cpu_id];
+  Task* head = cpu->task_list;
+
+  if (head == NULL) {
+    task->next = task;
+    task->prev = task;
+    cpu->task_list = task;
+  } else {
+    task->next = head;
+    task->prev = head->prev;
+    head->prev->next = task;
+    head->prev = task;
+  }
+  cpu->task_count++;
+}
+
+// sched_ctx lock must be held
+static void unlink_task_locked(Task* task) {
+  PerCPU* cpu = &percpu_areas[task->cpu_id];
+
+  if (task->next == task) {
+    cpu->task_list = NULL;
+  } else {
+    task->prev->next = task->next;
+    task->next->prev = task->prev;
+    if (cpu->task_list == task) {
+      cpu->task_list = task->next;
+    }
+  }
+  task->next = NULL;
+  task->prev = NULL;
+  cpu->task_count--;
+}
+
+// sched_ctx lock must be held. Gives the task its id and makes it
+// schedulable on task->cpu_id.
+static void reset_task_accounting(Task* task) {
+  task->state_since = GET_TIMER_COUNT();
+  task->runtime = 0;
+  task->wait_time = 0;
+  task->nr_voluntary = 0;
+  task->nr_involuntary = 0;
+}
+
+static void publish_task_locked(Task* task) {
+  task->base_priority = SCHED_PRIORITY_DEFAULT;
+  task->priority = SCHED_PRIORITY_DEFAULT;
+  reset_task_accounting(task);
+  seqcount_write_begin(&sched_ctx.task_table_seq);
+  id_table_insert(&sched_ctx.task_table, &task->id_node, task->id);
+  seqcount_write_end(&sched_ctx.task_table_seq);
+  link_task_locked(task);
+}
+
+// sched_ctx lock must be held, and the task must not be running anywhere
+static void free_task_locked(Task* task) {
+  if (PER_CPU_VAR(task->cpu_id, fpsimd_owner) == task) {
+    PER_CPU_VAR(task->cpu_id, fpsimd_owner) = NULL;
+  }
+
+  seqcount_write_begin(&sched_ctx.task_table_seq);
+  id_table_remove(&sched_ctx.task_table, &task->id_node);
+  seqcount_write_end(&sched_ctx.task_table_seq);
+  unlink_task_locked(task);
+
+  clear_task(task);
+  task->next = sched_ctx.free_tasks;
+  sched_ctx.free_tasks = task;
+}
+
+// sched_ctx lock must be held. Call before picking the next task, this
+// CPU is then no longer on the stack of the task it switched away from.
+static void reap_dead_task_locked(void) {
+  Task* dead_task = THIS_CPU_VAR(dead_task);
+  if (dead_task != NULL) {
+    THIS_CPU_VAR(dead_task) = NULL;
+    free_task_locked(dead_task);
+  }
 }
 
 
@@ -287,137 +316,188 @@ void idle_task(void) {
   }
 }
 
-static inline Task* get_task_by_index(int index) {
-  if (index < 0 || index >= (MAX_TASKS + NUM_CPUS)) {
-    return NULL;
-  }
-  return &sched_ctx.task_list[index];
-}
-
+// Take sched_ctx lock or read under task_table_seq
 static inline Task* get_task_by_id(task_id_t id) {
   if (id < 0) {
     return NULL;
   }
-  for (uint32_t i = 0; i < MAX_TASKS; i++) {
-    if (sched_ctx.task_list[i].id == id) {
-      return &sched_ctx.task_list[i];
-    }
-  }
-  return NULL;
+  IdTableNode* node = id_table_find(&sched_ctx.task_table, id);
+  return (node != NULL) ? ID_TABLE_ENTRY(node, Task, id_node) : NULL;
 }
 
 static inline Task* get_cpu_current_task(void) {
-  return sched_ctx.current_task[GET_CPU_ID()];
+  return THIS_CPU_VAR(current_task);
 }
 
 // CPU core specific
 static inline void set_cpu_current_task(Task* task) {
-  sched_ctx.current_task[GET_CPU_ID()] = task;
+  THIS_CPU_VAR(current_task) = task;
 }
 
 static inline Task* get_cpu_idle_task(void) {
-  return get_task_by_index(IDLE_TASK_INDEX + GET_CPU_ID());
+  return THIS_CPU_VAR(idle_task);
 }
 
 pid_t sched_get_pid_by_task_id(task_id_t task_id) {
-  Task* task = get_task_by_id(task_id);
-  if (task == NULL) {
-    return -1;
-  }
-  if (task->type != TASK_TYPE_USER) {
-    return -2;
-  }
-  return task->pid;
+  pid_t pid;
+  uint32_t seq;
+
+  do {
+    seq = seqcount_read_begin(&sched_ctx.task_table_seq);
+    Task* task = get_task_by_id(task_id);
+    if (task == NULL) {
+      pid = -1;
+    } else if (task->type != TASK_TYPE_USER) {
+      pid = -2;
+    } else {
+      pid = task->pid;
+    }
+  } while (seqcount_read_retry(&sched_ctx.task_table_seq, seq));
+
+  return pid;
+}
+
+// Idle tasks are never in task_table or a task_list, so they can't be
+// looked up, terminated or picked while another task is ready
+// Frame of the first exception taken on the task's stack. For a user task
+// in the kernel, it holds the user state to return to.
+static inline PtRegs* task_user_regs(Task* task) {
+  return (PtRegs*)(task_stack_top(task) - sizeof(PtRegs));
+}
+
+// Frame that starts the task at pc when restored, on top of its stack
+static void init_task_frame(Task* task, uintptr_t pc, uint64_t spsr, uintptr_t sp_el0,
+                            uint64_t arg) {
+  PtRegs* regs = task_user_regs(task);
+  memset(regs, 0, sizeof(PtRegs));
+  regs->regs[0] = arg;
+  regs->sp_el0 = sp_el0;
+  regs->elr_el1 = pc;
+  regs->spsr_el1 = spsr;
+  task->ctx.regs = regs;
 }
 
 static void create_idle_tasks(void) {
   for (uint32_t cpu = 0; cpu < NUM_CPUS; cpu++) {
-    Task* task = &sched_ctx.task_list[IDLE_TASK_INDEX + cpu];
-    sched_ctx.current_task_count++;
+    Task* task = allocate_task();  // First chunk has enough, lock not dropped
+    PER_CPU_VAR(cpu, idle_task) = task;
     sched_ctx.total_tasks_created++;
 
     task->id = sched_ctx.total_tasks_created;
-    task->ctx.sp_el1 = (uintptr_t)&task->stack[TASK_STACK_SIZE];
-    task->ctx.sp_el0 = 0;
-    task->ctx.pc = (uintptr_t)idle_task;
+    init_task_frame(task, (uintptr_t)idle_task, SPSR_EL1H, 0, 0);
     task->state = TASK_STATE_INITIAL;
     task->sleep_until = 0;
     task->type = TASK_TYPE_KERNEL;
     task->cpu_id = cpu;
+    reset_task_accounting(task);
+  }
+}
+
+// sched_ctx lock must be held. prev has been running since its
+// state_since, next waiting since its own.
+static void account_switch_locked(Task* prev, Task* next, uint64_t now, bool preempted) {
+  prev->runtime += now - prev->state_since;
+  prev->state_since = now;
+  if (preempted) {
+    prev->nr_involuntary++;
+  } else {
+    prev->nr_voluntary++;
+  }
+
+  next->wait_time += now - next->state_since;
+  next->state_since = now;
+}
+
+// sched_ctx lock must be held. Task just became ready, if it should preempt
+// whatever its CPU is running, kick that CPU instead of waiting for its tick.
+static void kick_task_cpu_locked(Task* task) {
+  uint32_t cpu = task->cpu_id;
+  if (cpu == THIS_CPU_ID()) {
+    return;
+  }
+  Task* running = PER_CPU_VAR(cpu, current_task);
+  if (running == NULL) {
+    return;  // Scheduler not started on that CPU yet
+  }
+  if (running == PER_CPU_VAR(cpu, idle_task) || running->priority < task->priority) {
+    ipi_send_reschedule(cpu);
   }
 }
 
 static inline bool is_schedulable(Task* task) {
-  return ((task->state == TASK_STATE_READY || task->state == TASK_STATE_INITIAL))
-         && (task->cpu_id == (GET_CPU_ID()));
+  return task->state == TASK_STATE_READY || task->state == TASK_STATE_INITIAL;
 }
 
 static Task* determine_cpu_next_task(void) {
-  // Simple FIFO: find the next task in ready state by looping through all tasks
-  uint32_t orig_task_idx = get_cpu_current_task()->index;
-
-  uint32_t task_idx = orig_task_idx;
-  for (uint32_t i = 0; i < MAX_TASKS; i++) {
-    task_idx = (task_idx + 1) % MAX_TASKS;
-    if (is_schedulable(&sched_ctx.task_list[task_idx])) {
-      return &sched_ctx.task_list[task_idx];
-    }
+  // Highest priority ready task wins, round robin among equal priorities
+  // by starting the search after the current task. Only this CPU's tasks
+  // are scanned, the current one last.
+  Task* current_task = get_cpu_current_task();
+  Task* first = THIS_CPU_VAR(task_list);
+  if (first == NULL) {
+    return get_cpu_idle_task();
   }
+  if (current_task != get_cpu_idle_task()) {
+    first = current_task->next;
+  }
+
+  Task* best = NULL;
+  Task* task = first;
+  do {
+    if (is_schedulable(task) && (best == NULL || task->priority > best->priority)) {
+      best = task;
+    }
+    task = task->next;
+  } while (task != first);
 
-  // Check if original task is still schedulable
-  if (is_schedulable(&sched_ctx.task_list[orig_task_idx])) {
-    return &sched_ctx.task_list[orig_task_idx];
+  if (best != NULL) {
+    return best;
   }
 
   return get_cpu_idle_task(); // No tasks ready, schedule idle task
 }
 
-// Switch context to new_task, calls IRQ end callback with int_id and cpu_id
-// Assumes sched_ctx lock is held
-static void switch_context_from_irq(Task* new_task, uint32_t int_id, uint32_t cpu_id) {
-  bool initial = (new_task->state == TASK_STATE_INITIAL);
-  bool user_task = (new_task->type == TASK_TYPE_USER);
-  
+// Switch context to new_task. Interrupts must be masked and sched_ctx lock
+// held. Everything else the task resumes with is in its frame.
+static void switch_context(Task* new_task) {
   new_task->state = TASK_STATE_RUNNING;
-  sched_ctx.end_irq_callback(int_id, cpu_id);
+
+  // Tasks that don't own the FP/SIMD registers trap on their first use
+  if (THIS_CPU_VAR(fpsimd_owner) == new_task) {
+    fpsimd_allow_el0();
+  } else {
+    fpsimd_trap_el0();
+  }
 
   start_timer();
 
-  if (initial) {
-    if (user_task) {
-      mmu_set_user_l2_table(new_task->l2_table);
-      unlock_sched_ctx();
-      INITIAL_JUMP_TO_USER_TASK_FROM_IRQ(new_task->ctx);
-    } else {
-      mmu_set_user_l2_table(NULL);
-      unlock_sched_ctx();
-      INITIAL_JUMP_TO_KERNEL_TASK_FROM_IRQ(new_task->ctx, new_task->param);
-    }
-  }
-  else {
-    if (user_task) {
-      mmu_set_user_l2_table(new_task->l2_table);
-      unlock_sched_ctx();
-      RESTORE_USER_CONTEXT_FROM_IRQ(new_task->ctx);
-    } else {
-      mmu_set_user_l2_table(NULL);
-      unlock_sched_ctx();
-      RESTORE_KERNEL_CONTEXT_FROM_IRQ(new_task->ctx);
-    }
-  }
+  mmu_set_user_l2_table(new_task->l2_table);
+  unlock_sched_ctx();
+  exception_return(new_task->ctx.regs);
+}
+
+// Switch context to new_task, calls IRQ end callback with int_id and cpu_id
+// Assumes sched_ctx lock is held
+static void switch_context_from_irq(Task* prev_task, Task* new_task, uint32_t int_id, uint32_t cpu_id) {
+  // The IRQ handler doesn't return from here, its exit is traced here
+  TRACE(TRACE_SCHED_SWITCH, 0, prev_task->id, new_task->id);
+  TRACE(TRACE_IRQ_EXIT, int_id & GICC_IAR_INTID_MASK, 0, 0);
+  sched_ctx.end_irq_callback(int_id, cpu_id);
+  switch_context(new_task);
 }
 
 void sched_init(uint64_t time_slice_us, EndIRQCallback end_irq_callback) {
   memset(&sched_ctx, 0, sizeof(SchedContext));
+  sched_ctx.lock = (Spinlock)SPINLOCK_INITIALIZER("sched_ctx");
   sched_ctx.lock.used_from_irq = true;
   sched_ctx.time_slice_cntp_tval = US_TO_CNTP_TVAL(time_slice_us);
   sched_ctx.end_irq_callback = end_irq_callback;
-  create_idle_tasks();
 
-  // Initialize task list indices
-  for (uint32_t i = 0; i < MAX_TASKS + NUM_CPUS; i++) {
-    sched_ctx.task_list[i].index = i;
-  }
+  // More chunks are allocated when this one runs out
+  init_task_chunk(&first_task_chunk);
+  add_task_chunk_locked(&first_task_chunk);
+
+  create_idle_tasks();
 
   sched_ctx.initialized = true;
 }
@@ -429,44 +509,58 @@ int sched_start(void) {
 
   // No lock needed because this is CPU specific
 
+  fpsimd_trap_el0();
+
   // Start with idle task
   set_cpu_current_task(get_cpu_idle_task());
 
   Task* task = get_cpu_current_task();
   task->state = TASK_STATE_RUNNING;
+  task->state_since = GET_TIMER_COUNT();
 
-  LOG(LOG_SCHED "switch CPU%d: start -> %ld\r\n", GET_CPU_ID(), task->id);
+  LOG(LOG_SCHED "switch CPU%d: start -> %ld\r\n", THIS_CPU_ID(), task->id);
 
   start_timer();
 
-  INITIAL_JUMP_TO_KERNEL_TASK(task->ctx, task->param);
-
-  __builtin_unreachable();
+  // Boot stack is left behind for good
+  exception_return(task->ctx.regs);
 }
 
 static void wake_up_tasks() {
-  // Check for sleeping tasks that need to wake up
+  // Check for sleeping tasks that need to wake up. Each CPU keeps ticking
+  // even when idle, so it only needs to check its own tasks.
   uint64_t current_time = GET_TIMER_COUNT();
-  for (int i = 0; i < MAX_TASKS; i++) {
-    if (sched_ctx.task_list[i].state == TASK_STATE_BLOCKED &&
-        sched_ctx.task_list[i].sleep_until > 0 &&
-        current_time >= sched_ctx.task_list[i].sleep_until) {
-      LOG(LOG_SCHED "wakeup: %ld\r\n", sched_ctx.task_list[i].id);
-      sched_ctx.task_list[i].state = TASK_STATE_READY;
-      sched_ctx.task_list[i].sleep_until = 0;
-    }
+  Task* first = THIS_CPU_VAR(task_list);
+  if (first == NULL) {
+    return;
   }
+
+  Task* task = first;
+  do {
+    if (task->state == TASK_STATE_BLOCKED && task->sleep_until > 0 &&
+        current_time >= task->sleep_until) {
+      LOG(LOG_SCHED "wakeup: %ld\r\n", task->id);
+      task->state = TASK_STATE_READY;
+      task->state_since = current_time;
+      task->sleep_until = 0;
+    }
+    task = task->next;
+  } while (task != first);
 }
 
 // Will lock sched_ctx, but won't unlock in case of context switch
-void sched_timer_irq_handler(uint32_t int_id, uint32_t cpu_id, uintptr_t sp_after_ctx_save) {
+void sched_timer_irq_handler(uint32_t int_id, uint32_t cpu_id, PtRegs* regs) {
   stop_timer();
   
   Task* current_task = get_cpu_current_task();
+  TRACE(TRACE_SCHED_TICK, 0, current_task->id, 0);
   
   lock_sched_ctx();
+  reap_dead_task_locked();
+  uint64_t now = GET_TIMER_COUNT();
 
-  if (current_task->state == TASK_STATE_RUNNING) {
+  bool preempted = current_task->state == TASK_STATE_RUNNING;
+  if (preempted) {
     current_task->state = TASK_STATE_READY;
   }
 
@@ -476,6 +570,8 @@ void sched_timer_irq_handler(uint32_t int_id, uint32_t cpu_id, uintptr_t sp_afte
 
   if (next_task == current_task) {
     start_timer();
+    current_task->runtime += now - current_task->state_since;
+    current_task->state_since = now;
     current_task->state = TASK_STATE_RUNNING;
     unlock_sched_ctx();
     return;  // No need to switch context if task didn't change
@@ -483,96 +579,110 @@ void sched_timer_irq_handler(uint32_t int_id, uint32_t cpu_id, uintptr_t sp_afte
 
   LOG(LOG_SCHED "switch CPU%d: %ld(%d) -> %ld(%d)\r\n",
           cpu_id, current_task->id, current_task->type, next_task->id, next_task->type);
+  account_switch_locked(current_task, next_task, now, preempted);
 
-  // Context switch needed, save the rest of the context (if current task is not terminated)
-  // General purpose registers have been saved already to the stack
+  // The IRQ frame already holds the whole interrupted state, including
+  // ELR, SPSR and SP_EL0, the task resumes by returning through it
   if (current_task->state != TASK_STATE_TERMINATED) {
-    SAVE_ELR_EL1(current_task->ctx);
-    LOG(LOG_SCHED "CPU%d saved elr_el1: 0x%lx\r\n", cpu_id, current_task->ctx.pc);
-
-    if (current_task->type == TASK_TYPE_USER) {
-      // User stack pointer needs to be saved separately for restoring user context later
-      SAVE_SP_EL0(current_task->ctx);
-      LOG(LOG_SCHED "saved sp_el0: 0x%lx\r\n", current_task->ctx.sp_el0);
-    }
-
-    current_task->ctx.sp_el1 = sp_after_ctx_save;
+    current_task->ctx.regs = regs;
+  } else {
+    THIS_CPU_VAR(dead_task) = current_task;
   }
   
   set_cpu_current_task(next_task);
 
-  switch_context_from_irq(next_task, int_id, cpu_id);
+  switch_context_from_irq(current_task, next_task, int_id, cpu_id);
   __builtin_unreachable();
 }
 
 task_id_t sched_create_kernel_task(void (*task_func)(void*), void *param) {
-  if (!sched_ctx.initialized || sched_ctx.current_task_count >= MAX_TASKS) {
+  return sched_create_kernel_task_on(THIS_CPU_ID(), task_func, param);
+}
+
+task_id_t sched_create_kernel_task_on(uint32_t cpu_id, void (*task_func)(void*),
+                                      void *param) {
+  if (!sched_ctx.initialized || cpu_id >= NUM_CPUS) {
     return NO_TASK;
   }
 
   lock_sched_ctx();
-  
+
   Task* new_task = allocate_task();
   if (new_task == NULL) {
     unlock_sched_ctx();
     return NO_TASK;
   }
 
-  sched_ctx.current_task_count++;
   sched_ctx.total_tasks_created++;
 
   // use total_tasks_created as ID to avoid reusing IDs of terminated tasks
   new_task->id = (task_id_t)sched_ctx.total_tasks_created;
-  new_task->ctx.sp_el1 = (uintptr_t)&new_task->stack[TASK_STACK_SIZE];
-  new_task->ctx.sp_el0 = 0;
-  new_task->ctx.pc = (uintptr_t)task_func;
-  new_task->param = param;
+  init_task_frame(new_task, (uintptr_t)task_func, SPSR_EL1H, 0, (uint64_t)param);
   new_task->state = TASK_STATE_INITIAL;
   new_task->sleep_until = 0;
   new_task->type = TASK_TYPE_KERNEL;
-  new_task->cpu_id = GET_CPU_ID();
+  new_task->cpu_id = cpu_id;
+  publish_task_locked(new_task);
+  kick_task_cpu_locked(new_task);
+
+  // Once unlocked the task may run, finish and be freed on its CPU
+  task_id_t id = new_task->id;
+  uint64_t entry = new_task->ctx.regs->elr_el1;
+  uint64_t sp = (uint64_t)new_task->ctx.regs;
   unlock_sched_ctx();
 
   LOG(LOG_SCHED "Created kernel task: id=%ld, entry=0x%lx, sp=0x%lx, cpu=%d\r\n",
-      new_task->id, new_task->ctx.pc, new_task->ctx.sp_el1, new_task->cpu_id);
+      id, entry, sp, cpu_id);
 
-  return new_task->id;
+  return id;
 }
 
-task_id_t sched_create_user_task(uintptr_t entry_point_va, uint64_t* l2_table, 
-                                 uint32_t cpu_id, uintptr_t sp, pid_t pid) {
-  if (!sched_ctx.initialized || sched_ctx.current_task_count >= MAX_TASKS) {
-    return NO_TASK;
-  }
-
-  lock_sched_ctx();
+// sched_ctx lock must be held. Allocates and initializes a user task but
+// doesn't publish it, so nothing can schedule it yet. NULL if out of memory.
+static Task* create_user_task_locked(uintptr_t entry_point_va, uint64_t* l2_table,
+                                     uint32_t cpu_id, uintptr_t sp, pid_t pid) {
   Task* new_task = allocate_task();
   if (new_task == NULL) {
-    unlock_sched_ctx();
-    return NO_TASK;
+    return NULL;
   }
 
-  sched_ctx.current_task_count++;
   sched_ctx.total_tasks_created++;
 
   // use total_tasks_created as ID to avoid reusing IDs of terminated tasks
   new_task->id = (task_id_t)sched_ctx.total_tasks_created;
-  new_task->ctx.sp_el0 = sp;
-  // this will be used when storing/restoring context
-  new_task->ctx.sp_el1 = (uintptr_t)&new_task->stack[TASK_STACK_SIZE];
-  new_task->ctx.pc = entry_point_va;
+  init_task_frame(new_task, entry_point_va, SPSR_EL0T, sp, 0);
   new_task->state = TASK_STATE_INITIAL;
   new_task->sleep_until = 0;
   new_task->type = TASK_TYPE_USER;
   new_task->l2_table = l2_table;
   new_task->cpu_id = cpu_id;
   new_task->pid = pid;
+  return new_task;
+}
+
+task_id_t sched_create_user_task(uintptr_t entry_point_va, uint64_t* l2_table, 
+                                 uint32_t cpu_id, uintptr_t sp, pid_t pid) {
+  if (!sched_ctx.initialized) {
+    return NO_TASK;
+  }
+
+  lock_sched_ctx();
+
+  Task* new_task = create_user_task_locked(entry_point_va, l2_table, cpu_id, sp, pid);
+  if (new_task == NULL) {
+    unlock_sched_ctx();
+    return NO_TASK;
+  }
+  publish_task_locked(new_task);
+
+  // Once unlocked the task may run, exit and be freed on its CPU
+  task_id_t id = new_task->id;
   unlock_sched_ctx();
 
   LOG(LOG_SCHED "Created user task: id=%ld, entry=0x%lx, sp=0x%lx, cpu=%d, pid=%d\r\n",
-      new_task->id, new_task->ctx.pc, new_task->ctx.sp_el0, new_task->cpu_id, new_task->pid);
+      id, (uint64_t)entry_point_va, (uint64_t)sp, cpu_id, pid);
 
-  return new_task->id;
+  return id;
 }
 
 void sched_block_current_task(void) {
@@ -582,13 +692,94 @@ void sched_block_current_task(void) {
   sched_yield();
 }
 
-void sched_unblock_task(task_id_t task_id) {
+bool sched_is_task_running(task_id_t task_id) {
+  bool running;
+  uint32_t seq;
+
+  do {
+    seq = seqcount_read_begin(&sched_ctx.task_table_seq);
+    Task* task = get_task_by_id(task_id);
+    running = (task != NULL && task->state == TASK_STATE_RUNNING);
+  } while (seqcount_read_retry(&sched_ctx.task_table_seq, seq));
+
+  return running;
+}
+
+int sched_set_priority(task_id_t task_id, uint8_t priority) {
+  lock_sched_ctx();
+  Task* task = get_task_by_id(task_id);
+  if (task == NULL) {
+    unlock_sched_ctx();
+    return -1;
+  }
+  // Don't drop below an active boost
+  if (task->priority == task->base_priority || priority > task->priority) {
+    task->priority = priority;
+  }
+  task->base_priority = priority;
+  unlock_sched_ctx();
+  return 0;
+}
+
+uint8_t sched_get_priority(task_id_t task_id) {
   lock_sched_ctx();
   Task* task = get_task_by_id(task_id);
+  uint8_t priority = (task != NULL) ? task->priority : SCHED_PRIORITY_DEFAULT;
+  unlock_sched_ctx();
+  return priority;
+}
+
+void sched_boost_priority(task_id_t task_id, uint8_t priority) {
+  lock_sched_ctx();
+  Task* task = get_task_by_id(task_id);
+  if (task != NULL && task->priority < priority) {
+    task->priority = priority;
+  }
+  unlock_sched_ctx();
+}
+
+void sched_restore_priority(task_id_t task_id) {
+  lock_sched_ctx();
+  Task* task = get_task_by_id(task_id);
+  if (task != NULL) {
+    task->priority = task->base_priority;
+  }
+  unlock_sched_ctx();
+}
+
+void sched_block_current_task_unless(const _Atomic bool* woken) {
+  lock_sched_ctx();
+  if (atomic_load_explicit(woken, memory_order_acquire)) {
+    unlock_sched_ctx();
+    return;
+  }
+  get_cpu_current_task()->state = TASK_STATE_BLOCKED;
+  unlock_sched_ctx();
+  sched_yield();
+}
+
+// sched_ctx lock must be held
+static inline void unblock_task_locked(Task* task) {
   if (task != NULL && task->state == TASK_STATE_BLOCKED) {
     task->state = TASK_STATE_READY;
+    task->state_since = GET_TIMER_COUNT();
     task->sleep_until = 0UL;
+    kick_task_cpu_locked(task);
   }
+}
+
+void sched_unblock_task(task_id_t task_id) {
+  lock_sched_ctx();
+  unblock_task_locked(get_task_by_id(task_id));
+  unlock_sched_ctx();
+}
+
+void sched_wake_task_if(Task* task, _Atomic bool* woken) {
+  // The task can't terminate and be freed while the lock is held, even if
+  // it sees woken right away
+  lock_sched_ctx();
+  atomic_store_explicit(woken, true, memory_order_release);
+  unblock_task_locked(task);
   unlock_sched_ctx();
 }
 
@@ -599,7 +790,7 @@ void sched_block_task(task_id_t task_id) {
   if (task != NULL && (task->state == TASK_STATE_RUNNING || task->state == TASK_STATE_READY)) {
     task->state = TASK_STATE_BLOCKED;
   }
-  lock_sched_ctx();
+  unlock_sched_ctx();
 }
 
 // Works only for task on caller CPU
@@ -624,8 +815,58 @@ void sched_sleep_cpu_current_task(uint64_t sleep_us) {
   sched_yield();
 }
 
+void sched_switch(void) {
+  Task* current_task = get_cpu_current_task();
+  if (current_task == NULL) {
+    trigger_timer_irq();  // Scheduler not started on this CPU, nothing to switch to
+    return;
+  }
+
+  uint32_t daif = GET_DAIF();
+  // Stay masked until the next task is restored, unlock won't unmask
+  MASK_ALL_INTERRUPTS();
+  lock_sched_ctx();
+  reap_dead_task_locked();
+
+  if (current_task->state == TASK_STATE_RUNNING) {
+    current_task->state = TASK_STATE_READY;
+  }
+
+  wake_up_tasks();
+  Task* next_task = determine_cpu_next_task();
+
+  if (next_task == current_task) {
+    current_task->state = TASK_STATE_RUNNING;
+    unlock_sched_ctx();
+    SET_DAIF(daif);
+    return;
+  }
+
+  LOG(LOG_SCHED "switch CPU%d: %ld(%d) -> %ld(%d) voluntary\r\n",
+          THIS_CPU_ID(), current_task->id, current_task->type, next_task->id, next_task->type);
+
+  if (current_task->state == TASK_STATE_TERMINATED) {
+    THIS_CPU_VAR(dead_task) = current_task;
+  }
+
+  TRACE(TRACE_SCHED_SWITCH, 1, current_task->id, next_task->id);
+  account_switch_locked(current_task, next_task, GET_TIMER_COUNT(), false);
+
+  set_cpu_current_task(next_task);
+  // A syscall blocking in here keeps its own exception frame further up
+  // the stack, its return to EL0 doesn't depend on the live ELR/SPSR
+  context_switch_save(&current_task->ctx, next_task, SPSR_EL1H | daif);
+  // Resumed by switch_context, interrupts are as they were on entry
+}
+
+// Continues sched_switch on the stack of the task that switched out
+void sched_switch_finish(Task* next_task) {
+  switch_context(next_task);
+  __builtin_unreachable();
+}
+
 void sched_yield(void) {
-  trigger_timer_irq();
+  sched_switch();
 }
 
 task_id_t sched_get_cpu_current_task_id(void) {
@@ -636,6 +877,124 @@ task_id_t sched_get_cpu_current_task_id(void) {
   return current_task->id;
 }
 
+Task* sched_get_cpu_current_task(void) {
+  return get_cpu_current_task();
+}
+
+task_id_t sched_get_task_id(Task* task) {
+  return (task != NULL) ? task->id : NO_TASK;
+}
+
+static const char* task_state_name(TaskState state) {
+  switch (state) {
+  case TASK_STATE_READY:
+    return "ready";
+  case TASK_STATE_RUNNING:
+    return "running";
+  case TASK_STATE_BLOCKED:
+    return "blocked";
+  case TASK_STATE_INITIAL:
+    return "new";
+  case TASK_STATE_TERMINATED:
+    return "dead";
+  default:
+    return "?";
+  }
+}
+
+static inline uint64_t ticks_to_us(uint64_t ticks) {
+  uint64_t freq = GET_TIMER_FREQ();
+  return (ticks / freq) * 1000000 + (ticks % freq) * 1000000 / freq;
+}
+
+// sched_ctx lock must be held. Time since the last tick or switch is
+// included, so a task that runs for long stretches isn't undercounted.
+static void fill_task_stats_locked(Task* task, TaskStats* stats, uint64_t now) {
+  uint64_t runtime = task->runtime;
+  uint64_t wait_time = task->wait_time;
+  if (task->state == TASK_STATE_RUNNING) {
+    runtime += now - task->state_since;
+  } else if (is_schedulable(task)) {
+    wait_time += now - task->state_since;
+  }
+
+  *stats = (TaskStats){
+    .id = task->id,
+    .pid = task->pid,
+    .cpu_id = task->cpu_id,
+    .type = task->type,
+    .idle = task == PER_CPU_VAR(task->cpu_id, idle_task),
+    .priority = task->priority,
+    .state = task_state_name(task->state),
+    .runtime_us = ticks_to_us(runtime),
+    .wait_us = ticks_to_us(wait_time),
+    .nr_voluntary = task->nr_voluntary,
+    .nr_involuntary = task->nr_involuntary
+  };
+}
+
+size_t sched_get_task_stats(TaskStats* out, size_t max, uint64_t* now_us) {
+  size_t count = 0;
+
+  lock_sched_ctx();
+  uint64_t now = GET_TIMER_COUNT();
+  *now_us = ticks_to_us(now);
+
+  for (uint32_t cpu = 0; cpu < NUM_CPUS; cpu++) {
+    if (count < max) {
+      fill_task_stats_locked(PER_CPU_VAR(cpu, idle_task), &out[count], now);
+    }
+    count++;
+  }
+
+  for (uint32_t cpu = 0; cpu < NUM_CPUS; cpu++) {
+    Task* first = PER_CPU_VAR(cpu, task_list);
+    if (first == NULL) {
+      continue;
+    }
+    Task* task = first;
+    do {
+      if (count < max) {
+        fill_task_stats_locked(task, &out[count], now);
+      }
+      count++;
+      task = task->next;
+    } while (task != first);
+  }
+
+  unlock_sched_ctx();
+  return count;
+}
+
+void sched_set_current_l2_table(uint64_t* l2_table) {
+  lock_sched_ctx();
+  Task* current_task = get_cpu_current_task();
+  // A user task's own table is fixed, it only borrows NULL for a moment
+  if (current_task != NULL && current_task->type == TASK_TYPE_KERNEL) {
+    current_task->l2_table = l2_table;
+  }
+  mmu_set_user_l2_table(l2_table);
+  unlock_sched_ctx();
+}
+
+void sched_forget_l2_table(uint64_t* l2_table) {
+  lock_sched_ctx();
+  for (uint32_t cpu = 0; cpu < NUM_CPUS; cpu++) {
+    Task* first = PER_CPU_VAR(cpu, task_list);
+    if (first == NULL) {
+      continue;
+    }
+    Task* task = first;
+    do {
+      if (task->type == TASK_TYPE_KERNEL && task->l2_table == l2_table) {
+        task->l2_table = NULL;
+      }
+      task = task->next;
+    } while (task != first);
+  }
+  unlock_sched_ctx();
+}
+
 int sched_terminate_task(task_id_t task_id) {
   lock_sched_ctx();
   Task* task = get_task_by_id(task_id);
@@ -643,8 +1002,15 @@ int sched_terminate_task(task_id_t task_id) {
     unlock_sched_ctx();
     return -1;
   }
-  task->state = TASK_STATE_TERMINATED;
-  sched_ctx.current_task_count--;
+
+  if (task->state == TASK_STATE_TERMINATED) {
+    // Already waiting for its CPU to free it
+  } else if (PER_CPU_VAR(task->cpu_id, current_task) == task) {
+    // Still on its stack, freed once its CPU has switched away
+    task->state = TASK_STATE_TERMINATED;
+  } else {
+    free_task_locked(task);
+  }
   unlock_sched_ctx();
 
   return 0;
@@ -661,37 +1027,90 @@ void sched_terminate_cpu_current_task(void) {
   }
 }
 
-static inline void copy_saved_context(Task* dest, Task* src) {
-  // Saved context from dest sp_el1 needs to be copied to src task stack
-  uintptr_t dest_stack_top = (uintptr_t)&dest->stack[TASK_STACK_SIZE];
-  const size_t offset = 31 * 8;
-  
-  uint64_t* context_in_dest_stack = (uint64_t*)(dest_stack_top - offset);
-  uint64_t* context_in_src_stack = (uint64_t*)(src->ctx.sp_el1);
-
-  // Copy general purpose registers x0-x30 (31 registers) that were saved to the stack during IRQ
-  for (int i = 0; i < 31; i++) {
-    context_in_dest_stack[i] = context_in_src_stack[i];
+task_id_t sched_clone_user_task(task_id_t src_task_id, uint64_t* l2_table, pid_t pid, uint32_t target_cpu) {
+  if (!sched_ctx.initialized || target_cpu >= NUM_CPUS) {
+    return NO_TASK;
   }
 
-  dest->ctx.sp_el1 = (uintptr_t)context_in_dest_stack;
-}
+  lock_sched_ctx();
 
-task_id_t sched_clone_user_task(task_id_t src_task_id, uint64_t* l2_table, pid_t pid, uint32_t target_cpu) {
   Task* src_task = get_task_by_id(src_task_id);
   if (src_task == NULL || src_task->type != TASK_TYPE_USER) {
+    unlock_sched_ctx();
     return NO_TASK;
   }
 
-  task_id_t new_task_id = sched_create_user_task(src_task->ctx.pc, l2_table, target_cpu,
-                                                 src_task->ctx.sp_el0, pid);
-  if (new_task_id == NO_TASK) {
+  // Parent is in the kernel (a syscall or preempted), the user state it
+  // returns to is in the frame at the top of its stack
+  PtRegs* src_regs = task_user_regs(src_task);
+  Task* new_task = create_user_task_locked(src_regs->elr_el1, l2_table, target_cpu,
+                                           src_regs->sp_el0, pid);
+  if (new_task == NULL) {
+    unlock_sched_ctx();
     return NO_TASK;
   }
-  Task* new_task = get_task_by_id(new_task_id);
 
-  copy_saved_context(new_task, src_task);
+  // Child is published only once its state is complete, no CPU can pick
+  // it up before. It returns to the same user state.
+  *new_task->ctx.regs = *src_regs;
+  // Child gets a copy of the FP/SIMD state too, which may still be only in
+  // the registers if the parent is cloning itself
+  if (src_task->cpu_id == THIS_CPU_ID() && THIS_CPU_VAR(fpsimd_owner) == src_task) {
+    fpsimd_save(task_fpsimd_state(src_task));
+  }
+  if (src_task->fpsimd_used) {
+    memcpy(task_fpsimd_state(new_task), task_fpsimd_state(src_task), sizeof(FPSIMDState));
+    new_task->fpsimd_used = true;
+  }
   new_task->state = TASK_STATE_READY;
+  publish_task_locked(new_task);
+  kick_task_cpu_locked(new_task);
+
+  task_id_t new_task_id = new_task->id;
+  unlock_sched_ctx();
+
+  LOG(LOG_SCHED "Cloned user task %ld: id=%ld, cpu=%d, pid=%d\r\n",
+      src_task_id, new_task_id, target_cpu, pid);
 
   return new_task_id;
 }
+
+uint32_t sched_pick_cpu(void) {
+  uint32_t best = 0;
+
+  lock_sched_ctx();
+  for (uint32_t cpu = 1; cpu < NUM_CPUS; cpu++) {
+    if (PER_CPU_VAR(cpu, task_count) < PER_CPU_VAR(best, task_count)) {
+      best = cpu;
+    }
+  }
+  unlock_sched_ctx();
+
+  return best;
+}
+
+int sched_fpsimd_access(void) {
+  Task* task = get_cpu_current_task();
+  if (task == NULL || task->type != TASK_TYPE_USER) {
+    return -1;
+  }
+
+  lock_sched_ctx();
+  Task* owner = THIS_CPU_VAR(fpsimd_owner);
+  if (owner != task) {
+    if (owner != NULL) {
+      fpsimd_save(task_fpsimd_state(owner));
+    }
+    if (!task->fpsimd_used) {
+      // First use, start from zeroed registers and default FPCR
+      memset(task_fpsimd_state(task), 0, sizeof(FPSIMDState));
+      task->fpsimd_used = true;
+    }
+    fpsimd_load(task_fpsimd_state(task));
+    THIS_CPU_VAR(fpsimd_owner) = task;
+  }
+  unlock_sched_ctx();
+
+  fpsimd_allow_el0();
+  return 0;
+}
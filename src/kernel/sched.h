@@ -3,13 +3,23 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include "sys/types.h"
+#include "pt-regs.h"
 
-#define MAX_TASKS 32
+// Higher value runs first. Tasks start at the default priority, which
+// leaves room below for background work that should only use idle time.
+#define SCHED_PRIORITY_MIN 0
+#define SCHED_PRIORITY_BACKGROUND 64
+#define SCHED_PRIORITY_DEFAULT 128
+#define SCHED_PRIORITY_MAX 255
 
 typedef int64_t task_id_t;
 #define NO_TASK ((task_id_t)(-1))
 
+// Opaque, owned by the scheduler
+typedef struct Task Task;
+
 typedef void (*EndIRQCallback)(uint32_t, uint32_t);
 
 typedef enum {
@@ -19,11 +29,15 @@ typedef enum {
 
 // TODO: refactor function return values
 
-// Call only from one CPU
+// Call only from one CPU. Tasks are allocated on demand, there is no fixed
+// limit besides kernel memory.
 void sched_init(uint64_t time_slice_us, EndIRQCallback end_irq_callback);
 
 // Create kernel task for caller CPU
 task_id_t sched_create_kernel_task(void (*task_func)(void*), void *param);
+// Create kernel task for specified CPU, it starts once that CPU schedules
+task_id_t sched_create_kernel_task_on(uint32_t cpu_id, void (*task_func)(void*),
+                                      void *param);
 // Create user task for specified CPU
 task_id_t sched_create_user_task(uintptr_t entry_point_va, uint64_t* l2_table, 
                                  uint32_t cpu_id, uintptr_t sp, pid_t pid);
@@ -35,27 +49,95 @@ void sched_terminate_cpu_current_task(void);
 // Call for each CPU
 int sched_start(void);
 
-// Call only from IRQ context
-void sched_timer_irq_handler(uint32_t int_id, uint32_t cpu_id, uintptr_t sp_after_ctx_save);
+// Call only from IRQ context, serves both the timer and reschedule IPIs
+// regs is the frame of the interrupted task, which resumes from it.
+void sched_timer_irq_handler(uint32_t int_id, uint32_t cpu_id, PtRegs* regs);
 
 // Block indefinitely until sched_unblock_task is called with the task ID
 void sched_block_current_task(void);
+// Same, but don't block if *woken is already set. The waker must set *woken
+// before calling sched_unblock_task, then the wakeup can't get lost.
+void sched_block_current_task_unless(const _Atomic bool* woken);
 // Unblock task with specified ID, making it eligible for scheduling again
 void sched_unblock_task(task_id_t task_id);
+// Sets *woken and unblocks task, for waiters that block with
+// sched_block_current_task_unless(woken). Both happen under the scheduler
+// lock, so the waiter can't return and its Task be reused in between.
+void sched_wake_task_if(Task* task, _Atomic bool* woken);
 void sched_block_task(task_id_t task_id);
 
+// Switch to the next task right away instead of waiting for the timer IRQ.
+// Works from kernel tasks and from the syscall path (interrupts masked, the
+// exception return state is preserved). Returns when the current task is
+// scheduled again, so a blocked task must be unblocked first.
+void sched_switch(void);
+
 // Yield the CPU to allow other tasks to run, but don't block the current task
 void sched_yield(void);
 
 // Sleep for approximately the specified number of microseconds, blocking the current task
 void sched_sleep_cpu_current_task(uint64_t sleep_us);
 
+// Loads l2_table (NULL to unload) as the user address space of the calling
+// CPU. A kernel task keeps it across context switches until it loads
+// another, so it can block, e.g. on an fd lock, while it works on a
+// process's memory.
+void sched_set_current_l2_table(uint64_t* l2_table);
+// Clears l2_table from kernel tasks still holding it, call before the
+// table is freed
+void sched_forget_l2_table(uint64_t* l2_table);
+
 // Get the ID of the task currently running on the calling CPU
 task_id_t sched_get_cpu_current_task_id(void);
+Task* sched_get_cpu_current_task(void);
+task_id_t sched_get_task_id(Task* task);
 
 // -1 if no task with the given ID exists, -2 if the task is not a user task
 pid_t sched_get_pid_by_task_id(task_id_t task_id);
 
+// True if the task is currently executing on some CPU. Lockless, result may
+// be stale by the time it's used.
+bool sched_is_task_running(task_id_t task_id);
+
+// Priorities only order tasks of the same CPU
+int sched_set_priority(task_id_t task_id, uint8_t priority);
+uint8_t sched_get_priority(task_id_t task_id);
+// Priority inheritance: raise effective priority of task_id to at least
+// priority, until sched_restore_priority drops it back to the base priority
+void sched_boost_priority(task_id_t task_id, uint8_t priority);
+void sched_restore_priority(task_id_t task_id);
+
 task_id_t sched_clone_user_task(task_id_t src_task_id, uint64_t* l2_table, pid_t pid, uint32_t target_cpu);
 
+// CPU with the fewest live tasks, for placing new tasks. This is the only
+// load balancing: tasks stay on their CPU for life, this_cpu() and
+// lockless per-CPU state rely on it (see percpu.h). The reschedule IPI only
+// makes a CPU notice a task placed or woken on it.
+uint32_t sched_pick_cpu(void);
+
+// Accounting snapshot of one task, times in microseconds
+typedef struct TaskStats {
+  task_id_t id;
+  pid_t pid;
+  uint32_t cpu_id;
+  TaskType type;
+  bool idle;  // The CPU's idle task, its runtime is the CPU's idle time
+  uint8_t priority;
+  const char* state;
+  uint64_t runtime_us;
+  uint64_t wait_us;  // Ready but not running
+  uint32_t nr_voluntary;  // Switched out after blocking or yielding
+  uint32_t nr_involuntary;  // Preempted
+} TaskStats;
+
+// Fills out with up to max tasks, idle tasks first, and sets *now_us to
+// the time of the snapshot. Returns the number of tasks that exist, which
+// may be more than max.
+size_t sched_get_task_stats(TaskStats* out, size_t max, uint64_t* now_us);
+
+// Call from the FP/SIMD access trap. Loads the current user task's FP/SIMD
+// state if needed and lets EL0 use it until the next switch. Returns -1 if
+// the current task is not a user task.
+int sched_fpsimd_access(void);
+
 #endif /* SCHED_H */
\ No newline at end of file
@@ -2,27 +2,13 @@
 #include "string.h"
 #include "sem.h"
 
-
-static int push_task_to_queue(TaskQueue* queue, task_id_t task_id) {
-  if (queue->count >= MAX_TASKS) {
-    return -1; // Full
-  }
-  queue->tasks[queue->rear] = task_id;
-  queue->rear = (queue->rear + 1) % MAX_TASKS;
-  queue->count++;
-  return 0;
-}
-
-static task_id_t pop_task_from_queue(TaskQueue* queue) {
-  if (queue->count == 0) {
-    return NO_TASK; // Empty
-  }
-  task_id_t task_id = queue->tasks[queue->front];
-  queue->front = (queue->front + 1) % MAX_TASKS;
-  queue->count--;
-  return task_id;
-}
-
+/*
+ * Units are handed over directly: a post with waiters present gives its
+ * unit to the first waiter without touching value, and a wait on a full
+ * semaphore with posters present takes the unit and lets the first poster
+ * complete. Woken tasks therefore never have to retake the lock and race
+ * with new arrivals.
+ */
 
 int k_sem_init(KSemaphore* sem, uint64_t initial_value, uint64_t max_value) {
   if (sem == NULL || initial_value > max_value || max_value == 0) {
@@ -36,29 +22,36 @@ int k_sem_init(KSemaphore* sem, uint64_t initial_value, uint64_t max_value) {
   return 0;
 }
 
+// Takes one unit, lock must be held and value > 0
+static inline void take_unit_locked(KSemaphore* sem) {
+  // A blocked poster's unit replaces the one taken, value stays the same
+  if (!wait_queue_wake_one(&sem->post_queue, 0)) {
+    sem->value--;
+  }
+}
+
+// Adds one unit, lock must be held and value < max_value or waiters present
+static inline void give_unit_locked(KSemaphore* sem) {
+  if (!wait_queue_wake_one(&sem->wait_queue, 0)) {
+    sem->value++;
+  }
+}
+
 int k_sem_wait(KSemaphore* sem) {
   if (sem == NULL) {
     return -1;
   }
 
   spinlock_acquire(&sem->lock);
-  
+
   if (sem->value == 0) {
-    push_task_to_queue(&sem->wait_queue, sched_get_cpu_current_task_id());
-    spinlock_release(&sem->lock);
-    sched_block_current_task();
-    spinlock_acquire(&sem->lock);
+    // Poster hands its unit over, nothing left to do when woken
+    (void)wait_queue_wait(&sem->wait_queue, &sem->lock);
+    return 0;
   }
-  
-  sem->value--;
-  
-  // Wake a waiting poster if any
-  task_id_t popped_poster = pop_task_from_queue(&sem->post_queue);
+
+  take_unit_locked(sem);
   spinlock_release(&sem->lock);
-  
-  if (popped_poster != NO_TASK) {
-    sched_unblock_task(popped_poster);
-  }
 
   return 0;
 }
@@ -73,42 +66,28 @@ int k_sem_try_wait(KSemaphore* sem) {
     spinlock_release(&sem->lock);
     return -1; // Would block
   }
-  sem->value--;
 
-  task_id_t popped_poster = pop_task_from_queue(&sem->post_queue);
+  take_unit_locked(sem);
   spinlock_release(&sem->lock);
 
-  if (popped_poster != NO_TASK) {
-    sched_unblock_task(popped_poster);
-  }
-
   return 0;
 }
 
-
 int k_sem_post(KSemaphore* sem) {
   if (sem == NULL) {
     return -1;
   }
 
   spinlock_acquire(&sem->lock);
-  
-  if (sem->value >= sem->max_value) {
-    push_task_to_queue(&sem->post_queue, sched_get_cpu_current_task_id());
-    spinlock_release(&sem->lock);
-    sched_block_current_task();
-    spinlock_acquire(&sem->lock);
+
+  if (sem->value >= sem->max_value && wait_queue_is_empty(&sem->wait_queue)) {
+    // Waiter takes our unit in place of the one it consumes
+    (void)wait_queue_wait(&sem->post_queue, &sem->lock);
+    return 0;
   }
-  
-  sem->value++;
-  
-  // Wake a waiting waiter if any
-  task_id_t popped_waiter = pop_task_from_queue(&sem->wait_queue);
+
+  give_unit_locked(sem);
   spinlock_release(&sem->lock);
-  
-  if (popped_waiter != NO_TASK) {
-    sched_unblock_task(popped_waiter);
-  }
 
   return 0;
 }
@@ -119,20 +98,14 @@ int k_sem_try_post(KSemaphore* sem) {
   }
 
   spinlock_acquire(&sem->lock);
-  if (sem->value >= sem->max_value) {
+  if (sem->value >= sem->max_value && wait_queue_is_empty(&sem->wait_queue)) {
     spinlock_release(&sem->lock);
     return -1; // Would block
   }
 
-  sem->value++;
-
-  task_id_t popped_waiter = pop_task_from_queue(&sem->wait_queue);
+  give_unit_locked(sem);
   spinlock_release(&sem->lock);
 
-  if (popped_waiter != NO_TASK) {
-    sched_unblock_task(popped_waiter);
-  }
-
   return 0;
 }
 
@@ -146,4 +119,4 @@ uint64_t k_sem_get_value(KSemaphore* sem) {
   spinlock_release(&sem->lock);
 
   return value;
-}
\ No newline at end of file
+}
@@ -4,25 +4,20 @@
 #include <stdint.h>
 #include "sched.h"
 #include "spinlock.h"
-
-typedef struct TaskQueue {
-  task_id_t tasks[MAX_TASKS];
-  uint32_t front;
-  uint32_t rear;
-  uint32_t count;
-} TaskQueue;
-
+#include "wait-queue.h"
 
 typedef struct KSemaphore {
   uint64_t value;
   uint64_t max_value;
-  TaskQueue wait_queue;
-  TaskQueue post_queue;
+  WaitQueue wait_queue;  // Waiting for value > 0
+  WaitQueue post_queue;  // Waiting for value < max_value
   Spinlock lock;
 } KSemaphore;
 
-#define K_SEM_INIT(initial_value, max_value) {initial_value, max_value, {0}, {0}, {0, false}}
-#define K_SEM_INIT_IRQ_SAFE(initial_value, max_value) {initial_value, max_value, {0}, {0}, {0, true}}
+#define K_SEM_INIT(initial_value, max_value) \
+  {initial_value, max_value, WAIT_QUEUE_INIT, WAIT_QUEUE_INIT, {.used_from_irq = false}}
+#define K_SEM_INIT_IRQ_SAFE(initial_value, max_value) \
+  {initial_value, max_value, WAIT_QUEUE_INIT, WAIT_QUEUE_INIT, {.used_from_irq = true}}
 
 int k_sem_init(KSemaphore* sem, uint64_t initial_value, uint64_t max_value);
 int k_sem_wait(KSemaphore* sem);
@@ -33,4 +28,4 @@ int k_sem_try_wait(KSemaphore* sem);
 int k_sem_try_post(KSemaphore* sem);
 uint64_t k_sem_get_value(KSemaphore* sem);
 
-#endif /* SEM_H */
\ No newline at end of file
+#endif /* SEM_H */
@@ -0,0 +1,82 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "spinlock.h"
+
+/*
+ * Sequence locks for read-mostly data. Readers never block writers, they
+ * take a snapshot of the sequence, read the data and retry if a writer was
+ * active meanwhile:
+ *
+ *   uint32_t seq;
+ *   do {
+ *     seq = seqlock_read_begin(&lock);
+ *     ... copy out the data ...
+ *   } while (seqlock_read_retry(&lock, seq));
+ *
+ * Readers may see torn data before the retry check, so they must only read
+ * (no pointer chasing into memory that can be freed) and must bound loops.
+ */
+
+// Bare sequence counter, writers must be serialized by some other lock
+typedef struct SeqCount {
+  _Atomic uint32_t sequence;  // Odd while a write is in progress
+} SeqCount;
+
+static inline uint32_t seqcount_read_begin(const SeqCount* s) {
+  uint32_t seq;
+  while ((seq = atomic_load_explicit(&s->sequence, memory_order_acquire)) & 1) {
+    __asm__ __volatile__("yield");
+  }
+  return seq;
+}
+
+static inline bool seqcount_read_retry(const SeqCount* s, uint32_t start) {
+  // Data reads must complete before the sequence is checked again
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&s->sequence, memory_order_relaxed) != start;
+}
+
+static inline void seqcount_write_begin(SeqCount* s) {
+  atomic_store_explicit(&s->sequence,
+                        atomic_load_explicit(&s->sequence, memory_order_relaxed) + 1,
+                        memory_order_relaxed);
+  // Sequence must be visible before any data writes
+  atomic_thread_fence(memory_order_release);
+}
+
+static inline void seqcount_write_end(SeqCount* s) {
+  atomic_store_explicit(&s->sequence,
+                        atomic_load_explicit(&s->sequence, memory_order_relaxed) + 1,
+                        memory_order_release);
+}
+
+// Sequence counter with its own writer lock
+typedef struct SeqLock {
+  SeqCount seq;
+  Spinlock lock;
+} SeqLock;
+
+static inline uint32_t seqlock_read_begin(const SeqLock* s) {
+  return seqcount_read_begin(&s->seq);
+}
+
+static inline bool seqlock_read_retry(const SeqLock* s, uint32_t start) {
+  return seqcount_read_retry(&s->seq, start);
+}
+
+static inline void seqlock_write_acquire(SeqLock* s) {
+  spinlock_acquire(&s->lock);
+  seqcount_write_begin(&s->seq);
+}
+
+static inline void seqlock_write_release(SeqLock* s) {
+  seqcount_write_end(&s->seq);
+  spinlock_release(&s->lock);
+}
+
+#endif /* SEQLOCK_H */
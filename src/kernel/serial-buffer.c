@@ -1,61 +1,62 @@
-#include <stdatomic.h>
 #include <stddef.h>
 
 #include "serial-buffer.h"
 #include "sched.h"
-#include "sem.h"
+#include "spinlock.h"
+#include "wait-queue.h"
+#include "lf-queue.h"
 
 #define SERIAL_BUFFER_SIZE 256
-#define SERIAL_BUFFER_MASK (SERIAL_BUFFER_SIZE - 1)
 
-#if SERIAL_BUFFER_SIZE & SERIAL_BUFFER_MASK
-#error "SERIAL_BUFFER_SIZE must be a power of 2"
-#endif
-
-// Lock free SPSC ring buffer for serial console input from UART
+// SPSC queue for serial console input from UART. Reader pops without
+// locking. If the reader is sleeping the queue is empty, and the IRQ
+// handler hands the character to it directly.
 typedef struct SerialBuffer {
-  _Atomic size_t head;
-  _Atomic size_t tail;
+  SPSCQueue queue;
   char buffer[SERIAL_BUFFER_SIZE];
-  KSemaphore buffer_sem;  // Semaphore to signal when data is available
+  Spinlock lock;  // Protects readers and pushes to the queue
+  WaitQueue readers;
 } SerialBuffer;
 
 static SerialBuffer serial_buffer = {
-  .head = ATOMIC_VAR_INIT(0),
-  .tail = ATOMIC_VAR_INIT(0),
+  .queue = {
+    .mask = SERIAL_BUFFER_SIZE - 1,
+    .elem_size = 1,
+    .buffer = (uint8_t*)serial_buffer.buffer
+  },
   .buffer = {0},
-  .buffer_sem = K_SEM_INIT_IRQ_SAFE(0, SERIAL_BUFFER_SIZE)
+  .lock = { .used_from_irq = true },
+  .readers = WAIT_QUEUE_INIT
 };
 
 int serial_buffer_put(char c) {
-  size_t head = atomic_load_explicit(&serial_buffer.head, memory_order_relaxed);
-  size_t tail = atomic_load_explicit(&serial_buffer.tail, memory_order_acquire);
+  int ret = 0;
+  spinlock_acquire(&serial_buffer.lock);
 
-  if ((head - tail) == SERIAL_BUFFER_SIZE) {
-    return -1; // full
+  if (wait_queue_wake_one(&serial_buffer.readers, (uint64_t)(unsigned char)c)) {
+    goto out;
   }
 
-  serial_buffer.buffer[head & SERIAL_BUFFER_MASK] = c;
-  atomic_store_explicit(&serial_buffer.head, head + 1, memory_order_release);
-
-  // Signal data available
-  k_sem_try_post(&serial_buffer.buffer_sem);
+  if (!spsc_queue_push(&serial_buffer.queue, &c)) {
+    ret = -1; // full
+  }
 
-  return 0;
+out:
+  spinlock_release(&serial_buffer.lock);
+  return ret;
 }
 
 char serial_buffer_get(void) {
-  size_t tail = atomic_load_explicit(&serial_buffer.tail, memory_order_relaxed);
-  size_t head = atomic_load_explicit(&serial_buffer.head, memory_order_acquire);
-
-  while (tail == head) {
-    // No data available, wait for data to be put into the buffer
-    k_sem_wait(&serial_buffer.buffer_sem);
-    tail = atomic_load_explicit(&serial_buffer.tail, memory_order_relaxed);
-    head = atomic_load_explicit(&serial_buffer.head, memory_order_acquire);
+  char c;
+
+  if (!spsc_queue_pop(&serial_buffer.queue, &c)) {
+    spinlock_acquire(&serial_buffer.lock);
+    if (!spsc_queue_pop(&serial_buffer.queue, &c)) {
+      // Empty, next character is handed over by serial_buffer_put
+      return (char)wait_queue_wait(&serial_buffer.readers, &serial_buffer.lock);
+    }
+    spinlock_release(&serial_buffer.lock);
   }
 
-  char c = serial_buffer.buffer[tail & SERIAL_BUFFER_MASK];
-  atomic_store_explicit(&serial_buffer.tail, tail + 1, memory_order_release);
   return c;
 }
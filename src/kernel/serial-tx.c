@@ -0,0 +1,126 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "serial-tx.h"
+#include "pl011.h"
+#include "spinlock.h"
+#include "string.h"
+
+#define SERIAL_TX_BUFFER_SIZE 8192
+
+#if SERIAL_TX_BUFFER_SIZE & (SERIAL_TX_BUFFER_SIZE - 1)
+#error "SERIAL_TX_BUFFER_SIZE must be a power of 2"
+#endif
+
+// Byte ring between k_puts callers and the UART TX interrupt. Head and tail
+// run freely and are masked on access, so head - tail is the fill level.
+// Writers copy into the ring and push what fits into the hardware FIFO
+// themselves. The TX interrupt is enabled only while bytes remain after
+// that, and drains the rest as the FIFO empties.
+typedef struct SerialTx {
+  char buffer[SERIAL_TX_BUFFER_SIZE];
+  size_t head;
+  size_t tail;
+  size_t dropped;
+  bool tx_irq_enabled;
+  Spinlock lock;
+} SerialTx;
+
+static SerialTx serial_tx = {
+  .buffer = {0},
+  .lock = { .used_from_irq = true }
+};
+
+static _Atomic bool serial_tx_panicked = false;
+
+static void fill_fifo_locked(void) {
+  while (serial_tx.head != serial_tx.tail && !pl011_tx_fifo_full()) {
+    pl011_write_data(serial_tx.buffer[serial_tx.tail & (SERIAL_TX_BUFFER_SIZE - 1)]);
+    serial_tx.tail++;
+  }
+
+  bool pending = serial_tx.head != serial_tx.tail;
+  if (pending != serial_tx.tx_irq_enabled) {
+    pl011_set_tx_irq(pending);
+    serial_tx.tx_irq_enabled = pending;
+  }
+}
+
+static size_t write_ring(const char* data, size_t len, bool count_dropped) {
+  spinlock_acquire(&serial_tx.lock);
+
+  size_t space = SERIAL_TX_BUFFER_SIZE - (serial_tx.head - serial_tx.tail);
+  size_t count = len < space ? len : space;
+  if (count_dropped) {
+    serial_tx.dropped += len - count;
+  }
+
+  // Copy in at most two parts, split where the ring wraps
+  size_t offset = serial_tx.head & (SERIAL_TX_BUFFER_SIZE - 1);
+  size_t first = SERIAL_TX_BUFFER_SIZE - offset;
+  if (first > count) {
+    first = count;
+  }
+  memcpy(&serial_tx.buffer[offset], data, first);
+  memcpy(serial_tx.buffer, data + first, count - first);
+  serial_tx.head += count;
+
+  fill_fifo_locked();
+
+  spinlock_release(&serial_tx.lock);
+  return count;
+}
+
+size_t serial_tx_write(const char* data, size_t len) {
+  return write_ring(data, len, true);
+}
+
+size_t serial_tx_write_partial(const char* data, size_t len) {
+  return write_ring(data, len, false);
+}
+
+void serial_tx_irq_handler(void) {
+  spinlock_acquire(&serial_tx.lock);
+  if (!serial_tx_panicked) {
+    fill_fifo_locked();
+  }
+  spinlock_release(&serial_tx.lock);
+}
+
+void serial_tx_panic(void) {
+  if (serial_tx_panicked) {
+    return;
+  }
+  serial_tx_panicked = true;
+
+  pl011_set_tx_irq(false);
+  while (serial_tx.head != serial_tx.tail) {
+    pl011_putc(serial_tx.buffer[serial_tx.tail & (SERIAL_TX_BUFFER_SIZE - 1)]);
+    serial_tx.tail++;
+  }
+}
+
+bool serial_tx_in_panic(void) {
+  return serial_tx_panicked;
+}
+
+size_t serial_tx_dropped(void) {
+  return serial_tx.dropped;
+}
+
+void serial_tx_flush(void) {
+  bool empty = false;
+  while (!empty) {
+    // Refill here too, the TX interrupt may be routed to a busy CPU
+    spinlock_acquire(&serial_tx.lock);
+    if (!serial_tx_panicked) {
+      fill_fifo_locked();
+    }
+    empty = serial_tx.head == serial_tx.tail;
+    spinlock_release(&serial_tx.lock);
+  }
+
+  while (pl011_busy()) {
+  }
+}
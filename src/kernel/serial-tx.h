@@ -0,0 +1,27 @@
+#ifndef SERIAL_TX_H
+#define SERIAL_TX_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Queues up to len bytes for the UART without waiting. Bytes that don't fit
+// in the ring are dropped and counted. Returns the number of bytes queued.
+size_t serial_tx_write(const char* data, size_t len);
+// Same, but the caller retries the rest, so nothing counts as dropped
+size_t serial_tx_write_partial(const char* data, size_t len);
+
+// Refills the TX FIFO from the ring, called from the UART IRQ
+void serial_tx_irq_handler(void);
+
+// Switches output to synchronous polling for good and flushes what is
+// queued. For fatal exception paths, the ring lock may be held by the
+// code that crashed, so it is not taken.
+void serial_tx_panic(void);
+bool serial_tx_in_panic(void);
+
+size_t serial_tx_dropped(void);
+
+// Blocks until the ring and the UART have sent everything queued so far
+void serial_tx_flush(void);
+
+#endif // SERIAL_TX_H
@@ -1,14 +1,100 @@
 #include "spinlock.h"
+#include "io.h"
+#include "percpu.h"
+
+#define TICKET_SHIFT 16
+
+// Interrupts stay masked until the last IRQ-safe lock held by this CPU is
+// released, whatever order the locks are released in
+static inline void irq_off_push(void) {
+  uint32_t daif = GET_DAIF();
+  MASK_ALL_INTERRUPTS();
+
+  PerCPU* cpu = this_cpu();
+  if (cpu->irq_off_depth++ == 0) {
+    cpu->irq_saved_daif = daif;
+  }
+}
+
+static inline void irq_off_pop(void) {
+  PerCPU* cpu = this_cpu();
+  if (--cpu->irq_off_depth == 0) {
+    SET_DAIF(cpu->irq_saved_daif);
+  }
+}
+
+// Takes a ticket, returns the lock word as it was before
+static inline uint32_t take_ticket(Spinlock* lock) {
+  uint32_t old, new, status;
+
+  __asm__ __volatile__(
+    "   prfm  pstl1strm, %[ticket]\n"
+    "1: ldaxr %w[old], %[ticket]\n"
+    "   add   %w[new], %w[old], %w[inc]\n"
+    "   stxr  %w[status], %w[new], %[ticket]\n"
+    "   cbnz  %w[status], 1b\n"
+    : [old] "=&r"(old), [new] "=&r"(new), [status] "=&r"(status),
+      [ticket] "+Q"(lock->ticket)
+    : [inc] "r"(1U << TICKET_SHIFT)
+    : "memory");
+
+  return old;
+}
+
+// Sleeps with wfe until our ticket is served. The exclusive load arms the
+// monitor, so the release store of the previous owner wakes us up.
+static inline void wait_for_ticket(Spinlock* lock, uint16_t my_ticket) {
+  uint32_t owner;
+
+  __asm__ __volatile__(
+    "   sevl\n"
+    "1: wfe\n"
+    "   ldaxrh %w[owner], %[ticket]\n"
+    "   cmp    %w[owner], %w[mine]\n"
+    "   b.ne   1b\n"
+    : [owner] "=&r"(owner)
+    : [ticket] "Q"(lock->ticket), [mine] "r"((uint32_t)my_ticket)
+    : "memory", "cc");
+}
+
+#if SPINLOCK_STATS
+static Spinlock* listed_locks[SPINLOCK_STATS_MAX_LOCKS];
+static _Atomic uint32_t num_listed_locks = 0;
+#endif
 
 void spinlock_acquire(Spinlock* lock) {
 #if USE_SMP
   if (lock->used_from_irq) {
-    lock->saved_irq_state[GET_CPU_ID()] = GET_DAIF();
-    MASK_ALL_INTERRUPTS();
+    irq_off_push();
   }
-  while (atomic_exchange(&lock->locked, 1) == 1) {
-    __asm__ __volatile__("yield");
+
+  uint32_t old = take_ticket(lock);
+  uint16_t my_ticket = old >> TICKET_SHIFT;
+  bool contended = ((uint16_t)old != my_ticket);
+
+#if SPINLOCK_STATS
+  uint64_t wait_start = contended ? GET_TIMER_COUNT() : 0;
+#endif
+
+  if (contended) {
+    wait_for_ticket(lock, my_ticket);
   }
+
+#if SPINLOCK_STATS
+  // Stats are protected by the lock itself
+  if (lock->stats.name != NULL && !lock->stats.listed) {
+    uint32_t idx = atomic_fetch_add(&num_listed_locks, 1);
+    if (idx < SPINLOCK_STATS_MAX_LOCKS) {
+      listed_locks[idx] = lock;
+    }
+    lock->stats.listed = true;
+  }
+  lock->stats.acquisitions++;
+  if (contended) {
+    lock->stats.contended++;
+    lock->stats.spin_ticks += GET_TIMER_COUNT() - wait_start;
+  }
+#endif
 #else
   (void)lock;
   MASK_ALL_INTERRUPTS();
@@ -17,12 +103,40 @@ void spinlock_acquire(Spinlock* lock) {
 
 void spinlock_release(Spinlock* lock) {
 #if USE_SMP
-  atomic_store(&lock->locked, 0);
+  uint32_t owner;
+
+  // Only the holder writes the owner half, no exclusive access needed
+  __asm__ __volatile__(
+    "   ldrh  %w[owner], %[ticket]\n"
+    "   add   %w[owner], %w[owner], #1\n"
+    "   stlrh %w[owner], %[ticket]\n"
+    : [owner] "=&r"(owner), [ticket] "+Q"(lock->ticket)
+    :
+    : "memory");
+
   if (lock->used_from_irq) {
-    SET_DAIF(lock->saved_irq_state[GET_CPU_ID()]);
+    irq_off_pop();
   }
 #else
   (void)lock;
   UNMASK_ALL_INTERRUPTS();
 #endif
-}
\ No newline at end of file
+}
+
+void spinlock_stats_print(void) {
+#if SPINLOCK_STATS
+  uint32_t count = atomic_load(&num_listed_locks);
+  if (count > SPINLOCK_STATS_MAX_LOCKS) {
+    count = SPINLOCK_STATS_MAX_LOCKS;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    // Read without the lock, values may be slightly stale
+    SpinlockStats* s = &listed_locks[i]->stats;
+    k_printf_wait("%s: acquired %lu, contended %lu, spin ticks %lu\n",
+                  s->name, s->acquisitions, s->contended, s->spin_ticks);
+  }
+#else
+  k_printf_wait("Spinlock statistics disabled, set SPINLOCK_STATS in spinlock.h\n");
+#endif
+}
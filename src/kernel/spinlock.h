@@ -8,14 +8,39 @@
 
 #include "armv8-a.h"
 
+// Set to 1 to count acquisitions and contention of each lock
+#define SPINLOCK_STATS 0
+
+#define SPINLOCK_STATS_MAX_LOCKS 16
+
+typedef struct SpinlockStats {
+  const char* name;       // Only named locks are listed
+  bool listed;
+  uint64_t acquisitions;
+  uint64_t contended;     // Acquisitions that had to wait
+  uint64_t spin_ticks;    // Time spent waiting, in system counter ticks
+} SpinlockStats;
+
+// FIFO ticket lock. Low half of ticket is the ticket being served, high half
+// is the next ticket to hand out. Zero initialized lock is unlocked.
 typedef struct Spinlock {
-  _Atomic uint32_t locked;
-  bool used_from_irq;
-  uint64_t saved_irq_state[NUM_CPUS];
+  uint32_t ticket;
+  bool used_from_irq;  // Masks interrupts while held, see PerCPU.irq_off_depth
+#if SPINLOCK_STATS
+  SpinlockStats stats;
+#endif
 } Spinlock;
 
+// Static initializer for locks that should show up in spinlock_stats_print
+#if SPINLOCK_STATS
+#define SPINLOCK_INITIALIZER(lock_name) { .stats = { .name = (lock_name) } }
+#else
+#define SPINLOCK_INITIALIZER(lock_name) { 0 }
+#endif
+
 // Not reentrant
 void spinlock_acquire(Spinlock* lock);
 void spinlock_release(Spinlock* lock);
+void spinlock_stats_print(void);
 
-#endif /* SPINLOCK_H */
\ No newline at end of file
+#endif /* SPINLOCK_H */
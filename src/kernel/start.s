@@ -33,6 +33,16 @@ _Setup_EL2:
     msr sctlr_el2, xzr
     msr hcr_el2, xzr
 
+    // Don't trap FP/SIMD to EL3 or EL2, EL1 controls it with CPACR_EL1
+    msr cptr_el3, xzr
+    mov x0, #0x33ff         // RES1 bits, TFP=0
+    msr cptr_el2, x0
+
+    // Give EL1 all PMU event counters (HPMN = PMCR_EL0.N), no PMU traps
+    mrs x0, pmcr_el0
+    ubfx x0, x0, #11, #5
+    msr mdcr_el2, x0
+
     // Determine the EL2 Execution state.
     mrs x0, scr_el3
     orr x0, x0, #(1<<10)    // RW EL2 Execution state is AArch64.
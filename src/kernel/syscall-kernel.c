@@ -1,4 +1,5 @@
 #include <stdarg.h>
+#include <sys/uio.h>
 
 #include "string.h"
 
@@ -7,32 +8,44 @@
 #include "process.h"
 #include "memory.h"
 #include "log.h"
+#include "klog.h"
+#include "trace.h"
 #include "armv8-a.h"
 #include "vfs.h"
 #include "io.h"
+#include "user-access.h"
+#include "futex.h"
 
-#define ENABLE_LOG 0
-
-#if ENABLE_LOG
-#define LOG(...) \
-    do { \
-      k_printf(__VA_ARGS__); \
-    } while (0)
-#else
-#define LOG(...) \
-    do {} while (0);
-#endif
+// Binary log records, cheap enough to keep on, see klog.h
+#define LOG(...) klog(KLOG_DEBUG, __VA_ARGS__)
 
 typedef void (*syscall_handler_fn)(SyscallContext*);
 
 static inline void end_syscall_handler(SyscallContext *ctx) {
   LOG(LOG_SYSCALL "Ending syscall handler for syscall number %ld for PID %d\n", ctx->args[0], ctx->pid);
+  TRACE(TRACE_SYSCALL_EXIT, ctx->number, ctx->task_id, 0);
   sched_unblock_task(ctx->task_id);
   k_free(ctx);
   sched_terminate_cpu_current_task();
   __builtin_unreachable();
 }
 
+// Copies iovec array from user, returns total length of buffers or -1 if invalid.
+// User L2 table must be loaded
+static ssize_t copy_iovecs_from_user(const struct iovec* user_iov, int iovcnt, struct iovec* out) {
+  if (iovcnt < 0 || iovcnt > IOV_MAX) {
+    return -1;
+  }
+
+  ssize_t total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    out[i].iov_base = (void*)READ_AS_EL0_64(&user_iov[i].iov_base);
+    out[i].iov_len = (size_t)READ_AS_EL0_64(&user_iov[i].iov_len);
+    total += out[i].iov_len;
+  }
+  return total;
+}
+
 void handle_getpid(SyscallContext *ctx) {
   process_load_l2_table(ctx->pid);
   WRITE_AS_EL0_64(ctx->ret, ctx->pid);
@@ -45,23 +58,25 @@ void handle_write(SyscallContext *ctx) {
   char* user_buffer = (char*)ctx->args[1];
   size_t size = ctx->args[2];
 
-  char* tmp_buffer = k_malloc(size + 1);
+  ssize_t bytes_written = -1;
 
   process_load_l2_table(ctx->pid);
-  
-  for (size_t i = 0; i < size; i++) {
-    tmp_buffer[i] = READ_AS_EL0_8((user_buffer + i));
-  }
-  tmp_buffer[size] = '\0';
 
-  size_t bytes_written = 0;
-
-  // "stdout"
-  if (fd == 1) {
-    k_puts(tmp_buffer);
-    bytes_written = size;
-  } else {
-    bytes_written = process_write_file(ctx->pid, fd, tmp_buffer, size);
+  char* tmp_buffer = k_malloc(size + 1);
+  if (tmp_buffer != NULL) {
+    for (size_t i = 0; i < size; i++) {
+      tmp_buffer[i] = READ_AS_EL0_8((user_buffer + i));
+    }
+    tmp_buffer[size] = '\0';
+
+    // "stdout"
+    if (fd == 1) {
+      k_puts(tmp_buffer);
+      bytes_written = size;
+    } else {
+      bytes_written = process_write_file(ctx->pid, fd, tmp_buffer, size);
+    }
+    k_free(tmp_buffer);
   }
 
   WRITE_AS_EL0_64(ctx->ret, bytes_written);
@@ -101,16 +116,17 @@ void handle_read(SyscallContext *ctx) {
   char* user_buffer = (char*)ctx->args[1];
   size_t size = ctx->args[2];
 
-  char* tmp_buffer = k_malloc(size);
+  ssize_t bytes_read = -1;
 
   process_load_l2_table(ctx->pid);
-  
-  ssize_t bytes_read = process_read_file(ctx->pid, fd, tmp_buffer, size);
 
-  if (bytes_read > 0) {
+  char* tmp_buffer = k_malloc(size);
+  if (tmp_buffer != NULL) {
+    bytes_read = process_read_file(ctx->pid, fd, tmp_buffer, size);
     for (ssize_t i = 0; i < bytes_read; i++) {
       WRITE_AS_EL0_8((user_buffer + i), tmp_buffer[i]);
     }
+    k_free(tmp_buffer);
   }
 
   WRITE_AS_EL0_64(ctx->ret, bytes_read);
@@ -119,6 +135,140 @@ void handle_read(SyscallContext *ctx) {
   end_syscall_handler(ctx);
 }
 
+void handle_pwrite(SyscallContext *ctx) {
+  int fd = ctx->args[0];
+  const void* user_buffer = (const void*)ctx->args[1];
+  size_t size = ctx->args[2];
+  off_t offset = ctx->args[3];
+
+  ssize_t ret = -1;
+
+  process_load_l2_table(ctx->pid);
+
+  void* tmp_buffer = k_malloc(size);
+  if (tmp_buffer != NULL) {
+    copy_from_user(tmp_buffer, user_buffer, size);
+    ret = process_pwrite_file(ctx->pid, fd, tmp_buffer, size, offset);
+    k_free(tmp_buffer);
+  }
+
+  WRITE_AS_EL0_64(ctx->ret, ret);
+
+  process_unload_l2_table(ctx->pid);
+  end_syscall_handler(ctx);
+}
+
+void handle_pread(SyscallContext *ctx) {
+  int fd = ctx->args[0];
+  void* user_buffer = (void*)ctx->args[1];
+  size_t size = ctx->args[2];
+  off_t offset = ctx->args[3];
+
+  ssize_t ret = -1;
+
+  process_load_l2_table(ctx->pid);
+
+  void* tmp_buffer = k_malloc(size);
+  if (tmp_buffer != NULL) {
+    ret = process_pread_file(ctx->pid, fd, tmp_buffer, size, offset);
+    if (ret > 0) {
+      copy_to_user(user_buffer, tmp_buffer, ret);
+    }
+    k_free(tmp_buffer);
+  }
+
+  WRITE_AS_EL0_64(ctx->ret, ret);
+
+  process_unload_l2_table(ctx->pid);
+  end_syscall_handler(ctx);
+}
+
+// All user buffers are gathered into one kernel buffer, so the whole batch
+// is written with one trap and one handler task
+void handle_writev(SyscallContext *ctx) {
+  int fd = ctx->args[0];
+  const struct iovec* user_iov = (const struct iovec*)ctx->args[1];
+  int iovcnt = ctx->args[2];
+
+  struct iovec iov[IOV_MAX];
+  ssize_t ret = -1;
+
+  process_load_l2_table(ctx->pid);
+
+  ssize_t total = copy_iovecs_from_user(user_iov, iovcnt, iov);
+  if (total == 0) {
+    ret = 0;
+  } else if (total > 0) {
+    uint8_t* tmp_buffer = k_malloc(total + 1);
+    if (tmp_buffer != NULL) {
+      size_t offset = 0;
+      for (int i = 0; i < iovcnt; i++) {
+        copy_from_user(tmp_buffer + offset, iov[i].iov_base, iov[i].iov_len);
+        iov[i].iov_base = tmp_buffer + offset;
+        offset += iov[i].iov_len;
+      }
+      tmp_buffer[total] = '\0';
+
+      // "stdout"
+      if (fd == 1) {
+        k_puts((const char*)tmp_buffer);
+        ret = total;
+      } else {
+        ret = process_writev_file(ctx->pid, fd, iov, iovcnt);
+      }
+      k_free(tmp_buffer);
+    }
+  }
+
+  WRITE_AS_EL0_64(ctx->ret, ret);
+
+  process_unload_l2_table(ctx->pid);
+  end_syscall_handler(ctx);
+}
+
+void handle_readv(SyscallContext *ctx) {
+  int fd = ctx->args[0];
+  const struct iovec* user_iov = (const struct iovec*)ctx->args[1];
+  int iovcnt = ctx->args[2];
+
+  struct iovec user_bufs[IOV_MAX];
+  struct iovec iov[IOV_MAX];
+  ssize_t ret = -1;
+
+  process_load_l2_table(ctx->pid);
+
+  ssize_t total = copy_iovecs_from_user(user_iov, iovcnt, user_bufs);
+  if (total == 0) {
+    ret = 0;
+  } else if (total > 0) {
+    uint8_t* tmp_buffer = k_malloc(total);
+    if (tmp_buffer != NULL) {
+      size_t offset = 0;
+      for (int i = 0; i < iovcnt; i++) {
+        iov[i].iov_base = tmp_buffer + offset;
+        iov[i].iov_len = user_bufs[i].iov_len;
+        offset += user_bufs[i].iov_len;
+      }
+
+      ret = process_readv_file(ctx->pid, fd, iov, iovcnt);
+
+      // Scatter what was read back to the user buffers
+      size_t remaining = (ret > 0) ? (size_t)ret : 0;
+      for (int i = 0; i < iovcnt && remaining > 0; i++) {
+        size_t len = (remaining < iov[i].iov_len) ? remaining : iov[i].iov_len;
+        copy_to_user(user_bufs[i].iov_base, iov[i].iov_base, len);
+        remaining -= len;
+      }
+      k_free(tmp_buffer);
+    }
+  }
+
+  WRITE_AS_EL0_64(ctx->ret, ret);
+
+  process_unload_l2_table(ctx->pid);
+  end_syscall_handler(ctx);
+}
+
 void handle_close(SyscallContext *ctx) {
   int fd = ctx->args[0];
 
@@ -158,12 +308,65 @@ void handle_fork(SyscallContext *ctx) {
   end_syscall_handler(ctx);
 }
 
+void handle_io_ring_setup(SyscallContext *ctx) {
+  uint32_t flags = ctx->args[0];
+
+  long ret = process_io_ring_setup(ctx->pid, flags);
+
+  process_load_l2_table(ctx->pid);
+  WRITE_AS_EL0_64(ctx->ret, ret);
+  process_unload_l2_table(ctx->pid);
+  end_syscall_handler(ctx);
+}
+
+void handle_io_ring_enter(SyscallContext *ctx) {
+  uint32_t min_complete = ctx->args[0];
+
+  int ret = process_io_ring_enter(ctx->pid, min_complete);
+
+  process_load_l2_table(ctx->pid);
+  WRITE_AS_EL0_64(ctx->ret, ret);
+  process_unload_l2_table(ctx->pid);
+  end_syscall_handler(ctx);
+}
+
+void handle_futex_wait(SyscallContext *ctx) {
+  uint32_t* uaddr = (uint32_t*)ctx->args[0];
+  uint32_t expected = (uint32_t)ctx->args[1];
+
+  process_load_l2_table(ctx->pid);
+  int ret = futex_wait(ctx->pid, uaddr, expected);
+  WRITE_AS_EL0_64(ctx->ret, ret);
+  process_unload_l2_table(ctx->pid);
+  end_syscall_handler(ctx);
+}
+
+void handle_futex_wake(SyscallContext *ctx) {
+  uint32_t* uaddr = (uint32_t*)ctx->args[0];
+  int count = (int)ctx->args[1];
+
+  int ret = futex_wake(ctx->pid, uaddr, count);
+
+  process_load_l2_table(ctx->pid);
+  WRITE_AS_EL0_64(ctx->ret, ret);
+  process_unload_l2_table(ctx->pid);
+  end_syscall_handler(ctx);
+}
+
 static syscall_handler_fn syscall_handler_table[] = {
   [SYS_GETPID] = handle_getpid,
   [SYS_OPEN] = handle_open,
   [SYS_WRITE] = handle_write,
   [SYS_READ] = handle_read,
   [SYS_CLOSE] = handle_close,
+  [SYS_PREAD] = handle_pread,
+  [SYS_PWRITE] = handle_pwrite,
+  [SYS_READV] = handle_readv,
+  [SYS_WRITEV] = handle_writev,
+  [SYS_IO_RING_SETUP] = handle_io_ring_setup,
+  [SYS_IO_RING_ENTER] = handle_io_ring_enter,
+  [SYS_FUTEX_WAIT] = handle_futex_wait,
+  [SYS_FUTEX_WAKE] = handle_futex_wake,
   [SYS_EXIT] = handle_exit,
   [SYS_FORK] = handle_fork,
   [SYS_EXECV] = handle_execv
@@ -171,9 +374,15 @@ static syscall_handler_fn syscall_handler_table[] = {
 
 int syscall_handler(long number, long* ret, ...) {
   SyscallContext *ctx = k_malloc(sizeof(SyscallContext));
+  if (ctx == NULL) {
+    WRITE_AS_EL0_64(ret, -1);
+    return 0;
+  }
 
   ctx->task_id = sched_get_cpu_current_task_id();
   ctx->pid = sched_get_pid_by_task_id(ctx->task_id);
+  ctx->number = number;
+  TRACE(TRACE_SYSCALL_ENTRY, number, ctx->task_id, 0);
 
   va_list args;
   va_start(args, ret);
@@ -195,9 +404,17 @@ int syscall_handler(long number, long* ret, ...) {
   if (number == SYS_SLEEP) {
     sched_sleep_cpu_current_task((unsigned int)ctx->args[0] * 1000 * 1000);
     ctx->ret = 0;
+    TRACE(TRACE_SYSCALL_EXIT, number, ctx->task_id, 0);
+    k_free(ctx);
   } else {
-    sched_create_kernel_task((void*)syscall_handler_table[number], ctx);
-    // This will generate timer irq right after returning to EL0
+    if (sched_create_kernel_task((void*)syscall_handler_table[number], ctx) == NO_TASK) {
+      // Nothing would unblock us, fail the syscall instead
+      WRITE_AS_EL0_64(ret, -1);
+      TRACE(TRACE_SYSCALL_EXIT, number, ctx->task_id, 0);
+      k_free(ctx);
+      return 0;
+    }
+    // Switches to the handler right away, returns once it has unblocked us
     sched_block_current_task();
   }
 
@@ -10,6 +10,7 @@
 typedef struct SyscallContext {
   pid_t pid;
   task_id_t task_id;
+  long number;
   long args[MAX_SYSCALL_PARAMS];
   long* ret;
 } SyscallContext;
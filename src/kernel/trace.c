@@ -0,0 +1,71 @@
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "trace.h"
+#include "armv8-a.h"
+#include "io.h"
+#include "percpu.h"
+#include "stdio.h"
+
+#define TRACE_RING_ENTRIES 4096  // Per CPU
+
+#if TRACE_RING_ENTRIES & (TRACE_RING_ENTRIES - 1)
+#error "TRACE_RING_ENTRIES must be a power of 2"
+#endif
+
+// Written by the owning CPU only, but IRQ handlers can interrupt a task in
+// the middle of a record, so slots are claimed with an atomic increment
+typedef struct TraceRing {
+  _Atomic uint64_t head;
+  TraceEntry entries[TRACE_RING_ENTRIES];
+} __attribute__((aligned(CACHE_LINE_SIZE))) TraceRing;
+
+static TraceRing trace_rings[NUM_CPUS];
+
+_Atomic bool trace_enabled = false;
+
+void trace_record(TraceEvent event, uint32_t arg0, uint64_t arg1, uint64_t arg2) {
+  TraceRing* ring = &trace_rings[THIS_CPU_ID()];
+  uint64_t index = atomic_fetch_add_explicit(&ring->head, 1, memory_order_relaxed);
+
+  TraceEntry* entry = &ring->entries[index & (TRACE_RING_ENTRIES - 1)];
+  entry->timestamp = GET_TIMER_COUNT();
+  entry->event = event;
+  entry->arg0 = arg0;
+  entry->arg1 = arg1;
+  entry->arg2 = arg2;
+}
+
+void trace_start(void) {
+  trace_enabled = false;
+  for (uint32_t cpu = 0; cpu < NUM_CPUS; cpu++) {
+    atomic_store_explicit(&trace_rings[cpu].head, 0, memory_order_relaxed);
+  }
+  trace_enabled = true;
+}
+
+void trace_stop(void) {
+  trace_enabled = false;
+}
+
+void trace_dump(void) {
+  trace_stop();
+
+  char line[128];
+  snprintf(line, sizeof(line), "trace: begin freq=%u cpus=%u\n", GET_TIMER_FREQ(), NUM_CPUS);
+  k_puts_wait(line);
+
+  for (uint32_t cpu = 0; cpu < NUM_CPUS; cpu++) {
+    uint64_t head = atomic_load_explicit(&trace_rings[cpu].head, memory_order_relaxed);
+    uint64_t count = head < TRACE_RING_ENTRIES ? head : TRACE_RING_ENTRIES;
+
+    for (uint64_t i = head - count; i < head; i++) {
+      const TraceEntry* entry = &trace_rings[cpu].entries[i & (TRACE_RING_ENTRIES - 1)];
+      snprintf(line, sizeof(line), "trace: %u %lx %u %x %lx %lx\n", cpu, entry->timestamp,
+               entry->event, entry->arg0, entry->arg1, entry->arg2);
+      k_puts_wait(line);
+    }
+  }
+
+  k_puts_wait("trace: end\n");
+}
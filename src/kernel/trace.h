@@ -0,0 +1,52 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Static tracepoints recorded into per-CPU rings with CNTPCT timestamps.
+// Rings overwrite their oldest entries, so after trace_stop they hold the
+// most recent events of each CPU. Dump over the console and convert with
+// tools/trace2json.py.
+//
+// Event numbers and argument meanings are part of the dump format, keep
+// them in sync with the decoder.
+typedef enum {
+  TRACE_IRQ_ENTRY = 1,     // arg0 interrupt id
+  TRACE_IRQ_EXIT,          // arg0 interrupt id
+  TRACE_SCHED_TICK,        // arg1 current task id
+  TRACE_SCHED_SWITCH,      // arg0 1 if voluntary, arg1 previous task id, arg2 next task id
+  TRACE_SYSCALL_ENTRY,     // arg0 syscall number, arg1 calling task id
+  TRACE_SYSCALL_EXIT,      // arg0 syscall number, arg1 calling task id
+  TRACE_KMALLOC            // arg1 size, arg2 returned pointer
+} TraceEvent;
+
+typedef struct TraceEntry {
+  uint64_t timestamp;
+  uint32_t event;
+  uint32_t arg0;
+  uint64_t arg1;
+  uint64_t arg2;
+} TraceEntry;
+
+extern _Atomic bool trace_enabled;
+
+void trace_record(TraceEvent event, uint32_t arg0, uint64_t arg1, uint64_t arg2);
+
+// Costs one load and branch while tracing is off
+#define TRACE(event, arg0, arg1, arg2) \
+  do { \
+    if (atomic_load_explicit(&trace_enabled, memory_order_relaxed)) { \
+      trace_record((event), (uint32_t)(arg0), (uint64_t)(arg1), (uint64_t)(arg2)); \
+    } \
+  } while (0)
+
+// Clears the rings and starts recording
+void trace_start(void);
+void trace_stop(void);
+// Prints the rings as text, stops tracing first. Waits for console output
+// space, call from a task.
+void trace_dump(void);
+
+#endif // TRACE_H
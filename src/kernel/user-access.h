@@ -0,0 +1,36 @@
+#ifndef USER_ACCESS_H
+#define USER_ACCESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "armv8-a.h"
+
+// Helpers for accessing user memory with EL0 permissions from kernel tasks.
+// The user L2 table of the process must be loaded.
+
+static inline void copy_from_user(void* dest, const void* user_src, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    ((uint8_t*)dest)[i] = READ_AS_EL0_8(((const uint8_t*)user_src + i));
+  }
+}
+
+static inline void copy_to_user(void* user_dest, const void* src, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    WRITE_AS_EL0_8(((uint8_t*)user_dest + i), ((const uint8_t*)src)[i]);
+  }
+}
+
+// Copies at most size - 1 characters, dest is always null terminated
+static inline void copy_string_from_user(char* dest, const char* user_src, size_t size) {
+  for (size_t i = 0; i < size - 1; i++) {
+    char c = READ_AS_EL0_8((user_src + i));
+    dest[i] = c;
+    if (c == '\0') {
+      return;
+    }
+  }
+  dest[size - 1] = '\0';
+}
+
+#endif // USER_ACCESS_H
@@ -1,45 +1,63 @@
 #include <stddef.h>
 #include "string.h"
 #include "vfs.h"
+#include "memory.h"
+#include "seqlock.h"
 
 
+// Mounts are only ever added, so lookups run locklessly under mounts_seq and
+// the returned VFSMountPoint pointers stay valid
 VFSMountPoint mounts[MAX_MOUNTS];
-VFSFileDescriptor open_files[MAX_OPEN_FILES];
+static SeqLock mounts_seq;
 
 
-static int first_diff_depth(const char* path1, const char* path2) {
-  int depth = -1;
-  char* tmp_path = (char*)path1;
-  char* tmp_mnt_path = (char*)path2;
+// Returns length of mount_path if it is a prefix of path ending at a
+// component boundary, e.g. "/sbin" matches "/sbin" and "/sbin/init" but
+// not "/sbinx". Root matches everything with length 0. Otherwise -1.
+static int mount_prefix_length(const char* path, const char* mount_path) {
+  if (mount_path[0] == PATH_SEPARATOR && mount_path[1] == '\0') {
+    return 0;
+  }
 
-  while (*tmp_path && *tmp_mnt_path && (*tmp_path == *tmp_mnt_path)) {
-    if (*tmp_path == PATH_SEPARATOR) {
-      depth++;
+  int i = 0;
+  while (mount_path[i]) {
+    if (path[i] != mount_path[i]) {
+      return -1;
     }
-    tmp_path++;
-    tmp_mnt_path++;
+    i++;
   }
-  return depth;
+
+  if (path[i] != '\0' && path[i] != PATH_SEPARATOR) {
+    return -1;
+  }
+  return i;
 }
 
+// Longest matching mount point wins
 static VFSMountPoint* find_mount_point(const char* path) {
-  VFSMountPoint* winner = NULL;
-  int winner_depth = -1;
+  VFSMountPoint* winner;
+  uint32_t seq;
 
-  for (unsigned i = 0; i < MAX_MOUNTS; i++) {
-    VFSMountPoint* mount = &mounts[i];
+  do {
+    seq = seqlock_read_begin(&mounts_seq);
+    winner = NULL;
+    int winner_length = -1;
 
-    if (!mount->active) {
-      continue;
-    }
+    for (unsigned i = 0; i < MAX_MOUNTS; i++) {
+      VFSMountPoint* mount = &mounts[i];
 
-    int depth = first_diff_depth(path, mount->path);
+      if (!mount->active) {
+        continue;
+      }
 
-    if (depth > winner_depth) {
-      winner_depth = depth;
-      winner = mount;
+      int length = mount_prefix_length(path, mount->path);
+
+      if (length > winner_length) {
+        winner_length = length;
+        winner = mount;
+      }
     }
-  }
+  } while (seqlock_read_retry(&mounts_seq, seq));
 
   return winner;
 }
@@ -72,13 +90,14 @@ get_path_without_mount_point(const char* path, const char* mount_point) {
   return path_without_mount_point;
 }
 
+// mounts_seq must be held for writing
 static bool is_mountpoint(const char* path) {
   for (unsigned i = 0; i < MAX_MOUNTS; i++) {
-    if (strcmp(mounts[i].path, path)) {
-      return false;
+    if (mounts[i].active && !strcmp(mounts[i].path, path)) {
+      return true;
     }
   }
-  return true;
+  return false;
 }
 
 static bool is_valid_path(const char* path) {
@@ -110,7 +129,7 @@ static bool is_valid_path(const char* path) {
   
     i++;
 
-    if (i > NAME_MAX) {
+    if (i >= NAME_MAX) {
       // Too long
       return false;
     }
@@ -124,8 +143,11 @@ int vfs_mount(const char *path, VFSInterface *fs, void *fs_data) {
     return -1;
   }
 
+  int ret = -1;
+  seqlock_write_acquire(&mounts_seq);
+
   if (is_mountpoint(path)) {
-    return -1;  // Cannot mount multiple times to same path
+    goto out;  // Cannot mount multiple times to same path
   }
 
   for (unsigned i = 0; i < MAX_MOUNTS; i++) {
@@ -138,10 +160,13 @@ int vfs_mount(const char *path, VFSInterface *fs, void *fs_data) {
     mount->fs = fs;
     mount->fs_data = fs_data;
     mount->active = true;
-    return 0;
+    ret = 0;
+    break;
   }
 
-  return -1;
+out:
+  seqlock_write_release(&mounts_seq);
+  return ret;
 }
 
 
@@ -152,18 +177,6 @@ VFSFileDescriptor* vfs_open(const char *path, int flags, mode_t mode) {
     return NULL;
   }
 
-  // Find free slot
-  int free_fd_slot = -1;
-  for (unsigned i = 0; i < MAX_OPEN_FILES; i++) {
-    if (!open_files[i].allocated) {
-      free_fd_slot = i;
-      break;
-    }
-  }
-  if (free_fd_slot == -1) {
-    return NULL;
-  }
-
   VFSMountPoint* mount_point = find_mount_point(path);
   if (mount_point == NULL) {
     return NULL;
@@ -180,8 +193,13 @@ VFSFileDescriptor* vfs_open(const char *path, int flags, mode_t mode) {
     return NULL;
   }
 
-  VFSFileDescriptor* vfs_fd = &open_files[free_fd_slot];
-  vfs_fd->allocated = true;
+  VFSFileDescriptor* vfs_fd = k_zalloc(sizeof(VFSFileDescriptor));
+  if (vfs_fd == NULL) {
+    mount_point->fs->close(mount_point->fs_data, file_handle);
+    return NULL;
+  }
+
+  vfs_fd->ref_count = 1;
   vfs_fd->mount = mount_point;
   vfs_fd->opaque_file_handle = file_handle;
   vfs_fd->mode = mode;
@@ -190,23 +208,113 @@ VFSFileDescriptor* vfs_open(const char *path, int flags, mode_t mode) {
 }
 
 
-ssize_t vfs_read(VFSFileDescriptor* fd, void *buffer, size_t size) {
+// Offset based operations, fd->lock must be held
+static inline ssize_t read_locked(VFSFileDescriptor* fd, void *buffer, size_t size) {
   return fd->mount->fs->read(fd->mount->fs_data, fd->opaque_file_handle, buffer, size);
 }
 
-ssize_t vfs_write(VFSFileDescriptor* fd, const void *buffer, size_t size) {
+static inline ssize_t write_locked(VFSFileDescriptor* fd, const void *buffer, size_t size) {
   return fd->mount->fs->write(fd->mount->fs_data, fd->opaque_file_handle, buffer, size);
 }
 
+ssize_t vfs_read(VFSFileDescriptor* fd, void *buffer, size_t size) {
+  kmutex_lock(&fd->lock);
+  ssize_t ret = read_locked(fd, buffer, size);
+  kmutex_unlock(&fd->lock);
+  return ret;
+}
+
+ssize_t vfs_write(VFSFileDescriptor* fd, const void *buffer, size_t size) {
+  kmutex_lock(&fd->lock);
+  ssize_t ret = write_locked(fd, buffer, size);
+  kmutex_unlock(&fd->lock);
+  return ret;
+}
+
+ssize_t vfs_pread(VFSFileDescriptor* fd, void* buffer, size_t size, off_t offset) {
+  if (offset < 0) {
+    return -1;
+  }
+  return fd->mount->fs->pread(fd->mount->fs_data, fd->opaque_file_handle, buffer, size, offset);
+}
+
+ssize_t vfs_pwrite(VFSFileDescriptor* fd, const void* buffer, size_t size, off_t offset) {
+  if (offset < 0) {
+    return -1;
+  }
+  return fd->mount->fs->pwrite(fd->mount->fs_data, fd->opaque_file_handle, buffer, size, offset);
+}
+
+ssize_t vfs_readv(VFSFileDescriptor* fd, const struct iovec* iov, int iovcnt) {
+  if (iovcnt < 0 || iovcnt > IOV_MAX) {
+    return -1;
+  }
+
+  // Whole vector is read atomically with respect to the file offset
+  kmutex_lock(&fd->lock);
+
+  ssize_t total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    ssize_t ret = read_locked(fd, iov[i].iov_base, iov[i].iov_len);
+    if (ret < 0) {
+      // Report partial success if something was already read
+      total = (total > 0) ? total : ret;
+      break;
+    }
+    total += ret;
+    if ((size_t)ret < iov[i].iov_len) {
+      break;  // End of file
+    }
+  }
+
+  kmutex_unlock(&fd->lock);
+  return total;
+}
+
+ssize_t vfs_writev(VFSFileDescriptor* fd, const struct iovec* iov, int iovcnt) {
+  if (iovcnt < 0 || iovcnt > IOV_MAX) {
+    return -1;
+  }
+
+  kmutex_lock(&fd->lock);
+
+  ssize_t total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    ssize_t ret = write_locked(fd, iov[i].iov_base, iov[i].iov_len);
+    if (ret < 0) {
+      total = (total > 0) ? total : ret;
+      break;
+    }
+    total += ret;
+    if ((size_t)ret < iov[i].iov_len) {
+      break;  // File full
+    }
+  }
+
+  kmutex_unlock(&fd->lock);
+  return total;
+}
+
+VFSFileDescriptor* vfs_dup(VFSFileDescriptor* fd) {
+  atomic_fetch_add_explicit(&fd->ref_count, 1, memory_order_relaxed);
+  return fd;
+}
+
 int vfs_close(VFSFileDescriptor* fd) {
+  if (atomic_fetch_sub_explicit(&fd->ref_count, 1, memory_order_acq_rel) != 1) {
+    return 0;  // Still referenced elsewhere
+  }
+
   int res = fd->mount->fs->close(fd->mount->fs_data, fd->opaque_file_handle);
-  fd->allocated = false;
-  fd->opaque_file_handle = NULL;
+  k_free(fd);
   return res;
 }
 
 int vfs_seek(VFSFileDescriptor* fd, size_t offset) {
-  return fd->mount->fs->seek(fd->mount->fs_data, fd->opaque_file_handle, offset);
+  kmutex_lock(&fd->lock);
+  int ret = fd->mount->fs->seek(fd->mount->fs_data, fd->opaque_file_handle, offset);
+  kmutex_unlock(&fd->lock);
+  return ret;
 }
 
 int vfs_mkdir(const char* path) {
@@ -222,7 +330,10 @@ int vfs_mkdir(const char* path) {
 }
 
 int vfs_readdir(VFSFileDescriptor* fd, char* buffer, size_t size) {
-  return fd->mount->fs->readdir(fd->mount->fs_data, fd->opaque_file_handle, buffer, size);
+  kmutex_lock(&fd->lock);
+  int ret = fd->mount->fs->readdir(fd->mount->fs_data, fd->opaque_file_handle, buffer, size);
+  kmutex_unlock(&fd->lock);
+  return ret;
 }
 
 int vfs_remove(const char* path) {
@@ -6,7 +6,9 @@
 #include <stdbool.h>
 
 #include "sys/types.h"
+#include "sys/uio.h"
 #include "fcntl.h"
+#include "kmutex.h"
 
 #define NAME_MAX 64
 #define MAX_OPEN_FILES 64
@@ -23,6 +25,9 @@ typedef struct VFSInterface {
   void* (*open)(void* fs_data, const char* path, int flags, mode_t mode);
   ssize_t (*read)(void* fs_data, void* file, void* buffer, size_t size);
   ssize_t (*write)(void* fs_data, void* file, const void* buffer, size_t size);
+  // Positional variants, don't move the file offset
+  ssize_t (*pread)(void* fs_data, void* file, void* buffer, size_t size, off_t offset);
+  ssize_t (*pwrite)(void* fs_data, void* file, const void* buffer, size_t size, off_t offset);
   int (*close)(void* fs_data, void* file);
   int (*seek)(void* fs_data, void* file, size_t offset);
   int (*mkdir)(void* fs_data, const char* path);
@@ -38,8 +43,11 @@ typedef struct VFSMountPoint {
   bool active;
 } VFSMountPoint;
 
+// Open file object, shared by all process fds referring to it (e.g. after fork).
+// Freed when the last reference is dropped with vfs_close.
 typedef struct VFSFileDescriptor {
-  bool allocated;
+  _Atomic uint32_t ref_count;
+  KMutex lock;  // Serializes operations that use the file offset
   VFSMountPoint* mount;
   void* opaque_file_handle;
   unsigned mode;
@@ -49,6 +57,14 @@ int vfs_mount(const char* path, VFSInterface* fs, void* fs_data);
 VFSFileDescriptor* vfs_open(const char* path, int flags, mode_t mode);
 ssize_t vfs_read(VFSFileDescriptor* fd, void* buffer, size_t size);
 ssize_t vfs_write(VFSFileDescriptor* fd, const void* buffer, size_t size);
+ssize_t vfs_pread(VFSFileDescriptor* fd, void* buffer, size_t size, off_t offset);
+ssize_t vfs_pwrite(VFSFileDescriptor* fd, const void* buffer, size_t size, off_t offset);
+// Vectored I/O, iov buffers must be kernel memory
+ssize_t vfs_readv(VFSFileDescriptor* fd, const struct iovec* iov, int iovcnt);
+ssize_t vfs_writev(VFSFileDescriptor* fd, const struct iovec* iov, int iovcnt);
+// Take another reference to an open file
+VFSFileDescriptor* vfs_dup(VFSFileDescriptor* fd);
+// Drop a reference, the file is closed when the last one is dropped
 int vfs_close(VFSFileDescriptor* fd);
 int vfs_seek(VFSFileDescriptor* fd, size_t offset);
 int vfs_mkdir(const char* path);
@@ -0,0 +1,65 @@
+#include <stddef.h>
+
+#include "wait-queue.h"
+
+void wait_queue_init(WaitQueue* queue) {
+  queue->head = NULL;
+  queue->tail = NULL;
+  queue->count = 0;
+}
+
+uint64_t wait_queue_wait(WaitQueue* queue, Spinlock* lock) {
+  WaitQueueEntry entry = {
+    .task = sched_get_cpu_current_task(),
+    .value = 0,
+    .woken = false,
+    .next = NULL
+  };
+
+  if (queue->tail != NULL) {
+    queue->tail->next = &entry;
+  } else {
+    queue->head = &entry;
+  }
+  queue->tail = &entry;
+  queue->count++;
+
+  spinlock_release(lock);
+
+  while (!atomic_load_explicit(&entry.woken, memory_order_acquire)) {
+    sched_block_current_task_unless(&entry.woken);
+  }
+
+  return entry.value;
+}
+
+bool wait_queue_wake_one(WaitQueue* queue, uint64_t value) {
+  WaitQueueEntry* entry = queue->head;
+  if (entry == NULL) {
+    return false;
+  }
+
+  queue->head = entry->next;
+  if (queue->head == NULL) {
+    queue->tail = NULL;
+  }
+  queue->count--;
+
+  // Entry is gone as soon as woken is set, the waiter may return
+  entry->value = value;
+  sched_wake_task_if(entry->task, &entry->woken);
+
+  return true;
+}
+
+uint32_t wait_queue_wake_n(WaitQueue* queue, uint32_t n, uint64_t value) {
+  uint32_t woken = 0;
+  while (woken < n && wait_queue_wake_one(queue, value)) {
+    woken++;
+  }
+  return woken;
+}
+
+uint32_t wait_queue_wake_all(WaitQueue* queue, uint64_t value) {
+  return wait_queue_wake_n(queue, WAIT_QUEUE_WAKE_ALL, value);
+}
@@ -0,0 +1,63 @@
+#ifndef WAIT_QUEUE_H
+#define WAIT_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "sched.h"
+#include "spinlock.h"
+
+#define WAIT_QUEUE_WAKE_ALL UINT32_MAX
+
+// Entry lives on the stack of the sleeping task for as long as it's queued
+typedef struct WaitQueueEntry {
+  Task* task;
+  uint64_t value;  // Handed over by the waker
+  _Atomic bool woken;
+  struct WaitQueueEntry* next;
+} WaitQueueEntry;
+
+/*
+ * FIFO queue of sleeping tasks. The queue has no lock of its own, it's
+ * protected by the lock of the object it belongs to (e.g. semaphore), so
+ * that checking a condition and going to sleep is atomic:
+ *
+ *   spinlock_acquire(&obj->lock);
+ *   if (!condition) {
+ *     value = wait_queue_wait(&obj->queue, &obj->lock);  // releases lock
+ *   } else {
+ *     ...
+ *     spinlock_release(&obj->lock);
+ *   }
+ *
+ * Wakers can pass a value to the woken task directly (e.g. a semaphore
+ * unit or a received byte), so the woken task doesn't need to retake the
+ * lock and compete with new arrivals.
+ */
+typedef struct WaitQueue {
+  WaitQueueEntry* head;
+  WaitQueueEntry* tail;
+  uint32_t count;
+} WaitQueue;
+
+#define WAIT_QUEUE_INIT { NULL, NULL, 0 }
+
+void wait_queue_init(WaitQueue* queue);
+
+// Queues the calling task, releases lock and sleeps until woken.
+// Returns the value passed by the waker. lock is not held on return.
+uint64_t wait_queue_wait(WaitQueue* queue, Spinlock* lock);
+
+// Lock protecting the queue must be held for the functions below.
+// Wakes the first waiter, returns false if the queue was empty
+bool wait_queue_wake_one(WaitQueue* queue, uint64_t value);
+// Wakes up to n first waiters, returns number of woken tasks
+uint32_t wait_queue_wake_n(WaitQueue* queue, uint32_t n, uint64_t value);
+uint32_t wait_queue_wake_all(WaitQueue* queue, uint64_t value);
+
+static inline bool wait_queue_is_empty(const WaitQueue* queue) {
+  return queue->head == NULL;
+}
+
+#endif /* WAIT_QUEUE_H */
@@ -0,0 +1,79 @@
+#include <stdint.h>
+
+#include "unistd.h"
+#include "bench-stats.h"
+
+#define stdout 1
+
+#define SYSCALL_SAMPLES 1000
+// Each fork copies the whole address space and the children exit
+// asynchronously, keep this well below the user memory block count
+#define FORK_SAMPLES    50
+#define FORK_RETRIES    100
+
+static uint64_t samples[SYSCALL_SAMPLES];
+
+// The kernel enables EL0 access with CNTKCTL_EL1.EL0PCTEN
+static inline uint64_t timer_count(void) {
+  uint64_t count;
+  asm volatile ("isb\nmrs %0, cntpct_el0" : "=r"(count) :: "memory");
+  return count;
+}
+
+static inline uint64_t timer_freq(void) {
+  uint64_t freq;
+  asm volatile ("mrs %0, cntfrq_el0" : "=r"(freq));
+  return freq;
+}
+
+static void report(const char* name, size_t count) {
+  BenchSummary summary;
+  bench_summarize(samples, count, &summary);
+
+  char line[BENCH_LINE_MAX];
+  int len = bench_format(line, sizeof(line), name, &summary);
+  if (len > 0) {
+    write(stdout, line, (size_t)len);
+  }
+}
+
+static void delay_ticks(uint64_t ticks) {
+  uint64_t end = timer_count() + ticks;
+  while (timer_count() < end) {
+  }
+}
+
+int main() {
+  uint64_t freq = timer_freq();
+
+  for (size_t i = 0; i < SYSCALL_SAMPLES; i++) {
+    uint64_t start = timer_count();
+    (void)getpid();
+    uint64_t end = timer_count();
+    samples[i] = bench_ticks_to_ns(end - start, freq);
+  }
+  report("syscall_getpid_rt", SYSCALL_SAMPLES);
+
+  // Parent side only, fork to return in the parent
+  size_t count = 0;
+  int failures = 0;
+  while (count < FORK_SAMPLES && failures < FORK_RETRIES) {
+    uint64_t start = timer_count();
+    pid_t pid = fork();
+    uint64_t end = timer_count();
+
+    if (pid == 0) {
+      _exit(0);
+    }
+    if (pid < 0) {
+      // Out of user memory until earlier children are reaped
+      failures++;
+      delay_ticks(freq / 1000);
+      continue;
+    }
+    samples[count++] = bench_ticks_to_ns(end - start, freq);
+  }
+  report("fork", count);
+
+  return 0;
+}
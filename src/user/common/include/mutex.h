@@ -0,0 +1,26 @@
+#ifndef MUTEX_H
+#define MUTEX_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Futex based mutex. Lock and unlock stay in user space unless there is
+// contention, only then futex_wait/futex_wake are called.
+//
+// Limitation: processes are single-threaded and don't share memory, so
+// only the calling process can hold a mutex. Locking one it already holds
+// blocks it in futex_wait for good. Until threads or shared mappings
+// exist, the contended path is untested scaffolding.
+typedef struct mutex_t {
+  // 0: unlocked, 1: locked, 2: locked and someone may be waiting
+  _Atomic uint32_t state;
+} mutex_t;
+
+#define MUTEX_INITIALIZER { 0 }
+
+void mutex_lock(mutex_t* mutex);
+// Returns 0 if the lock was taken, -1 if it's held by someone else
+int mutex_trylock(mutex_t* mutex);
+void mutex_unlock(mutex_t* mutex);
+
+#endif // MUTEX_H
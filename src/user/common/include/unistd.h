@@ -1,5 +1,7 @@
 #include <stddef.h>
 #include "sys/types.h"
+#include "sys/uio.h"
+#include "io-ring.h"
 
 /* process */
 void _exit(int status);
@@ -14,4 +16,28 @@ unsigned int sleep(unsigned int seconds);
 int open(const char *path, int flags, int mode);
 ssize_t write(int fd, const void *buf, size_t count);
 ssize_t read(int fd, void *buf, size_t count);
-int close(int fd);
\ No newline at end of file
+int close(int fd);
+ssize_t pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset);
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt);
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt);
+
+/* asynchronous io */
+// Returns the ring shared with the kernel, or NULL on failure
+IORing* io_ring_setup(unsigned int flags);
+// Returns next free SQE to fill in, or NULL if the submission queue is full
+IORingSQE* io_ring_get_sqe(IORing* ring);
+// Publishes all SQEs taken with io_ring_get_sqe and waits for at least
+// wait_nr completions. Traps only if needed: in SQPOLL mode with
+// wait_nr == 0 no syscall is made, unless the worker has gone idle.
+int io_ring_submit(IORing* ring, unsigned int wait_nr);
+// Pops one completion to cqe, returns 0 on success or -1 if none available
+int io_ring_reap(IORing* ring, IORingCQE* cqe);
+
+/* synchronization */
+// Sleeps until futex_wake on uaddr, if *uaddr == expected at the time of the
+// call. Returns 0 when woken, -1 if the value was different. Waiters are
+// per process and processes don't share memory yet, see futex.h.
+int futex_wait(_Atomic uint32_t* uaddr, uint32_t expected);
+// Wakes up to count waiters of uaddr, returns number of waiters woken
+int futex_wake(_Atomic uint32_t* uaddr, int count);
\ No newline at end of file
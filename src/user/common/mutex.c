@@ -0,0 +1,44 @@
+#include "mutex.h"
+#include "unistd.h"
+
+#define MUTEX_UNLOCKED  0
+#define MUTEX_LOCKED    1
+#define MUTEX_CONTENDED 2
+
+void mutex_lock(mutex_t* mutex) {
+  uint32_t expected = MUTEX_UNLOCKED;
+  if (atomic_compare_exchange_strong_explicit(&mutex->state, &expected, MUTEX_LOCKED,
+                                              memory_order_acquire,
+                                              memory_order_relaxed)) {
+    return;  // Fast path, no syscall
+  }
+
+  // Mark contended so that the holder knows to wake us on unlock
+  if (expected != MUTEX_CONTENDED) {
+    expected = atomic_exchange_explicit(&mutex->state, MUTEX_CONTENDED,
+                                        memory_order_acquire);
+  }
+
+  while (expected != MUTEX_UNLOCKED) {
+    futex_wait(&mutex->state, MUTEX_CONTENDED);
+    expected = atomic_exchange_explicit(&mutex->state, MUTEX_CONTENDED,
+                                        memory_order_acquire);
+  }
+}
+
+int mutex_trylock(mutex_t* mutex) {
+  uint32_t expected = MUTEX_UNLOCKED;
+  if (atomic_compare_exchange_strong_explicit(&mutex->state, &expected, MUTEX_LOCKED,
+                                              memory_order_acquire,
+                                              memory_order_relaxed)) {
+    return 0;
+  }
+  return -1;
+}
+
+void mutex_unlock(mutex_t* mutex) {
+  if (atomic_exchange_explicit(&mutex->state, MUTEX_UNLOCKED,
+                               memory_order_release) == MUTEX_CONTENDED) {
+    futex_wake(&mutex->state, 1);
+  }
+}
@@ -97,3 +97,80 @@ int close(int fd) {
   make_syscall(SYS_CLOSE, &ret, fd);
   return (int)ret;
 }
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+  long ret = -1;
+  make_syscall(SYS_PREAD, &ret, fd, buf, count, offset);
+  return (ssize_t)ret;
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
+  long ret = -1;
+  make_syscall(SYS_PWRITE, &ret, fd, buf, count, offset);
+  return (ssize_t)ret;
+}
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
+  long ret = -1;
+  make_syscall(SYS_READV, &ret, fd, iov, iovcnt);
+  return (ssize_t)ret;
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+  long ret = -1;
+  make_syscall(SYS_WRITEV, &ret, fd, iov, iovcnt);
+  return (ssize_t)ret;
+}
+
+IORing* io_ring_setup(unsigned int flags) {
+  long ret = -1;
+  make_syscall(SYS_IO_RING_SETUP, &ret, flags);
+  return (ret == -1) ? NULL : (IORing*)ret;
+}
+
+IORingSQE* io_ring_get_sqe(IORing* ring) {
+  uint32_t head = atomic_load_explicit(&ring->sq_head, memory_order_acquire);
+  if (ring->sq_pending - head >= IO_RING_ENTRIES) {
+    return NULL;  // Full
+  }
+  return &ring->sqes[ring->sq_pending++ & IO_RING_MASK];
+}
+
+int io_ring_submit(IORing* ring, unsigned int wait_nr) {
+  // Sequentially consistent, pairs with the worker setting NEED_WAKEUP
+  // before its last look at sq_tail
+  atomic_store(&ring->sq_tail, ring->sq_pending);
+
+  if ((ring->flags & IO_RING_SETUP_SQPOLL) && wait_nr == 0 &&
+      !(atomic_load(&ring->sq_flags) & IO_RING_SQ_NEED_WAKEUP)) {
+    return 0;
+  }
+
+  long ret = -1;
+  make_syscall(SYS_IO_RING_ENTER, &ret, wait_nr);
+  return (int)ret;
+}
+
+int io_ring_reap(IORing* ring, IORingCQE* cqe) {
+  uint32_t head = atomic_load_explicit(&ring->cq_head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&ring->cq_tail, memory_order_acquire);
+  if (head == tail) {
+    return -1;  // Empty
+  }
+
+  *cqe = ring->cqes[head & IO_RING_MASK];
+  atomic_store_explicit(&ring->cq_head, head + 1, memory_order_release);
+  return 0;
+}
+
+int futex_wait(_Atomic uint32_t* uaddr, uint32_t expected) {
+  long ret = -1;
+  make_syscall(SYS_FUTEX_WAIT, &ret, uaddr, expected);
+  return (int)ret;
+}
+
+int futex_wake(_Atomic uint32_t* uaddr, int count) {
+  long ret = -1;
+  make_syscall(SYS_FUTEX_WAKE, &ret, uaddr, count);
+  return (int)ret;
+}
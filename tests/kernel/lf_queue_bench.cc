@@ -0,0 +1,110 @@
+// Throughput of the kernel lock-free queues on the host, compared with a
+// mutex protected ring. Usage: lf_queue_bench [items_per_producer]
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "lf_queue_shim.h"
+
+namespace {
+
+constexpr size_t kCapacity = 1024;
+
+// Baseline with the same interface
+class MutexRing {
+ public:
+  bool push(uint64_t v) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (head_ - tail_ == kCapacity) {
+      return false;
+    }
+    buf_[head_++ % kCapacity] = v;
+    return true;
+  }
+  bool pop(uint64_t* v) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (head_ == tail_) {
+      return false;
+    }
+    *v = buf_[tail_++ % kCapacity];
+    return true;
+  }
+
+ private:
+  std::mutex lock_;
+  uint64_t buf_[kCapacity];
+  size_t head_ = 0;
+  size_t tail_ = 0;
+};
+
+template <typename Push, typename Pop>
+double run(int producers, int consumers, uint64_t items_per_producer, Push push, Pop pop) {
+  const uint64_t total = (uint64_t)producers * items_per_producer;
+  std::atomic<uint64_t> popped{0};
+  std::vector<std::thread> threads;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&] {
+      for (uint64_t i = 0; i < items_per_producer; i++) {
+        while (!push(i)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (int c = 0; c < consumers; c++) {
+    threads.emplace_back([&] {
+      uint64_t v;
+      while (popped.load(std::memory_order_relaxed) < total) {
+        if (pop(&v)) {
+          popped.fetch_add(1, std::memory_order_relaxed);
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  return total / elapsed.count() / 1e6;
+}
+
+void bench(const char* name, ShimQueueKind kind, int producers, int consumers, uint64_t items) {
+  ShimQueue* q = shim_queue_create(kind, kCapacity, sizeof(uint64_t));
+  double lf = run(producers, consumers, items,
+                  [q](uint64_t v) { return shim_queue_push(q, &v); },
+                  [q](uint64_t* v) { return shim_queue_pop(q, v); });
+  shim_queue_destroy(q);
+
+  auto ring = std::make_unique<MutexRing>();
+  double locked = run(producers, consumers, items,
+                      [&](uint64_t v) { return ring->push(v); },
+                      [&](uint64_t* v) { return ring->pop(v); });
+
+  printf("%-5s %dP/%dC: lock-free %7.2f Mops/s, mutex %7.2f Mops/s\n",
+         name, producers, consumers, lf, locked);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint64_t items = (argc > 1) ? strtoull(argv[1], nullptr, 0) : 2000000;
+
+  bench("SPSC", SHIM_QUEUE_SPSC, 1, 1, items);
+  bench("MPSC", SHIM_QUEUE_MPSC, 2, 1, items / 2);
+  bench("MPSC", SHIM_QUEUE_MPSC, 4, 1, items / 4);
+  bench("MPMC", SHIM_QUEUE_MPMC, 2, 2, items / 2);
+  bench("MPMC", SHIM_QUEUE_MPMC, 4, 4, items / 4);
+  return 0;
+}
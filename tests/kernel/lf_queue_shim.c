@@ -0,0 +1,75 @@
+#include <stdlib.h>
+
+#include "lf_queue_shim.h"
+#include "lf-queue.h"
+
+struct ShimQueue {
+  ShimQueueKind kind;
+  union {
+    SPSCQueue spsc;
+    MPSCQueue mpsc;
+    MPMCQueue mpmc;
+  };
+  void* buffer;
+};
+
+ShimQueue* shim_queue_create(ShimQueueKind kind, size_t capacity, size_t elem_size) {
+  ShimQueue* q = aligned_alloc(LF_QUEUE_CACHE_LINE, sizeof(ShimQueue));
+  if (q == NULL) {
+    return NULL;
+  }
+  q->kind = kind;
+  // Big enough for any kind, alignment like k_malloc
+  q->buffer = aligned_alloc(8, MPMC_QUEUE_BUFFER_SIZE(capacity > 0 ? capacity : 1,
+                                                      elem_size > 0 ? elem_size : 1));
+
+  int ret = -1;
+  switch (kind) {
+  case SHIM_QUEUE_SPSC:
+    ret = spsc_queue_init(&q->spsc, q->buffer, capacity, elem_size);
+    break;
+  case SHIM_QUEUE_MPSC:
+    ret = mpsc_queue_init(&q->mpsc, q->buffer, capacity, elem_size);
+    break;
+  case SHIM_QUEUE_MPMC:
+    ret = mpmc_queue_init(&q->mpmc, q->buffer, capacity, elem_size);
+    break;
+  }
+
+  if (ret != 0) {
+    shim_queue_destroy(q);
+    return NULL;
+  }
+  return q;
+}
+
+void shim_queue_destroy(ShimQueue* q) {
+  if (q != NULL) {
+    free(q->buffer);
+    free(q);
+  }
+}
+
+bool shim_queue_push(ShimQueue* q, const void* elem) {
+  switch (q->kind) {
+  case SHIM_QUEUE_SPSC:
+    return spsc_queue_push(&q->spsc, elem);
+  case SHIM_QUEUE_MPSC:
+    return mpsc_queue_push(&q->mpsc, elem);
+  case SHIM_QUEUE_MPMC:
+    return mpmc_queue_push(&q->mpmc, elem);
+  }
+  return false;
+}
+
+bool shim_queue_pop(ShimQueue* q, void* out) {
+  switch (q->kind) {
+  case SHIM_QUEUE_SPSC:
+    return spsc_queue_pop(&q->spsc, out);
+  case SHIM_QUEUE_MPSC:
+    return mpsc_queue_pop(&q->mpsc, out);
+  case SHIM_QUEUE_MPMC:
+    return mpmc_queue_pop(&q->mpmc, out);
+  }
+  return false;
+}
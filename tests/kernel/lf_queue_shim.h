@@ -0,0 +1,29 @@
+#ifndef LF_QUEUE_SHIM_H
+#define LF_QUEUE_SHIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  SHIM_QUEUE_SPSC,
+  SHIM_QUEUE_MPSC,
+  SHIM_QUEUE_MPMC
+} ShimQueueKind;
+
+typedef struct ShimQueue ShimQueue;
+
+// NULL if the kernel init function rejects the arguments
+ShimQueue* shim_queue_create(ShimQueueKind kind, size_t capacity, size_t elem_size);
+void shim_queue_destroy(ShimQueue* q);
+bool shim_queue_push(ShimQueue* q, const void* elem);
+bool shim_queue_pop(ShimQueue* q, void* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LF_QUEUE_SHIM_H
@@ -0,0 +1,179 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "lf_queue_shim.h"
+
+namespace {
+
+struct Item {
+  uint32_t producer;
+  uint32_t seq;
+};
+
+struct QueueDeleter {
+  void operator()(ShimQueue* q) const { shim_queue_destroy(q); }
+};
+using QueuePtr = std::unique_ptr<ShimQueue, QueueDeleter>;
+
+QueuePtr make_queue(ShimQueueKind kind, size_t capacity, size_t elem_size) {
+  return QueuePtr(shim_queue_create(kind, capacity, elem_size));
+}
+
+class LFQueueTest : public ::testing::TestWithParam<ShimQueueKind> {};
+
+/* BASIC FUNCTIONALITY */
+TEST_P(LFQueueTest, RejectsInvalidArguments) {
+  EXPECT_EQ(make_queue(GetParam(), 0, 4), nullptr);
+  EXPECT_EQ(make_queue(GetParam(), 3, 4), nullptr);
+  EXPECT_EQ(make_queue(GetParam(), 100, 4), nullptr);
+  EXPECT_EQ(make_queue(GetParam(), 16, 0), nullptr);
+  EXPECT_NE(make_queue(GetParam(), 1, 4), nullptr);
+  EXPECT_NE(make_queue(GetParam(), 16, 4), nullptr);
+}
+
+TEST_P(LFQueueTest, PopFromEmptyFails) {
+  QueuePtr q = make_queue(GetParam(), 8, sizeof(uint64_t));
+  ASSERT_NE(q, nullptr);
+
+  uint64_t out = 0xAA;
+  EXPECT_FALSE(shim_queue_pop(q.get(), &out));
+  EXPECT_EQ(out, 0xAAu);
+}
+
+TEST_P(LFQueueTest, IsFifoAndFullAtCapacity) {
+  QueuePtr q = make_queue(GetParam(), 8, sizeof(uint64_t));
+  ASSERT_NE(q, nullptr);
+
+  for (uint64_t i = 0; i < 8; i++) {
+    EXPECT_TRUE(shim_queue_push(q.get(), &i));
+  }
+  uint64_t extra = 100;
+  EXPECT_FALSE(shim_queue_push(q.get(), &extra));
+
+  for (uint64_t i = 0; i < 8; i++) {
+    uint64_t out = 0;
+    ASSERT_TRUE(shim_queue_pop(q.get(), &out));
+    EXPECT_EQ(out, i);
+  }
+  uint64_t out = 0;
+  EXPECT_FALSE(shim_queue_pop(q.get(), &out));
+}
+
+TEST_P(LFQueueTest, WrapsAroundManyLaps) {
+  QueuePtr q = make_queue(GetParam(), 4, sizeof(uint32_t));
+  ASSERT_NE(q, nullptr);
+
+  uint32_t next_pop = 0;
+  for (uint32_t i = 0; i < 1000; i++) {
+    ASSERT_TRUE(shim_queue_push(q.get(), &i));
+    if (i % 3 == 2) {
+      // Drain sometimes, leaving the queue partially filled across laps
+      uint32_t out;
+      while (shim_queue_pop(q.get(), &out)) {
+        ASSERT_EQ(out, next_pop++);
+      }
+    }
+  }
+}
+
+TEST_P(LFQueueTest, CopiesOddSizedElements) {
+  struct Odd {
+    char bytes[13];
+  };
+  QueuePtr q = make_queue(GetParam(), 4, sizeof(Odd));
+  ASSERT_NE(q, nullptr);
+
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 4; i++) {
+      Odd in;
+      memset(in.bytes, 'a' + i + round, sizeof(in.bytes));
+      ASSERT_TRUE(shim_queue_push(q.get(), &in));
+    }
+    for (int i = 0; i < 4; i++) {
+      Odd out;
+      ASSERT_TRUE(shim_queue_pop(q.get(), &out));
+      for (char c : out.bytes) {
+        EXPECT_EQ(c, 'a' + i + round);
+      }
+    }
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(AllKinds, LFQueueTest,
+                         ::testing::Values(SHIM_QUEUE_SPSC, SHIM_QUEUE_MPSC, SHIM_QUEUE_MPMC));
+
+/* STRESS */
+
+// Runs producers and consumers until every item has been popped once.
+// Checks that each producer's items come out in order within one consumer
+// and that nothing is lost or duplicated.
+void stress(ShimQueueKind kind, int producers, int consumers, uint32_t items_per_producer) {
+  QueuePtr q = make_queue(kind, 64, sizeof(Item));
+  ASSERT_NE(q, nullptr);
+
+  const uint64_t total = (uint64_t)producers * items_per_producer;
+  std::atomic<uint64_t> popped{0};
+  std::vector<std::atomic<uint32_t>> seen(total);
+  std::atomic<bool> order_ok{true};
+
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&, p] {
+      for (uint32_t i = 0; i < items_per_producer; i++) {
+        Item item = {(uint32_t)p, i};
+        while (!shim_queue_push(q.get(), &item)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (int c = 0; c < consumers; c++) {
+    threads.emplace_back([&] {
+      std::vector<int64_t> last(producers, -1);
+      while (popped.load() < total) {
+        Item item;
+        if (!shim_queue_pop(q.get(), &item)) {
+          std::this_thread::yield();
+          continue;
+        }
+        if ((int64_t)item.seq <= last[item.producer]) {
+          order_ok = false;
+        }
+        last[item.producer] = item.seq;
+        seen[(uint64_t)item.producer * items_per_producer + item.seq]++;
+        popped++;
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  EXPECT_TRUE(order_ok);
+  EXPECT_EQ(popped.load(), total);
+  for (uint64_t i = 0; i < total; i++) {
+    ASSERT_EQ(seen[i].load(), 1u) << "item " << i;
+  }
+  Item extra;
+  EXPECT_FALSE(shim_queue_pop(q.get(), &extra));
+}
+
+TEST(LFQueueStressTest, SPSC) {
+  stress(SHIM_QUEUE_SPSC, 1, 1, 1000000);
+}
+
+TEST(LFQueueStressTest, MPSC) {
+  stress(SHIM_QUEUE_MPSC, 4, 1, 250000);
+}
+
+TEST(LFQueueStressTest, MPMC) {
+  stress(SHIM_QUEUE_MPMC, 4, 4, 250000);
+}
+
+}  // namespace
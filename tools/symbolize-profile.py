@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""Symbolizes a LaOS profiler dump against the kernel ELF, see src/kernel/profile.h.
+
+Usage: symbolize-profile.py [console log] [-e build/src/kernel/kernel] [--lines]
+
+Reads the console output captured around `profile dump`, other lines are
+ignored. Prints samples per function, and with --lines per source line too.
+PCs outside the kernel image are counted as user space.
+"""
+
+import argparse
+import bisect
+import collections
+import re
+import shutil
+import subprocess
+import sys
+
+DEFAULT_ELF = "build/src/kernel/kernel"
+TOOL_PREFIXES = ("aarch64-none-elf-", "aarch64-linux-gnu-", "")
+
+BEGIN_RE = re.compile(r"profile: begin source=(\w+) period=(\d+)")
+PC_RE = re.compile(r"profile: pc ([0-9a-f]+) (\d+)")
+TASK_RE = re.compile(r"profile: task (-?\d+|other) (\d+)")
+CPU_RE = re.compile(r"profile: cpu (\d+) samples (\d+) lost (\d+)")
+
+
+def find_tool(name, override):
+    if override:
+        return override
+    for prefix in TOOL_PREFIXES:
+        path = shutil.which(prefix + name)
+        if path:
+            return path
+    sys.exit(f"symbolize-profile: {name} not found, pass --{name}")
+
+
+def parse_dump(lines):
+    """Returns (header, PC counts, task counts, per-CPU stats) of the last dump."""
+    header = None
+    pcs = tasks = cpus = None
+    for line in lines:
+        m = BEGIN_RE.search(line)
+        if m:
+            header = (m.group(1), int(m.group(2)))
+            pcs, tasks, cpus = collections.Counter(), collections.Counter(), {}
+            continue
+        if header is None:
+            continue
+        if "profile: end" in line:
+            break
+        m = PC_RE.search(line)
+        if m:
+            pcs[int(m.group(1), 16)] += int(m.group(2))
+            continue
+        m = TASK_RE.search(line)
+        if m:
+            tasks[m.group(1)] += int(m.group(2))
+            continue
+        m = CPU_RE.search(line)
+        if m:
+            cpus[int(m.group(1))] = (int(m.group(2)), int(m.group(3)))
+    if header is None:
+        sys.exit("symbolize-profile: no 'profile: begin' line found")
+    return header, pcs, tasks, cpus
+
+
+def load_symbols(nm, elf):
+    """Returns sorted (address, name) of function symbols and the text end."""
+    out = subprocess.run([nm, "-n", "--defined-only", elf], check=True,
+                         capture_output=True, text=True).stdout
+    symbols = []
+    end = 0
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) != 3:
+            continue
+        addr, kind, name = int(parts[0], 16), parts[1], parts[2]
+        if kind in "tTwW":
+            symbols.append((addr, name))
+        end = max(end, addr)
+    return symbols, end
+
+
+def symbolize(pc, symbols, addrs, text_end):
+    i = bisect.bisect_right(addrs, pc) - 1
+    if i < 0 or pc > text_end:
+        return "[user]"
+    return symbols[i][1]
+
+
+def source_lines(addr2line, elf, pcs):
+    out = subprocess.run([addr2line, "-e", elf] + [hex(pc) for pc in pcs],
+                         check=True, capture_output=True, text=True).stdout
+    return dict(zip(pcs, out.splitlines()))
+
+
+def print_table(title, counter, total, limit):
+    print(f"\n{title}")
+    for name, count in counter.most_common(limit):
+        print(f"  {100.0 * count / total:6.2f}%  {count:8d}  {name}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", nargs="?", help="console log, stdin if omitted")
+    parser.add_argument("-e", "--elf", default=DEFAULT_ELF, help="kernel ELF")
+    parser.add_argument("--lines", action="store_true", help="also list source lines")
+    parser.add_argument("-n", "--limit", type=int, default=30, help="rows per table")
+    parser.add_argument("--nm", help="nm to use, found from PATH by default")
+    parser.add_argument("--addr2line", help="addr2line to use, found from PATH by default")
+    args = parser.parse_args()
+
+    infile = open(args.input, errors="replace") if args.input else sys.stdin
+    with infile:
+        (source, period), pcs, tasks, cpus = parse_dump(infile)
+
+    total = sum(pcs.values())
+    print(f"source {source}, period {period}, {total} samples")
+    for cpu, (samples, lost) in sorted(cpus.items()):
+        print(f"  CPU{cpu}: {samples} samples, {lost} lost")
+    if total == 0:
+        return 0
+
+    symbols, text_end = load_symbols(find_tool("nm", args.nm), args.elf)
+    addrs = [addr for addr, _ in symbols]
+
+    functions = collections.Counter()
+    for pc, count in pcs.items():
+        functions[symbolize(pc, symbols, addrs, text_end)] += count
+
+    print_table("By task", collections.Counter(
+        {f"task {t}": c for t, c in tasks.items()}), total, args.limit)
+    print_table("By function", functions, total, args.limit)
+
+    if args.lines:
+        kernel_pcs = [pc for pc in pcs if symbolize(pc, symbols, addrs, text_end) != "[user]"]
+        locations = source_lines(find_tool("addr2line", args.addr2line), args.elf, kernel_pcs)
+        lines = collections.Counter()
+        for pc in kernel_pcs:
+            lines[locations.get(pc, hex(pc))] += pcs[pc]
+        print_table("By source line", lines, total, args.limit)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""Converts a LaOS trace dump to Chrome trace JSON, see src/kernel/trace.h.
+
+Usage: trace2json.py [console log] [-o trace.json]
+
+Reads the console output captured around `trace dump`, other lines are
+ignored. Each CPU becomes a process with an "irq" thread for interrupts,
+ticks and allocations, and a "tasks" thread showing the running task.
+Syscalls are async events keyed by the calling task, since they block and
+finish in a handler task.
+"""
+
+import argparse
+import json
+import re
+import sys
+
+TRACE_IRQ_ENTRY = 1
+TRACE_IRQ_EXIT = 2
+TRACE_SCHED_TICK = 3
+TRACE_SCHED_SWITCH = 4
+TRACE_SYSCALL_ENTRY = 5
+TRACE_SYSCALL_EXIT = 6
+TRACE_KMALLOC = 7
+
+TID_IRQ = 0
+TID_TASKS = 1
+
+# From src/kernel/armv8-a.h, ipi.h and platform.h
+IRQ_NAMES = {
+    0: "ipi reschedule",
+    1: "ipi call function",
+    2: "ipi bench",
+    30: "timer",
+    96 + 57: "uart",
+}
+
+SYSCALL_HEADER = "src/common/include/syscall-common.h"
+
+BEGIN_RE = re.compile(r"trace: begin freq=(\d+) cpus=(\d+)")
+ENTRY_RE = re.compile(
+    r"trace: (\d+) ([0-9a-f]+) (\d+) ([0-9a-f]+) ([0-9a-f]+) ([0-9a-f]+)")
+
+
+def load_syscall_names(path):
+    names = {}
+    try:
+        with open(path) as f:
+            for line in f:
+                m = re.match(r"#define SYS_(\w+)\s+(\d+)", line)
+                if m:
+                    names[int(m.group(2))] = m.group(1).lower()
+    except OSError:
+        pass
+    return names
+
+
+def parse_dump(lines):
+    """Returns (counter frequency, entries) of the last dump in lines."""
+    freq = None
+    entries = None
+    for line in lines:
+        m = BEGIN_RE.search(line)
+        if m:
+            freq = int(m.group(1))
+            entries = []
+            continue
+        if entries is None:
+            continue
+        if "trace: end" in line:
+            break
+        m = ENTRY_RE.search(line)
+        if m:
+            cpu, ts, event, arg0, arg1, arg2 = m.groups()
+            entries.append((int(cpu), int(ts, 16), int(event),
+                            int(arg0, 16), int(arg1, 16), int(arg2, 16)))
+    if freq is None:
+        raise ValueError("no 'trace: begin' line found")
+    return freq, entries
+
+
+def task_name(task_id):
+    # Ids are signed in the kernel
+    if task_id >= 1 << 63:
+        task_id -= 1 << 64
+    return f"task {task_id}"
+
+
+def convert(freq, entries, syscall_names):
+    entries.sort(key=lambda e: e[1])
+    start = entries[0][1] if entries else 0
+    events = []
+    running = {}  # CPU -> open task slice name
+    cpus = sorted({e[0] for e in entries})
+
+    for cpu in cpus:
+        events.append({"ph": "M", "name": "process_name", "pid": cpu,
+                       "args": {"name": f"CPU{cpu}"}})
+        events.append({"ph": "M", "name": "thread_name", "pid": cpu,
+                       "tid": TID_IRQ, "args": {"name": "irq"}})
+        events.append({"ph": "M", "name": "thread_name", "pid": cpu,
+                       "tid": TID_TASKS, "args": {"name": "tasks"}})
+
+    last_us = 0.0
+    for cpu, ts, event, arg0, arg1, arg2 in entries:
+        us = (ts - start) * 1e6 / freq
+        last_us = us
+        base = {"pid": cpu, "ts": us}
+
+        if event in (TRACE_IRQ_ENTRY, TRACE_IRQ_EXIT):
+            name = IRQ_NAMES.get(arg0, f"irq {arg0}")
+            ph = "B" if event == TRACE_IRQ_ENTRY else "E"
+            events.append({**base, "tid": TID_IRQ, "ph": ph, "name": name})
+        elif event == TRACE_SCHED_TICK:
+            events.append({**base, "tid": TID_IRQ, "ph": "i", "s": "t",
+                           "name": "tick", "args": {"task": task_name(arg1)}})
+        elif event == TRACE_SCHED_SWITCH:
+            if cpu in running:
+                events.append({**base, "tid": TID_TASKS, "ph": "E",
+                               "name": running.pop(cpu)})
+            name = task_name(arg2)
+            running[cpu] = name
+            events.append({**base, "tid": TID_TASKS, "ph": "B", "name": name,
+                           "args": {"voluntary": bool(arg0),
+                                    "prev": task_name(arg1)}})
+        elif event in (TRACE_SYSCALL_ENTRY, TRACE_SYSCALL_EXIT):
+            name = syscall_names.get(arg0, f"syscall {arg0}")
+            ph = "b" if event == TRACE_SYSCALL_ENTRY else "e"
+            events.append({**base, "tid": TID_TASKS, "ph": ph, "cat": "syscall",
+                           "id": arg1, "name": name,
+                           "args": {"task": task_name(arg1)}})
+        elif event == TRACE_KMALLOC:
+            events.append({**base, "tid": TID_IRQ, "ph": "i", "s": "t",
+                           "name": "k_malloc",
+                           "args": {"size": arg1, "ptr": hex(arg2)}})
+
+    for cpu, name in running.items():
+        events.append({"pid": cpu, "tid": TID_TASKS, "ts": last_us, "ph": "E",
+                       "name": name})
+
+    return {"traceEvents": events, "displayTimeUnit": "ns"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", nargs="?", help="console log, stdin if omitted")
+    parser.add_argument("-o", "--output", help="output file, stdout if omitted")
+    parser.add_argument("--syscalls", default=SYSCALL_HEADER,
+                        help="header with SYS_* numbers for syscall names")
+    args = parser.parse_args()
+
+    infile = open(args.input, errors="replace") if args.input else sys.stdin
+    with infile:
+        try:
+            freq, entries = parse_dump(infile)
+        except ValueError as e:
+            print(f"trace2json: {e}", file=sys.stderr)
+            return 1
+
+    trace = convert(freq, entries, load_syscall_names(args.syscalls))
+    outfile = open(args.output, "w") if args.output else sys.stdout
+    with outfile:
+        json.dump(trace, outfile)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())